@@ -10,49 +10,230 @@
 #include "include/message.h"
 #include "include/utils.h"
 #include "include/pairs.h"
+#include "include/batch.h"
+#include "include/binary.h"
+#include "include/crypto.h"
+#include "include/keys.h"
+#include "include/pool.h"
+#include "include/dedup.h"
+#include "include/reliable.h"
+#include "include/epoch.h"
 
 struct AuctionSystem auctionSys;
 extern struct PairSystem pSystem;
 
 #define AUCTION_TIMEOUT 60     // 60 secondes pour t3s
+#define AUCTION_WARNING 10     // Avertissement de fin (CODE 11) envoyé 10 secondes avant la fin
 #define MIN_VALIDATION_COUNT 3 // Minimum number of validations for consensus
+#define AUCTION_BURST 16       // Datagrams handled per call when they arrive in a burst
+#define AUCTION_REPEAT_MS 200  // Délai du second envoi des annonces sans enveloppe numérotée
+#define GROUP_KEY_RETRY_S 5    // Intervalle entre deux demandes de la clé de groupe
+#define AUCTION_STRIPE_BITS 4  // 16 verrous d'enchères
 
 // Compteur pour les ventes initiées par ce pair
 static uint32_t auction_counter = 0;
 
-// Thread pour surveiller les enchères
-pthread_t auction_monitor_thread;
-int monitor_running = 0;
+// Demande en cours de la clé de groupe, quand elle n'a pas été reçue à la liaison
+static EVP_PKEY *rekey_dh = NULL;  // Clé X25519 éphémère, gardée d'une demande à l'autre
+static unsigned char rekey_pub[MESSAGE_KEY_SIZE];
+static time_t rekey_time = 0;      // Date de la dernière demande
+static int rekey_next = 0;         // Rang du prochain pair à interroger
+
+// Messages d'enchères traités récemment, pour ignorer leurs copies
+static struct dedup recent_messages;
+
+// Socket utilisée pour les avertissements et les fins de vente, donnée au premier armement
+static int end_sock = -1;
+static void release_end_timer(struct Auction *auction);
+
+/*
+ * Verrous des enchères
+ *
+ * Les enchères vivent dans une arène de blocs (voir struct AuctionSystem) :
+ * une enchère ne bouge jamais, un pointeur reste valable après avoir relâché
+ * les verrous. store_lock protège la table des blocs, l'index et les slots
+ * libres : pris en lecture pour chercher une enchère à modifier, en écriture
+ * pour en ajouter ou en retirer une. Les champs d'une enchère sont protégés
+ * par le verrou de sa bande, choisie par son ID : des offres sur des enchères
+ * différentes avancent en parallèle. Toujours store_lock avant une bande, et
+ * jamais d'envoi réseau sous un verrou : on copie ce qu'il faut envoyer, puis
+ * on relâche.
+ *
+ * Le prix, le dernier proposant et les dates sont en plus publiés par un
+ * verrou de séquence (seq) : les lecteurs (affichage, fins de vente, copies)
+ * ne prennent pas la bande, ne font jamais attendre une offre et recommencent
+ * si une offre a modifié l'enchère pendant leur lecture.
+ *
+ * Ces lecteurs ne prennent pas non plus store_lock : ils restent dans une
+ * époque (epoch.h) le temps de leur lecture. Une enchère retirée (à sa fin)
+ * sort de l'index et passe live à 0, mais son slot n'est réutilisé qu'une
+ * fois sortis tous les lecteurs qui ont pu la voir ;
+ * les anciennes tables des blocs et de l'index sont libérées de la même
+ * façon. store_seq, impair pendant une écriture, fait recommencer sous le
+ * verrou une recherche sans verrou qui l'a croisée.
+ */
+static pthread_rwlock_t store_lock = PTHREAD_RWLOCK_INITIALIZER;
+static unsigned int store_seq = 0;
+static pthread_mutex_t stripes[1 << AUCTION_STRIPE_BITS];
+
+// store_lock en écriture ; les recherches sans verrou en cours recommenceront
+static void lock_store(void) {
+  pthread_rwlock_wrlock(&store_lock);
+  __atomic_store_n(&store_seq, store_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void unlock_store(void) {
+  __atomic_store_n(&store_seq, store_seq + 1, __ATOMIC_RELEASE);
+  pthread_rwlock_unlock(&store_lock);
+}
+
+static pthread_mutex_t *stripe_of(unsigned int auction_id) {
+  return &stripes[(auction_id * 2654435761u) >> (32 - AUCTION_STRIPE_BITS)];
+}
+
+// Trouve une enchère et la verrouille, à relâcher avec release_auction()
+static struct Auction *acquire_auction(unsigned int auction_id) {
+  pthread_rwlock_rdlock(&store_lock);
+  struct Auction *auction = find_auction(auction_id);
+  if (!auction) {
+    pthread_rwlock_unlock(&store_lock);
+    return NULL;
+  }
+  pthread_mutex_lock(stripe_of(auction_id));
+  return auction;
+}
+
+// L'ID d'une enchère ne change que sous store_lock en écriture : c'est la même bande
+static void release_auction(struct Auction *auction) {
+  pthread_mutex_unlock(stripe_of(auction->auction_id));
+  pthread_rwlock_unlock(&store_lock);
+}
+
+// Publie le nouvel état d'une enchère, sous le verrou de sa bande
+static void publish_state(struct Auction *auction, unsigned int price, unsigned short bidder,
+                          time_t start_time, time_t last_bid_time) {
+  // seq impair : les lecteurs en cours recommenceront
+  __atomic_store_n(&auction->seq, auction->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&auction->current_price, price, __ATOMIC_RELAXED);
+  __atomic_store_n(&auction->id_dernier_prop, bidder, __ATOMIC_RELAXED);
+  __atomic_store_n(&auction->start_time, start_time, __ATOMIC_RELAXED);
+  __atomic_store_n(&auction->last_bid_time, last_bid_time, __ATOMIC_RELAXED);
+  __atomic_store_n(&auction->seq, auction->seq + 1, __ATOMIC_RELEASE);
+}
 
-// Mutex pour protéger l'accès aux enchères
-pthread_mutex_t auction_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Nouvelle offre : prix, proposant et date de la dernière offre
+static void publish_bid(struct Auction *auction, unsigned int price, unsigned short bidder) {
+  publish_state(auction, price, bidder, auction->start_time, time(NULL));
+}
+
+// Copie une enchère sans verrou (dans une époque) ; les champs fixés à la
+// création sont écrits avant qu'elle soit visible
+static void read_auction(const struct Auction *auction, struct Auction *copy) {
+  memset(copy, 0, sizeof(struct Auction));
+  copy->auction_id = auction->auction_id;
+  copy->creator_id = auction->creator_id;
+  copy->initial_price = auction->initial_price;
+  unsigned int before, after;
+  do {
+    before = __atomic_load_n(&auction->seq, __ATOMIC_ACQUIRE);
+    copy->current_price = __atomic_load_n(&auction->current_price, __ATOMIC_RELAXED);
+    copy->id_dernier_prop = __atomic_load_n(&auction->id_dernier_prop, __ATOMIC_RELAXED);
+    copy->start_time = __atomic_load_n(&auction->start_time, __ATOMIC_RELAXED);
+    copy->last_bid_time = __atomic_load_n(&auction->last_bid_time, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&auction->seq, __ATOMIC_RELAXED);
+  } while ((before & 1) || before != after);
+}
+
+// Enchère d'un slot : son bloc ne bouge jamais
+static struct Auction *auction_at(int slot) {
+  struct Auction **chunks = __atomic_load_n(&auctionSys.chunks, __ATOMIC_ACQUIRE);
+  return &chunks[slot >> AUCTION_CHUNK_BITS][slot & (AUCTION_CHUNK - 1)];
+}
+
+// Recherche sans verrou, dans une époque : refaite sous store_lock si l'index a bougé
+static struct Auction *lookup_auction(unsigned int auction_id) {
+  unsigned int before = __atomic_load_n(&store_seq, __ATOMIC_ACQUIRE);
+  if (!(before & 1)) {
+    struct Auction *auction = find_auction(auction_id);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&store_seq, __ATOMIC_RELAXED) == before) return auction;
+  }
+  pthread_rwlock_rdlock(&store_lock);
+  struct Auction *auction = find_auction(auction_id);
+  pthread_rwlock_unlock(&store_lock);
+  return auction;
+}
+
+// Copie l'état d'une enchère, pour le lire sans garder de verrou
+static int copy_auction(unsigned int auction_id, struct Auction *copy) {
+  epoch_enter();
+  struct Auction *auction = lookup_auction(auction_id);
+  if (auction) read_auction(auction, copy);
+  epoch_exit();
+  return auction ? 0 : -1;
+}
+
+// Copie les enchères présentes sans verrou, dans l'ordre des slots ; à libérer par l'appelant
+static struct Auction *copy_all_auctions(int *count) {
+  epoch_enter();
+  int total = __atomic_load_n(&auctionSys.count, __ATOMIC_ACQUIRE);
+  struct Auction *copies = malloc((total > 0 ? total : 1) * sizeof(struct Auction));
+  if (!copies) {
+    epoch_exit();
+    perror("Échec de l'allocation mémoire pour la copie des enchères");
+    return NULL;
+  }
+  int n = 0;
+  for (int i = 0; i < total; i++) {
+    struct Auction *auction = auction_at(i);
+    if (__atomic_load_n(&auction->live, __ATOMIC_ACQUIRE)) read_auction(auction, &copies[n++]);
+  }
+  epoch_exit();
+  *count = n;
+  return copies;
+}
 
 int init_auction_system() {
   // Vérifier que le système n'a pas déjà été initialisé
-  if (auctionSys.auctions != NULL) {
+  if (auctionSys.chunks != NULL) {
     printf("Le système d'enchères est déjà initialisé\n");
     return 0;
   }
 
-  // Allouer la mémoire initiale pour le tableau d'enchères
-  auctionSys.auctions = malloc(10 * sizeof(struct Auction));
-  if (!auctionSys.auctions) {
-    perror("malloc a échoué pour le tableau d'enchères");
+  // Table des blocs de l'arène, le premier bloc est alloué avec la première enchère
+  auctionSys.chunks = calloc(AUCTION_CHUNKS_MIN, sizeof(struct Auction *));
+  if (!auctionSys.chunks) {
+    perror("calloc a échoué pour la table des enchères");
     return -1;
   }
+  auctionSys.chunks_size = AUCTION_CHUNKS_MIN;
 
-  // Initialiser tous les champs à zéro
-  memset(auctionSys.auctions, 0, 10 * sizeof(struct Auction));
+  // Index des enchères par ID
+  auctionSys.index = calloc(1, sizeof(struct AuctionIndex) + AUCTION_INDEX_MIN * sizeof(int));
+  if (!auctionSys.index) {
+    perror("calloc a échoué pour l'index des enchères");
+    free(auctionSys.chunks);
+    auctionSys.chunks = NULL;
+    return -1;
+  }
+  auctionSys.index->size = AUCTION_INDEX_MIN;
 
   // Initialiser les autres champs de la structure
   auctionSys.count = 0;
-  auctionSys.capacity = 10;
+  auctionSys.capacity = 0;
+  auctionSys.free_slots = NULL;
+  auctionSys.free_count = 0;
+  auctionSys.free_capacity = 0;
 
   // Initialiser le compteur d'enchères
   auction_counter = 0;
+  dedup_init(&recent_messages);
 
-  // Initialiser le mutex
-  pthread_mutex_init(&auction_mutex, NULL);
+  // Initialiser les verrous des enchères
+  for (int i = 0; i < (1 << AUCTION_STRIPE_BITS); i++) pthread_mutex_init(&stripes[i], NULL);
 
   printf("Système d'enchères initialisé avec succès\n");
   return 0;
@@ -60,30 +241,34 @@ int init_auction_system() {
 
 void cleanup_auction_system() {
   // Prendre le verrou avant le nettoyage
-  pthread_mutex_lock(&auction_mutex);
-
-  // Arrêter le thread de surveillance
-  if (monitor_running) {
-    monitor_running = 0;
-
-    // Relâcher le verrou pendant que nous attendons le thread
-    pthread_mutex_unlock(&auction_mutex);
-    pthread_join(auction_monitor_thread, NULL);
-    pthread_mutex_lock(&auction_mutex);
-  }
-
-  // Libérer la mémoire des enchères
-  if (auctionSys.auctions != NULL) {
-    free(auctionSys.auctions);
-    auctionSys.auctions = NULL;
-  }
+  lock_store();
+
+  if (auctionSys.chunks != NULL) {
+    // Plus aucun lecteur : les slots et les tables retirés sont rendus tout de suite
+    epoch_cleanup();
+
+    // Libérer les timers puis les blocs des enchères
+    for (int i = 0; i < auctionSys.count; i++) release_end_timer(auction_at(i));
+    for (int i = 0; i < auctionSys.capacity >> AUCTION_CHUNK_BITS; i++) free(auctionSys.chunks[i]);
+    free(auctionSys.chunks);
+    auctionSys.chunks = NULL;
+  }
+  auctionSys.chunks_size = 0;
+  free(auctionSys.index);
+  auctionSys.index = NULL;
+  free(auctionSys.free_slots);
+  auctionSys.free_slots = NULL;
+  auctionSys.free_count = 0;
+  auctionSys.free_capacity = 0;
 
   auctionSys.count = 0;
   auctionSys.capacity = 0;
+  EVP_PKEY_free(rekey_dh);
+  rekey_dh = NULL;
 
-  // Libérer le mutex
-  pthread_mutex_unlock(&auction_mutex);
-  pthread_mutex_destroy(&auction_mutex);
+  // Libérer les verrous
+  unlock_store();
+  for (int i = 0; i < (1 << AUCTION_STRIPE_BITS); i++) pthread_mutex_destroy(&stripes[i]);
 
   printf("Système d'enchères nettoyé avec succès\n");
 }
@@ -98,38 +283,647 @@ unsigned int generate_auction_id() {
   return (unsigned int) atoi(id_str);
 }
 
+// Case de départ de la recherche d'un ID dans l'index (hachage multiplicatif)
+static int index_home(unsigned int auction_id, int size) {
+  return (int) ((auction_id * 2654435761u) & (unsigned int) (size - 1));
+}
+
+// Case de l'index qui contient l'ID, ou la case vide où il s'arrête ; les
+// cases sont lues une à une, l'index peut changer si store_lock n'est pas pris
+static int index_probe(const struct AuctionIndex *index, unsigned int auction_id) {
+  int mask = index->size - 1;
+  int i = index_home(auction_id, index->size);
+  int slot;
+  while ((slot = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE)) != 0 &&
+         auction_at(slot - 1)->auction_id != auction_id) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+// Double la taille de l'index dans une nouvelle table ; l'ancienne est libérée après ses lecteurs
+static int index_grow(void) {
+  struct AuctionIndex *old = auctionSys.index;
+  int size = old->size * 2;
+  struct AuctionIndex *index = calloc(1, sizeof(struct AuctionIndex) + size * sizeof(int));
+  if (!index) {
+    perror("calloc a échoué pour l'index des enchères");
+    return -1;
+  }
+  index->size = size;
+  for (int i = 0; i < old->size; i++) {
+    int slot = old->slots[i];
+    if (slot == 0) continue;
+    int j = index_home(auction_at(slot - 1)->auction_id, size);
+    while (index->slots[j] != 0) j = (j + 1) & (size - 1);
+    index->slots[j] = slot;
+  }
+  __atomic_store_n(&auctionSys.index, index, __ATOMIC_RELEASE);
+  epoch_retire(free, old);
+  return 0;
+}
+
+// Référence le slot dans l'index sous son ID (à appeler une fois l'enchère remplie)
+static int index_insert(int slot) {
+  // Garder l'index à moitié vide pour que les recherches restent courtes
+  if (2 * (auctionSys.count + 1) > auctionSys.index->size && index_grow() < 0) return -1;
+  struct AuctionIndex *index = auctionSys.index;
+  __atomic_store_n(&index->slots[index_probe(index, auction_at(slot)->auction_id)], slot + 1,
+                   __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Retire le slot de l'index, en recollant les entrées qui le suivaient
+static void index_remove(int slot) {
+  struct AuctionIndex *index = auctionSys.index;
+  int mask = index->size - 1;
+  int hole = index_probe(index, auction_at(slot)->auction_id);
+  if (index->slots[hole] != slot + 1) return; // L'ID désigne un autre slot
+  __atomic_store_n(&index->slots[hole], 0, __ATOMIC_RELAXED);
+
+  // Une entrée ne peut remonter dans le trou que s'il est entre sa case de départ et elle
+  for (int i = (hole + 1) & mask; index->slots[i] != 0; i = (i + 1) & mask) {
+    int home = index_home(auction_at(index->slots[i] - 1)->auction_id, index->size);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      __atomic_store_n(&index->slots[hole], index->slots[i], __ATOMIC_RELAXED);
+      __atomic_store_n(&index->slots[i], 0, __ATOMIC_RELAXED);
+      hole = i;
+    }
+  }
+}
+
 // Fonction pour trouver une enchère par son ID
 struct Auction *find_auction(unsigned int auction_id) {
-  for (int i = 0; i < auctionSys.count; i++)
-    if (auctionSys.auctions[i].auction_id == auction_id) return &auctionSys.auctions[i];
-  return NULL;
+  struct AuctionIndex *index = __atomic_load_n(&auctionSys.index, __ATOMIC_ACQUIRE);
+  if (index == NULL) return NULL;
+  int slot = __atomic_load_n(&index->slots[index_probe(index, auction_id)], __ATOMIC_ACQUIRE);
+  return slot != 0 ? auction_at(slot - 1) : NULL;
 }
 
-int handle_auction_message(int auc_sock, int m_send) {
-  struct sockaddr_in6 sender;
-  char buffer[UNKNOWN_SIZE];
-  memset(buffer, 0, sizeof(buffer));
+// Ajoute un bloc à l'arène sans déplacer les autres ; seule la table des
+// pointeurs de blocs double quand elle est pleine
+static int add_chunk(void) {
+  int n = auctionSys.capacity >> AUCTION_CHUNK_BITS;
+  if (n == auctionSys.chunks_size) {
+    int size = auctionSys.chunks_size * 2;
+    struct Auction **chunks = calloc(size, sizeof(struct Auction *));
+    if (!chunks) {
+      perror("calloc a échoué pour la table des enchères");
+      return -1;
+    }
+    memcpy(chunks, auctionSys.chunks, n * sizeof(struct Auction *));
+    struct Auction **old = auctionSys.chunks;
+    __atomic_store_n(&auctionSys.chunks, chunks, __ATOMIC_RELEASE);
+    auctionSys.chunks_size = size;
+    epoch_retire(free, old);
+  }
 
-  int len = receive_multicast(auc_sock, buffer, sizeof(buffer), &sender);
-  if (len <= 0)
-    return 0; // No data or error
+  struct Auction *chunk = calloc(AUCTION_CHUNK, sizeof(struct Auction));
+  if (!chunk) {
+    perror("calloc a échoué pour un bloc d'enchères");
+    return -1;
+  }
+  auctionSys.chunks[n] = chunk;
+  auctionSys.capacity += AUCTION_CHUNK;
+  return 0;
+}
+
+// Rend le slot d'une enchère retirée, appelée par epoch_reclaim() sous store_lock en écriture
+static void recycle_slot(void *arg) {
+  if (auctionSys.free_count == auctionSys.free_capacity) {
+    int capacity = auctionSys.free_capacity > 0 ? auctionSys.free_capacity * 2 : AUCTION_CHUNK;
+    int *free_slots = realloc(auctionSys.free_slots, capacity * sizeof(int));
+    if (!free_slots) {
+      perror("realloc a échoué pour les slots libres");
+      return; // Le slot est perdu, pas l'enchère
+    }
+    auctionSys.free_slots = free_slots;
+    auctionSys.free_capacity = capacity;
+  }
+  auctionSys.free_slots[auctionSys.free_count++] = (int) (uintptr_t) arg;
+}
+
+// Slot pour une nouvelle enchère, -1 en cas d'erreur (store_lock en écriture) :
+// celui d'une enchère retirée que plus aucun lecteur ne voit, sinon un nouveau
+// à la fin de l'arène. Invisible tant que publish_auction() ne l'a pas rempli
+static int take_slot(void) {
+  epoch_reclaim();
+  if (auctionSys.free_count > 0) return auctionSys.free_slots[--auctionSys.free_count];
+
+  if (auctionSys.count >= auctionSys.capacity && add_chunk() < 0) return -1;
+  int slot = auctionSys.count;
+  // live est à 0 : les lecteurs qui parcourent les slots l'ignorent
+  __atomic_store_n(&auctionSys.count, slot + 1, __ATOMIC_RELEASE);
+  return slot;
+}
 
-  struct message *msg = malloc(sizeof(struct message));
-  if (msg == NULL) {
-    perror("malloc a échoué");
+// Remplit le slot et rend l'enchère visible, -1 si l'index est plein (store_lock en écriture)
+static int publish_auction(int slot, unsigned int auction_id, unsigned short creator_id,
+                           unsigned int initial_price, unsigned short bidder) {
+  // Personne ne lit le slot : ni dans l'index, ni live
+  struct Auction *auction = auction_at(slot);
+  auction->auction_id = auction_id;
+  auction->creator_id = creator_id;
+  auction->initial_price = initial_price;
+  auction->current_price = initial_price;
+  auction->id_dernier_prop = bidder;
+  auction->start_time = time(NULL);
+  auction->last_bid_time = time(NULL);
+  auction->end_timer = NULL;
+  auction->warned = 0;
+
+  if (index_insert(slot) < 0) {
+    // Sans place dans l'index, l'enchère serait introuvable
+    recycle_slot((void *) (uintptr_t) slot);
     return -1;
   }
+  __atomic_store_n(&auction->live, 1, __ATOMIC_RELEASE);
+  return 0;
+}
 
-  if (buffer_to_message(msg, buffer) < 0) {
-    perror("buffer_to_message a échoué");
+// Retire une enchère : introuvable tout de suite, son slot réutilisé après les lecteurs
+static void retire_slot(int slot) {
+  struct Auction *auction = auction_at(slot);
+  index_remove(slot);
+  release_end_timer(auction);
+  __atomic_store_n(&auction->live, 0, __ATOMIC_RELEASE);
+  epoch_retire(recycle_slot, (void *) (uintptr_t) slot);
+}
+
+// Retire une enchère terminée par son ID, si elle est encore là
+static void retire_auction(unsigned int auction_id) {
+  lock_store();
+  int slot = auctionSys.index ? auctionSys.index->slots[index_probe(auctionSys.index, auction_id)] : 0;
+  if (slot != 0) {
+    printf("Retrait de l'enchère terminée %u (slot %d)\n", auction_id, slot - 1);
+    retire_slot(slot - 1);
+  }
+  unlock_store();
+}
+
+// Une enchère est terminée si elle a été marquée comme telle ou sans offre depuis AUCTION_TIMEOUT
+static int auction_finished(const struct Auction *auction) {
+  if (auction->auction_id == 0 || auction->last_bid_time == 0) return 1;
+  return difftime(time(NULL), auction->last_bid_time) > AUCTION_TIMEOUT;
+}
+
+static int send_final(int m_send, const struct Auction *auction);
+
+// Fin annoncée par le superviseur (CODE 12) : retirer l'enchère si la fin
+// correspond à notre dernière offre connue. Le superviseur a déjà retiré la sienne
+static void handle_final(const struct message *msg) {
+  struct Auction auction;
+  if (copy_auction(msg->numv, &auction) < 0 || auction.creator_id == pSystem.my_id) return;
+  if (auction.current_price != msg->prix) return;
+  if (auction.id_dernier_prop != msg->id && auction.creator_id != msg->id) return;
+  mark_auction_finished(msg->numv);
+}
+
+// Appelée par la roue de timers : avertissement, puis fin de la vente sans nouvelle offre
+static void on_end_timer(struct wheel_timer *timer, void *arg) {
+  unsigned int auction_id = (unsigned int) (uintptr_t) arg;
+  struct Auction *auction = acquire_auction(auction_id);
+  if (!auction) return;
+  // Une offre a réarmé le timer pendant qu'il expirait : la fin a reculé
+  if (auction->end_timer != timer || wheel_pending(timer)) {
+    release_auction(auction);
+    return;
+  }
+
+  if (!auction->warned) {
+    // La fin reste à AUCTION_TIMEOUT secondes de la dernière offre
+    auction->warned = 1;
+    wheel_schedule(timer, AUCTION_WARNING * 1000);
+    release_auction(auction);
+    send_end_warning(end_sock, auction_id);
+    return;
+  }
+
+  // Terminée sous le verrou : une offre arrivée ensuite la trouve terminée
+  release_end_timer(auction);
+  struct Auction final;
+  read_auction(auction, &final);
+  publish_state(auction, auction->current_price, auction->id_dernier_prop, auction->start_time, 0);
+  release_auction(auction);
+
+  printf("Aucune offre depuis %d secondes pour l'enchère %u\n", AUCTION_TIMEOUT, auction_id);
+  send_final(end_sock, &final);
+  printf("Enchère %u marquée comme terminée\n", auction_id);
+  retire_auction(auction_id);
+}
+
+// Arme ou réarme la fin d'une enchère que nous supervisons, à appeler quand last_bid_time bouge
+static void schedule_end(struct Auction *auction, int m_send) {
+  end_sock = m_send;
+  if (!auction->end_timer) {
+    auction->end_timer = malloc(sizeof(struct wheel_timer));
+    if (!auction->end_timer) {
+      perror("malloc a échoué pour le timer de fin de vente");
+      return;
+    }
+    wheel_timer_init(auction->end_timer, on_end_timer, (void *) (uintptr_t) auction->auction_id);
+  }
+  auction->warned = 0;
+  wheel_schedule(auction->end_timer, (AUCTION_TIMEOUT - AUCTION_WARNING) * 1000);
+}
+
+static void release_end_timer(struct Auction *auction) {
+  if (!auction->end_timer) return;
+  wheel_cancel(auction->end_timer);
+  free(auction->end_timer);
+  auction->end_timer = NULL;
+}
+
+// Sérialise un message dans l'encodage compris par tous les pairs du groupe d'enchères
+static char *encode_for_auction_group(struct message *msg, int *len) {
+  int encoding = pairs_group_encoding();
+  int buffer_size = get_encoded_size(msg, encoding);
+  if (buffer_size < 0) {
+    return NULL;
+  }
+  char *buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    perror("Échec de l'allocation du buffer");
+    return NULL;
+  }
+  *len = encode_message(msg, encoding, buffer, buffer_size);
+  if (*len < 0) {
+    free(buffer);
+    return NULL;
+  }
+  return buffer;
+}
+
+// Lot de réponses en cours pour ce thread, NULL si les messages partent un par un
+static __thread struct batch *pending_batch = NULL;
+
+// Envoie un message encodé au groupe d'enchères, ou l'ajoute au lot en cours
+static int send_to_auction_group(int m_send, const char *buffer, int len) {
+  if (pending_batch != NULL) return batch_add(pending_batch, buffer, len);
+  // Numéroté pour que les pertes soient réparées, si tous les pairs le comprennent
+  if (pairs_group_capabilities() & ENC_RELIABLE) {
+    return reliable_send(m_send, &pSystem.auction, buffer, len);
+  }
+  return send_multicast(m_send, &pSystem.auction, buffer, len);
+}
+
+// Prépare un lot vide pour le groupe d'enchères
+static void init_auction_batch(struct batch *out, int m_send) {
+  unsigned char caps = pairs_group_capabilities();
+  batch_init(out, m_send, &pSystem.auction, (caps & ENC_BATCH) != 0);
+  if (caps & ENC_RELIABLE) batch_set_sender(out, reliable_send_batch, RELIABLE_HEADER_SIZE);
+}
+
+/**
+ * Annonce encodée en attente de son second envoi
+ */
+struct repeat_send {
+  struct wheel_timer timer; // Doit rester le premier champ
+  int m_send;
+  int len;
+  char *buffer;             // Libéré après le second envoi
+};
+
+// Appelée par la roue de timers : second envoi de l'annonce
+static void on_repeat_timer(struct wheel_timer *timer, void *arg) {
+  (void) arg;
+  struct repeat_send *rs = (struct repeat_send *) timer;
+  struct batch out;
+  init_auction_batch(&out, rs->m_send);
+  if (batch_add(&out, rs->buffer, rs->len) < 0 || batch_flush(&out) < 0) {
+    perror("Échec du second envoi d'une annonce");
+  }
+  free(rs->buffer);
+  free(rs);
+}
+
+// Sans enveloppe numérotée (un pair au moins ne comprend pas ENC_RELIABLE), une
+// annonce perdue n'est jamais redemandée : la renvoyer une fois AUCTION_REPEAT_MS
+// plus tard, sans bloquer la boucle. Prend possession du buffer si elle renvoie 1,
+// 0 si rien n'est à renvoyer
+static int repeat_if_unreliable(int m_send, char *buffer, int len) {
+  if (pairs_group_capabilities() & ENC_RELIABLE) return 0;
+  struct repeat_send *rs = malloc(sizeof(struct repeat_send));
+  if (!rs) {
+    perror("malloc a échoué (second envoi)");
+    return -1;
+  }
+  rs->m_send = m_send;
+  rs->len = len;
+  rs->buffer = buffer;
+  wheel_timer_init(&rs->timer, on_repeat_timer, NULL);
+  wheel_schedule(&rs->timer, AUCTION_REPEAT_MS);
+  return 1;
+}
+
+// Ouvre un lot pour les réponses produites par le traitement en cours,
+// renvoie 1 si le lot a été ouvert ici
+static int begin_replies(struct batch *out, int m_send) {
+  if (pending_batch != NULL) return 0; // Un lot est déjà ouvert
+  init_auction_batch(out, m_send);
+  pending_batch = out;
+  return 1;
+}
+
+// Envoie les réponses du lot ouvert par begin_replies()
+static void end_replies(struct batch *out, int opened) {
+  if (!opened) return;
+  pending_batch = NULL;
+  if (batch_flush(out) < 0) {
+    perror("Échec de l'envoi des réponses groupées");
+  }
+}
+
+/**
+ * Message en attente de sa signature avant d'être envoyé au groupe d'enchères
+ */
+struct signed_send {
+  struct crypto_job job; // Doit rester le premier champ
+  struct message *msg;
+  int m_send;
+  unsigned char data[MESSAGE_SIGNED_MAX];
+};
+
+// Appelée depuis la boucle d'événements une fois le message signé
+static void send_signed(struct crypto_job *job) {
+  struct signed_send *ss = (struct signed_send *) job;
+  struct message *msg = ss->msg;
+
+  if (!job->result || message_set_sig_raw(msg, job->sig, job->slen) < 0) {
+    fprintf(stderr, "Échec de la signature du message %d (vente %u)\n", msg->code, msg->numv);
+    goto end;
+  }
+
+  // Convertir le message en buffer
+  int buffer_size;
+  char *buffer = encode_for_auction_group(msg, &buffer_size);
+  if (!buffer) {
+    perror("Échec de la conversion du message en buffer");
+    goto end;
+  }
+
+  // Les pairs qui le perdent le redemandent (voir reliable.h), sinon il part deux fois
+  if (send_to_auction_group(ss->m_send, buffer, buffer_size) < 0) {
+    perror("Échec de l'envoi du message signé");
+  }
+  if (repeat_if_unreliable(ss->m_send, buffer, buffer_size) <= 0) free(buffer);
+
+end:
+  free_message(msg);
+  free(ss);
+}
+
+// Fait signer un message par les threads de crypto puis l'envoie, le message est libéré
+static int send_signed_to_auction_group(int m_send, struct message *msg) {
+  struct signed_send *ss = malloc(sizeof(struct signed_send));
+  if (!ss) {
+    perror("malloc a échoué (message signé)");
     free_message(msg);
     return -1;
   }
+  memset(&ss->job, 0, sizeof(ss->job));
+  ss->job.op = CRYPTO_SIGN;
+  ss->job.data = ss->data;
+  ss->job.len = message_signed_data(msg, ss->data);
+  ss->job.done = send_signed;
+  ss->msg = msg;
+  ss->m_send = m_send;
+  crypto_submit(&ss->job);
+  return 0;
+}
+
+// Sans clé de groupe, la redemander à un pair connu (CODE 21), au plus une
+// fois toutes les GROUP_KEY_RETRY_S secondes et à tour de rôle : l'échange
+// X25519 de la liaison est refait, signé des deux côtés
+static void request_group_key(int m_send) {
+  time_t now = time(NULL);
+  if (crypto_has_group_key() || now - rekey_time < GROUP_KEY_RETRY_S) return;
+  rekey_time = now;
+
+  uint16_t peer = 0;
+  for (int n = 0; n < pSystem.count && peer == 0; n++) {
+    int i = (rekey_next + n) % pSystem.count;
+    EVP_PKEY *key = pSystem.pairs[i].active ? keys_get(pSystem.pairs[i].id) : NULL;
+    if (key != NULL) {
+      peer = pSystem.pairs[i].id;
+      rekey_next = i + 1;
+    }
+    EVP_PKEY_free(key);
+  }
+  if (peer == 0) return; // Aucun pair dont la clé est connue
+
+  struct message *msg = init_message(CODE_DEMANDE_CLE_GROUPE);
+  if (!msg) {
+    perror("Échec de l'initialisation du message");
+    return;
+  }
+  // La même clé pour chaque demande : une réponse en retard reste utilisable
+  if (rekey_dh == NULL) rekey_dh = crypto_dh_generate(rekey_pub);
+  if (rekey_dh == NULL) {
+    free_message(msg);
+    return;
+  }
+  memcpy(msg->dh, rekey_pub, MESSAGE_KEY_SIZE);
+  msg->ldh = MESSAGE_KEY_SIZE;
+  msg->id = pSystem.my_id;
+  msg->numv = peer; // Seul ce pair répond
+  printf("Clé de groupe inconnue, demande au pair %d...\n", peer);
+  send_signed_to_auction_group(m_send, msg);
+}
+
+// Répond à une demande de clé de groupe signée qui nous est adressée (CODE 22)
+static int answer_group_key(int m_send, struct message *msg) {
+  if (msg->numv != pSystem.my_id || msg->ldh != MESSAGE_KEY_SIZE || !crypto_has_group_key()) {
+    return 0;
+  }
+  struct message *reply = init_message(CODE_CLE_GROUPE);
+  if (!reply) {
+    perror("Échec de l'initialisation du message");
+    return -1;
+  }
+  reply->id = pSystem.my_id;
+  reply->numv = msg->id; // Le pair qui a demandé
+  EVP_PKEY *dh = crypto_dh_generate(reply->dh);
+  if (dh == NULL || crypto_group_key_export(dh, msg->dh, reply->gkey) < 0) {
+    EVP_PKEY_free(dh);
+    free_message(reply);
+    return -1;
+  }
+  EVP_PKEY_free(dh);
+  reply->ldh = MESSAGE_KEY_SIZE;
+  reply->lgkey = MESSAGE_KEY_SIZE;
+  printf("Envoi de la clé de groupe au pair %d\n", msg->id);
+  return send_signed_to_auction_group(m_send, reply);
+}
+
+// Prend la clé de groupe envoyée par un pair interrogé
+static int receive_group_key_again(struct message *msg) {
+  if (msg->numv != pSystem.my_id || rekey_dh == NULL ||
+      msg->ldh != MESSAGE_KEY_SIZE || msg->lgkey != MESSAGE_KEY_SIZE) {
+    return 0;
+  }
+  if (crypto_group_key_import(rekey_dh, msg->dh, msg->gkey) < 0) return -1;
+  EVP_PKEY_free(rekey_dh);
+  rekey_dh = NULL;
+  printf("Clé de groupe reçue du pair %d\n", msg->id);
+  return 0;
+}
+
+/**
+ * Message reçu en attente de la vérification de sa signature
+ */
+struct verified_message {
+  struct crypto_job job; // Doit rester le premier champ
+  struct message *msg;   // Copie détachée du buffer de réception
+  int m_send;
+  unsigned char data[MESSAGE_SIGNED_MAX];
+};
+
+/**
+ * Vérifications accumulées pendant une rafale, faites par un seul job
+ */
+struct verify_batch {
+  struct crypto_job *head;
+  struct crypto_job **tail;
+};
+
+static int process_auction_message(int m_send, struct message *msg);
+
+// Traite dans l'ordre les messages d'un lot vérifié
+static void dispatch_verified(struct crypto_job *job) {
+  struct verified_message *vm = (struct verified_message *) job;
+  struct batch out;
+  int opened = begin_replies(&out, vm->m_send);
+
+  while (job != NULL) {
+    struct crypto_job *next = job->batch;
+    vm = (struct verified_message *) job;
+    if (job->result) {
+      process_auction_message(vm->m_send, vm->msg);
+    } else {
+      fprintf(stderr, "Signature invalide: message %d du pair %d ignoré\n",
+              vm->msg->code, vm->msg->id);
+    }
+    EVP_PKEY_free(job->pubkey);
+    free_message(vm->msg);
+    free(vm);
+    job = next;
+  }
+
+  end_replies(&out, opened);
+}
+
+// Met de côté un message signé pour la vérification groupée
+static int queue_verification(int m_send, struct message *msg, EVP_PKEY *key,
+                              struct verify_batch *vb) {
+  struct verified_message *vm = malloc(sizeof(struct verified_message));
+  struct message *copy = pool_get_message();
+  if (!vm || !copy) {
+    perror("malloc a échoué (vérification)");
+    free(vm);
+    pool_put_message(copy);
+    EVP_PKEY_free(key);
+    return -1;
+  }
+  // Le message pointe dans le buffer de réception, qui sera réutilisé
+  *copy = *msg;
+  if (message_detach(copy) < 0) {
+    free(vm);
+    pool_put_message(copy);
+    EVP_PKEY_free(key);
+    return -1;
+  }
+
+  memset(&vm->job, 0, sizeof(vm->job));
+  vm->job.op = CRYPTO_VERIFY;
+  vm->job.data = vm->data;
+  vm->job.len = message_signed_data(copy, vm->data);
+  memcpy(vm->job.sig, copy->sig, copy->lsig);
+  vm->job.slen = copy->lsig;
+  vm->job.pubkey = key;
+  vm->job.done = dispatch_verified;
+  vm->msg = copy;
+  vm->m_send = m_send;
+
+  *vb->tail = &vm->job;
+  vb->tail = &vm->job.batch;
+  return 0;
+}
+
+// Décode un message reçu sur le groupe d'enchères, le traite tout de suite
+// s'il n'est pas signé, sinon le met de côté pour la vérification groupée
+static int dispatch_auction_message(int m_send, char *buffer, int len, struct verify_batch *vb) {
+  // Copie d'un message déjà traité : ignorée avant le décodage et la vérification
+  struct dedup_key dkey;
+  if (dedup_key_from_buffer(buffer, len, &dkey) == 0 && dedup_seen(&recent_messages, &dkey)) {
+    return 0;
+  }
+
+  // Décodage sur place dans le buffer de réception, sans allocation
+  struct message_view view;
+  if (decode_message_view(&view, buffer, len) < 0) {
+    perror("buffer_to_message a échoué");
+    return -1;
+  }
+  struct message *msg = &view.msg;
+
+  // Enchères et relais : MAC avec la clé de groupe, vérifié tout de suite
+  if (msg->lmac > 0) {
+    int mac = message_check_mac(msg);
+    if (mac == 0) {
+      fprintf(stderr, "MAC invalide: message %d du pair %d ignoré\n", msg->code, msg->id);
+      return -1;
+    }
+    if (mac < 0) {
+      // Pas une falsification : la clé de groupe nous manque, la redemander
+      request_group_key(m_send);
+#ifdef REQUIRE_SIGNATURES
+      fprintf(stderr, "Clé de groupe inconnue: message %d du pair %d ignoré\n", msg->code, msg->id);
+      return -1;
+#else
+      fprintf(stderr, "Clé de groupe inconnue: MAC du message %d du pair %d non vérifié\n",
+              msg->code, msg->id);
+#endif
+    }
+    return process_auction_message(m_send, msg);
+  }
+
+  EVP_PKEY *key = NULL;
+  if (msg->lsig > 0 && msg->id != pSystem.my_id) key = keys_get(msg->id);
+  if (key != NULL) return queue_verification(m_send, msg, key, vb);
+
+  // L'échange de la clé de groupe n'est fait qu'avec des pairs authentifiés
+  if (msg->code == CODE_DEMANDE_CLE_GROUPE || msg->code == CODE_CLE_GROUPE) {
+    if (msg->id != pSystem.my_id) {
+      fprintf(stderr, "Message %d du pair %d ignoré: non signé ou clé inconnue\n", msg->code, msg->id);
+    }
+    return 0;
+  }
+
+#ifdef REQUIRE_SIGNATURES
+  if (msg->code == CODE_NOUVELLE_VENTE && msg->id != pSystem.my_id) {
+    fprintf(stderr, "Vente du pair %d ignorée: non signée ou clé inconnue\n", msg->id);
+    return -1;
+  }
+  if (msg->code == CODE_ENCHERE || msg->code == CODE_ENCHERE_SUPERVISEUR) {
+    fprintf(stderr, "Enchère du pair %d ignorée: sans MAC\n", msg->id);
+    return -1;
+  }
+#endif
+  return process_auction_message(m_send, msg);
+}
+
+// Traite un message reçu sur le groupe d'enchères
+static int process_auction_message(int m_send, struct message *msg) {
+  // Retenu seulement une fois authentifié, une copie forgée ne masque pas l'original
+  struct dedup_key key;
+  if (dedup_key_from_message(msg, &key) == 0 && dedup_add(&recent_messages, &key)) {
+    return 0; // Les deux copies attendaient la même vérification
+  }
 
   switch (msg->code) {
     case CODE_NOUVELLE_VENTE: // Code 8 - New auction
       if (pSystem.my_id == msg->id) {
-        free_message(msg);
         return 0; // Ignore messages from ourselves
       }
       printf("Nouvelle vente reçue - ID: %d, NUMV: %u, PRIX: %u\n", msg->id,  msg->numv, msg->prix);
@@ -154,13 +948,12 @@ int handle_auction_message(int auc_sock, int m_send) {
       }
       if (creator.id == 0 || !creator.active) {
         fprintf(stderr, "Erreur: Créateur de l'enchère %u introuvable (%d)\n", msg->numv, msg->id);
-        free_message(msg);
         return -1;
       }
 
       // Chercher si cette enchère existe déjà
-      struct Auction *existing = find_auction(msg->numv);
-      if (!existing) {
+      struct Auction existing;
+      if (copy_auction(msg->numv, &existing) < 0) {
         // L'enchère n'existe pas encore, on la crée avec l'ID spécifié
         printf("Création d'une nouvelle enchère avec ID=%u, prix=%u\n", msg->numv, msg->prix);
         unsigned int auction_id = init_auction_with_id(&creator, msg->prix, msg->numv);
@@ -170,10 +963,9 @@ int handle_auction_message(int auc_sock, int m_send) {
         } else {
           printf("Enchère %u ajoutée au système\n", msg->numv);
           // Vérifier que l'enchère est bien dans le système
-          existing = find_auction(msg->numv);
-          if (existing) {
+          if (copy_auction(msg->numv, &existing) == 0) {
             printf("Enchère vérifiée dans le système: ID=%u, prix=%u, créateur=%d\n",
-                   existing->auction_id, existing->current_price,  existing->creator_id);
+                   existing.auction_id, existing.current_price,  existing.creator_id);
           } else {
             printf("ERREUR: Impossible de trouver l'enchère %u après sa création!\n", msg->numv);
             return -1;
@@ -181,7 +973,7 @@ int handle_auction_message(int auc_sock, int m_send) {
         }
       } else {
         printf("L'enchère %u existe déjà dans le système (prix=%u, créateur=%d)\n",
-               existing->auction_id, existing->current_price, existing->creator_id);
+               existing.auction_id, existing.current_price, existing.creator_id);
       }
       break;
 
@@ -201,13 +993,69 @@ int handle_auction_message(int auc_sock, int m_send) {
 
     case CODE_FIN_VENTE: // Code 12 - Fin de vente
       printf("Fin de vente - ID gagnant: %d, NUMV: %u, PRIX final: %u\n", msg->id, msg->numv, msg->prix);
+      handle_final(msg);
       break;
+
+    case CODE_DEMANDE_CLE_GROUPE: // Code 21 - Un pair sans clé de groupe nous la demande
+      return answer_group_key(m_send, msg);
+
+    case CODE_CLE_GROUPE: // Code 22 - Réponse à notre demande de clé de groupe
+      return receive_group_key_again(msg);
   }
   return 0;
 }
 
+int handle_auction_message(int auc_sock, int m_send) {
+  // Tous les datagrammes déjà arrivés (rafale d'enchères) en un seul appel
+  char buffers[AUCTION_BURST][BATCH_MTU + 1];
+  struct sockaddr_in6 senders[AUCTION_BURST];
+  int lens[AUCTION_BURST];
+
+  int count = receive_multicast_batch(auc_sock, buffers[0], sizeof(buffers[0]),
+                                      AUCTION_BURST, lens, senders);
+  if (count <= 0)
+    return 0; // No data or error
+
+  // Les relais et refus produits pendant le traitement partent groupés
+  struct batch out;
+  int opened = begin_replies(&out, m_send);
+  // Les messages signés de la rafale sont vérifiés ensemble à la fin
+  struct verify_batch vb = { NULL, &vb.head };
+
+  int ret = 0;
+  for (int n = 0; n < count; n++) {
+    char *buffer = buffers[n];
+    int len = lens[n];
+    if (len <= 0) continue;
+    if (len > BATCH_MTU) len = BATCH_MTU; // Tronqué, le dernier octet devient '\0'
+    buffer[len] = '\0';
+    // Enveloppe numérotée : trous redemandés, copies et contrôle consommés ici
+    char *data;
+    int data_len = reliable_receive(m_send, buffer, len, &senders[n], &data);
+    if (data_len > 0 && is_batch_buffer(data, data_len)) {
+      // Traiter chaque message du lot dans l'ordre
+      int offset = 0;
+      int msg_len;
+      char *inner;
+      while ((inner = batch_next(data, data_len, &offset, &msg_len)) != NULL) {
+        if (!is_binary_buffer(inner, msg_len) && inner[msg_len - 1] != '\0') {
+          fprintf(stderr, "Erreur: message texte non terminé dans un lot\n");
+          continue;
+        }
+        if (dispatch_auction_message(m_send, inner, msg_len, &vb) < 0) ret = -1;
+      }
+    } else if (data_len > 0 && dispatch_auction_message(m_send, data, data_len, &vb) < 0) {
+      ret = -1;
+    }
+  }
+
+  end_replies(&out, opened);
+  if (vb.head != NULL) crypto_submit(vb.head);
+  return ret;
+}
+
 int create_auction(int m_send) {
-  if (auctionSys.auctions == NULL) {
+  if (auctionSys.chunks == NULL) {
     if (init_auction_system() < 0) {
       fprintf(stderr, "Échec de l'initialisation du système d'enchères\n");
       return -1;
@@ -255,46 +1103,12 @@ unsigned int init_auction(struct Pair *creator, unsigned int initial_price) {
     return 0;
   }
 
-  pthread_mutex_lock(&auction_mutex);
-  // Chercher un slot libre (enchère terminée) avant d'en créer un nouveau
-  int free_slot = -1;
-  for (int i = 0; i < auctionSys.count; i++)
-  {
-    if (is_auction_finished(auctionSys.auctions[i].auction_id))
-    {
-      free_slot = i;
-      printf("Réutilisation du slot %d pour une nouvelle enchère\n", i);
-      break;
-    }
-  }
-
-  struct Auction *new_auction;
-  if (free_slot >= 0) {
-    // Réutiliser un slot existant
-    new_auction = &auctionSys.auctions[free_slot];
-    memset(new_auction, 0, sizeof(struct Auction));
-  } else {
-    // Vérifier si nous avons besoin d'augmenter la capacité
-    if (auctionSys.count >= auctionSys.capacity) {
-      size_t new_capacity = auctionSys.capacity * 2;
-      struct Auction *new_auctions = realloc(auctionSys.auctions, new_capacity * sizeof(struct Auction));
-
-      if (!new_auctions) {
-        perror("realloc a échoué");
-        pthread_mutex_unlock(&auction_mutex);
-        return 0;
-      }
-
-      auctionSys.auctions = new_auctions;
-      auctionSys.capacity = new_capacity;
-
-      // Initialiser les nouveaux éléments à zéro
-      memset(&auctionSys.auctions[auctionSys.count], 0, (new_capacity - auctionSys.count) * sizeof(struct Auction));
-    }
-
-    // Ajouter la nouvelle enchère à la fin du tableau
-    new_auction = &auctionSys.auctions[auctionSys.count];
-    auctionSys.count++;
+  // Les enchères terminées sont retirées à leur fin : leur slot est repris ici
+  lock_store();
+  int slot = take_slot();
+  if (slot < 0) {
+    unlock_store();
+    return 0;
   }
 
   printf("Capacité actuelle: %d, Nombre d'enchères: %d\n", auctionSys.capacity, auctionSys.count);
@@ -302,35 +1116,30 @@ unsigned int init_auction(struct Pair *creator, unsigned int initial_price) {
   // Générer un nouvel ID d'enchère
   unsigned int auction_id = generate_auction_id();
 
-  new_auction->auction_id = auction_id;
-  new_auction->creator_id = creator->id;
-  new_auction->initial_price = initial_price;
-  new_auction->current_price = initial_price;
-  new_auction->id_dernier_prop = creator->id;
-  new_auction->start_time = time(NULL);
-  new_auction->last_bid_time = time(NULL);
+  if (publish_auction(slot, auction_id, creator->id, initial_price, creator->id) < 0) {
+    unlock_store();
+    return 0;
+  }
 
-  printf("Enchère %u créée avec succès (count=%d, capacity=%d)\n",
-         auction_id, auctionSys.count, auctionSys.capacity);
+  printf("Enchère %u créée avec succès (slot=%d, count=%d, capacity=%d)\n",
+         auction_id, slot, auctionSys.count, auctionSys.capacity);
 
-  pthread_mutex_unlock(&auction_mutex);
+  unlock_store();
   return auction_id;
 }
 
 int start_auction(int m_send, unsigned int auction_id) {
-  pthread_mutex_lock(&auction_mutex);
-
-  struct Auction *auction = find_auction(auction_id);
+  struct Auction *auction = acquire_auction(auction_id);
   if (!auction) {
     fprintf(stderr, "Erreur: Enchère %u introuvable\n", auction_id);
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
-  auction->start_time = time(NULL);
-  auction->last_bid_time = time(NULL);
+  publish_state(auction, auction->current_price, auction->id_dernier_prop, time(NULL), time(NULL));
+  unsigned int initial_price = auction->initial_price;
+  schedule_end(auction, m_send);
 
-  pthread_mutex_unlock(&auction_mutex);
+  release_auction(auction);
 
   struct message *msg = init_message(CODE_NOUVELLE_VENTE);
   if (!msg) {
@@ -340,78 +1149,34 @@ int start_auction(int m_send, unsigned int auction_id) {
 
   msg->id = pSystem.my_id;
   msg->numv = auction_id;
-  msg->prix = auction->initial_price;
-
-  if (message_set_mess(msg, "Nouvelle enchère") < 0 || message_set_sig(msg) < 0)  {
-    perror("Échec de l'initialisation des champs du message");
-    free_message(msg);
-    return -1;
-  }
-
-  // Convertir le message en buffer
-  int buffer_size = get_buffer_size(msg);
-  char *buffer = malloc(buffer_size);
-  if (!buffer) {
-    perror("Échec de l'allocation du buffer");
-    free_message(msg);
-    return -1;
-  }
-
-  memset(buffer, 0, buffer_size);
-
-  if (message_to_buffer(msg, buffer, buffer_size) < 0) {
-    perror("Échec de la conversion du message en buffer");
-    free(buffer);
-    free_message(msg);
-    return -1;
-  }
+  msg->prix = initial_price;
 
-  // Envoyer plusieurs fois le message au groupe multicast des enchères
+  // Envoyer l'annonce au groupe multicast des enchères, une fois signée
   printf("Diffusion de la nouvelle enchère %u (prix initial %u) à tous les pairs...\n",
-         auction_id, auction->initial_price);
-
-  for (int i = 0; i < 2; i++) {
-    if (send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size) < 0) {
-      perror("Échec de l'envoi de l'annonce de nouvelle vente");
-    }
-    usleep(200000);
-  }
-
-  printf("Nouvelle vente %u lancée avec prix initial %u\n", auction_id, auction->initial_price);
-
-  // Libérer les ressources
-  free(buffer);
-  free_message(msg);
-
-  if (!monitor_running) {
-    monitor_running = 1;
-    int *m_send_ptr = &m_send;
-    if (pthread_create(&auction_monitor_thread, NULL, auction_monitor, m_send_ptr) != 0) {
-      perror("Échec de la création du thread de surveillance");
-      monitor_running = 0;
-    }
+         auction_id, initial_price);
+  if (send_signed_to_auction_group(m_send, msg) < 0) {
+    perror("Échec de l'envoi de l'annonce de nouvelle vente");
+    return -1;
   }
+  printf("Nouvelle vente %u lancée avec prix initial %u\n", auction_id, initial_price);
   return 0;
 }
 
 // Fonction pour gérer les messages d'enchère reçus (CODE=9)
 int handle_bid(int m_send, struct message *msg) {
-  pthread_mutex_lock(&auction_mutex);
-
-  struct Auction *auction = find_auction(msg->numv);
+  struct Auction *auction = acquire_auction(msg->numv);
   if (!auction) {
     unsigned short supervisor_id = (msg->numv >> 16) & 0xFFFF;
     if (supervisor_id == pSystem.my_id) {
       fprintf(stderr, "Enchère reçue pour notre vente inconnue ID=%u\n", msg->numv);
     }
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
   // Vérification que l'enchère est encore en cours
-  if (is_auction_finished(auction->auction_id)) {
+  if (auction_finished(auction)) {
     fprintf(stderr, "Erreur: L'enchère %u est terminée\n", msg->numv);
-    pthread_mutex_unlock(&auction_mutex);
+    release_auction(auction);
     return -1;
   }
 
@@ -424,16 +1189,15 @@ int handle_bid(int m_send, struct message *msg) {
       printf("Offre rejetée (superviseur): prix (%u) inférieur ou égal au prix actuel (%u)\n",
              msg->prix, auction->current_price);
 
-      pthread_mutex_unlock(&auction_mutex);
+      release_auction(auction);
       send_rejection_message(m_send, msg);
 
       return -1;
     }
 
     // Mettre à jour les données de l'enchère
-    auction->current_price = msg->prix;
-    auction->id_dernier_prop = msg->id;
-    auction->last_bid_time = time(NULL);
+    publish_bid(auction, msg->prix, msg->id);
+    schedule_end(auction, m_send);
 
     printf("Prix de l'enchère %u mis à jour: %u (offrant: %d)\n",
            auction->auction_id, auction->current_price, auction->id_dernier_prop);
@@ -442,7 +1206,7 @@ int handle_bid(int m_send, struct message *msg) {
     unsigned int prix = msg->prix;
     unsigned short id = msg->id;
 
-    pthread_mutex_unlock(&auction_mutex);
+    release_auction(auction);
 
     // Relayer l'enchère (CODE_ENCHERE_SUPERVISEUR = 10)
     struct message *relay_msg = init_message(CODE_ENCHERE_SUPERVISEUR);
@@ -453,17 +1217,12 @@ int handle_bid(int m_send, struct message *msg) {
     relay_msg->id = id;
     relay_msg->numv = auction_id;
     relay_msg->prix = prix;
+    message_set_mac(relay_msg); // Sans clé de groupe, le relais part sans MAC
 
-    int buffer_size = get_buffer_size(relay_msg);
-    char *buffer = malloc(buffer_size);
+    int buffer_size;
+    char *buffer = encode_for_auction_group(relay_msg, &buffer_size);
     if (buffer == NULL) {
-      perror("Échec de l'allocation du buffer pour le message relayé");
-      free_message(relay_msg);
-      return -1;
-    }
-    if (message_to_buffer(relay_msg, buffer, buffer_size)) {
       perror("Échec de la conversion du message relayé en buffer");
-      free(buffer);
       free_message(relay_msg);
       return -1;
     }
@@ -471,7 +1230,7 @@ int handle_bid(int m_send, struct message *msg) {
 
     printf("Relais de l'offre: enchère %u, offrant %d, prix %u\n", msg->numv, msg->id, msg->prix);
     // Code = 10 - Envoi de l'enchère relayée
-    if (send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size) < 0) {
+    if (send_to_auction_group(m_send, buffer, buffer_size) < 0) {
       perror("Échec de l'envoi de l'enchère relayée");
       free(buffer);
       return -1;
@@ -484,9 +1243,7 @@ int handle_bid(int m_send, struct message *msg) {
   if (msg->id == pSystem.my_id && msg->prix > auction->current_price) {
     printf("Mise à jour locale de l'enchère %u: prix = %u (offrant: nous)\n",
            auction->auction_id, msg->prix);
-    auction->current_price = msg->prix;
-    auction->id_dernier_prop = msg->id;
-    auction->last_bid_time = time(NULL);
+    publish_bid(auction, msg->prix, msg->id);
   } else {
     // Si nous ne sommes pas le superviseur, nous vérifions seulement que le prix est supérieur
     // pour information utilisateur, mais nous ne faisons rien d'autre
@@ -499,62 +1256,45 @@ int handle_bid(int m_send, struct message *msg) {
     }
   }
 
-  pthread_mutex_unlock(&auction_mutex);
+  release_auction(auction);
   return 0;
 }
 
 // Fonction pour gérer les enchères relayées par le superviseur (CODE=10)
 int handle_supervisor_bid(struct message *msg) {
-  pthread_mutex_lock(&auction_mutex);
   fflush(stdout);
 
-  struct Auction *auction = find_auction(msg->numv);
+  struct Auction *auction = acquire_auction(msg->numv);
   if (!auction) {
     // Si l'enchère n'existe pas dans notre système, on l'ajoute
     printf("Réception d'une enchère pour une vente inconnue (ID=%u). Création de l'enchère.\n", msg->numv);
 
-    if (auctionSys.count >= auctionSys.capacity) {
-      size_t new_capacity = auctionSys.capacity * 2;
-      struct Auction *new_auctions = realloc(auctionSys.auctions, new_capacity * sizeof(struct Auction));
-
-      if (!new_auctions) {
-        perror("Échec de la réallocation du tableau d'enchères");
-        pthread_mutex_unlock(&auction_mutex);
-        return -1;
-      }
-
-      auctionSys.auctions = new_auctions;
-      auctionSys.capacity = new_capacity;
-
-      // Initialiser les nouveaux éléments à zéro
-      memset(&auctionSys.auctions[auctionSys.count], 0,
-             (new_capacity - auctionSys.count) * sizeof(struct Auction));
+    lock_store();
+    if (find_auction(msg->numv) != NULL) {
+      // Ajoutée par un autre thread entre les deux verrous : traiter l'offre comme une mise à jour
+      unlock_store();
+      return handle_supervisor_bid(msg);
     }
 
-    struct Auction *new_auction = &auctionSys.auctions[auctionSys.count];
-    memset(new_auction, 0, sizeof(struct Auction));
-
-    new_auction->auction_id = msg->numv;
-    new_auction->creator_id = (msg->numv >> 16) & 0xFFFF; // Extraction de l'ID du créateur (ancienne méthode)
-    new_auction->initial_price = msg->prix;
-    new_auction->current_price = msg->prix;
-    new_auction->id_dernier_prop = msg->id;
-    new_auction->start_time = time(NULL);
-    new_auction->last_bid_time = time(NULL);
-
-    auctionSys.count++;
+    int slot = take_slot();
+    // Extraction de l'ID du créateur (ancienne méthode)
+    if (slot < 0 || publish_auction(slot, msg->numv, (msg->numv >> 16) & 0xFFFF, msg->prix, msg->id) < 0) {
+      unlock_store();
+      return -1;
+    }
+    struct Auction *new_auction = auction_at(slot);
 
     printf("Nouvelle enchère ajoutée au système - ID: %u, Prix: %u, Créateur: %d, Dernier proposant: %d\n",
            new_auction->auction_id, new_auction->current_price, new_auction->creator_id, new_auction->id_dernier_prop);
 
-    pthread_mutex_unlock(&auction_mutex);
+    unlock_store();
     return 0;
   }
   // Vérifier si le prix proposé est supérieur au prix actuel
   if (msg->prix <= auction->current_price) {
     printf("Prix proposé (%u) inférieur ou égal au prix actuel (%u). Enchère ignorée.\n",
            msg->prix, auction->current_price);
-    pthread_mutex_unlock(&auction_mutex);
+    release_auction(auction);
     return 0;
   }
 
@@ -562,35 +1302,29 @@ int handle_supervisor_bid(struct message *msg) {
   unsigned int ancien_prix = auction->current_price;
   unsigned short ancien_proposant = auction->id_dernier_prop;
 
-  auction->current_price = msg->prix;
-  auction->id_dernier_prop = msg->id;
-  auction->last_bid_time = time(NULL);
+  publish_bid(auction, msg->prix, msg->id);
+  if (auction->end_timer) schedule_end(auction, end_sock);
 
   printf("Mise à jour de l'enchère %u: prix %u → %u, proposant %d → %d\n",
          auction->auction_id, ancien_prix, msg->prix, ancien_proposant, msg->id);
 
-  pthread_mutex_unlock(&auction_mutex);
+  release_auction(auction);
   return 0;
 }
 
 // Fonction pour envoyer un avertissement de fin de vente (CODE=11)
 int send_end_warning(int m_send, unsigned int auction_id)
 {
-  pthread_mutex_lock(&auction_mutex);
-
-  struct Auction *auction = find_auction(auction_id);
-  if (!auction)
+  struct Auction auction;
+  if (copy_auction(auction_id, &auction) < 0)
   {
     fprintf(stderr, "Erreur: Enchère %u introuvable\n", auction_id);
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
   // Vérifie que nous sommes le superviseur de cette enchère
-  unsigned short supervisor_id = (auction->auction_id >> 16) & 0xFFFF;
-  if (supervisor_id != pSystem.my_id)
+  if (auction.creator_id != pSystem.my_id)
   {
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
@@ -599,95 +1333,85 @@ int send_end_warning(int m_send, unsigned int auction_id)
   if (!warning_msg)
   {
     perror("Échec de l'initialisation du message");
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
   warning_msg->id = pSystem.my_id;
   warning_msg->numv = auction_id;
-  warning_msg->prix = auction->current_price;
+  warning_msg->prix = auction.current_price;
 
-  int buffer_size = get_buffer_size(warning_msg);
-  char *buffer = malloc(buffer_size);
+  int buffer_size;
+  char *buffer = encode_for_auction_group(warning_msg, &buffer_size);
   if (!buffer)
   {
-    perror("Échec de l'allocation du buffer");
+    perror("Échec de la conversion du message en buffer");
     free_message(warning_msg);
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
-  message_to_buffer(warning_msg, buffer, buffer_size);
-  send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size);
+  send_to_auction_group(m_send, buffer, buffer_size);
 
   printf("Avertissement de fin de vente pour l'enchère %u envoyé (prix actuel: %u)\n",
-         auction_id, auction->current_price);
+         auction_id, auction.current_price);
 
   free(buffer);
   free_message(warning_msg);
-
-  pthread_mutex_unlock(&auction_mutex);
   return 0;
 }
 
-// Fonction pour finaliser une vente (CODE=12)
-int finalize_auction(int m_send, unsigned int auction_id)
+// Envoie la fin de vente (CODE=12) d'après une copie de l'enchère
+static int send_final(int m_send, const struct Auction *auction)
 {
-  pthread_mutex_lock(&auction_mutex);
-
-  struct Auction *auction = find_auction(auction_id);
-  if (!auction)
-  {
-    fprintf(stderr, "Erreur: Enchère %u introuvable\n", auction_id);
-    pthread_mutex_unlock(&auction_mutex);
-    return -1;
-  }
-
-  unsigned short supervisor_id = (auction->auction_id >> 16) & 0xFFFF;
-  if (supervisor_id != pSystem.my_id)
-  {
-    pthread_mutex_unlock(&auction_mutex);
-    return -1;
-  }
-
-  // Envoyer le message de fin (CODE_FIN_VENTE = 12)
   struct message *final_msg = init_message(CODE_FIN_VENTE);
   if (!final_msg)
   {
     perror("Échec de l'initialisation du message");
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
   // Pour l'ID, on prend soit l'ID du dernier proposant s'il y en a un,
   // soit l'ID du superviseur s'il n'y a pas eu d'enchère
   final_msg->id = (auction->id_dernier_prop != auction->creator_id) ? auction->id_dernier_prop : auction->creator_id;
-  final_msg->numv = auction_id;
+  final_msg->numv = auction->auction_id;
   final_msg->prix = auction->current_price;
 
-  int buffer_size = get_buffer_size(final_msg);
-  char *buffer = malloc(buffer_size);
+  int buffer_size;
+  char *buffer = encode_for_auction_group(final_msg, &buffer_size);
   if (!buffer)
   {
-    perror("Échec de l'allocation du buffer");
+    perror("Échec de la conversion du message en buffer");
     free_message(final_msg);
-    pthread_mutex_unlock(&auction_mutex);
     return -1;
   }
 
-  message_to_buffer(final_msg, buffer, buffer_size);
-  send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size);
+  send_to_auction_group(m_send, buffer, buffer_size);
 
   printf("Fin de la vente pour l'enchère %u: gagnant ID=%u, prix final=%u\n",
-         auction_id, final_msg->id, final_msg->prix);
+         auction->auction_id, final_msg->id, final_msg->prix);
 
   free(buffer);
   free_message(final_msg);
-
-  pthread_mutex_unlock(&auction_mutex);
   return 0;
 }
 
+// Fonction pour finaliser une vente (CODE=12)
+int finalize_auction(int m_send, unsigned int auction_id)
+{
+  struct Auction auction;
+  if (copy_auction(auction_id, &auction) < 0)
+  {
+    fprintf(stderr, "Erreur: Enchère %u introuvable\n", auction_id);
+    return -1;
+  }
+
+  if (auction.creator_id != pSystem.my_id)
+  {
+    return -1;
+  }
+
+  return send_final(m_send, &auction);
+}
+
 // Fonction pour quitter le système d'enchères (CODE=13)
 int quit_auction_system(int m_send) {
   struct message *quit_msg = init_message(CODE_QUIT_SYSTEME);
@@ -699,17 +1423,16 @@ int quit_auction_system(int m_send) {
 
   quit_msg->id = pSystem.my_id;
 
-  int buffer_size = get_buffer_size(quit_msg);
-  char *buffer = malloc(buffer_size);
+  int buffer_size;
+  char *buffer = encode_for_auction_group(quit_msg, &buffer_size);
   if (!buffer)
   {
-    perror("Échec de l'allocation du buffer");
+    perror("Échec de la conversion du message en buffer");
     free_message(quit_msg);
     return -1;
   }
 
-  message_to_buffer(quit_msg, buffer, buffer_size);
-  send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size);
+  send_to_auction_group(m_send, buffer, buffer_size);
 
   printf("Message de départ envoyé (ID=%u)\n", pSystem.my_id);
 
@@ -722,34 +1445,19 @@ int quit_auction_system(int m_send) {
 // Fonction pour vérifier si une enchère est terminée
 int is_auction_finished(unsigned int auction_id)
 {
-  struct Auction *auction = find_auction(auction_id);
-  if (!auction)
+  struct Auction auction;
+  if (copy_auction(auction_id, &auction) < 0)
   {
     return 1; // Si l'enchère n'existe pas, elle est considérée comme terminée
   }
-
-  // Si l'enchère a été explicitement marquée comme terminée
-  if (auction->auction_id == 0 || auction->last_bid_time == 0)
-  {
-    return 1;
-  }
-
-  time_t now = time(NULL);
-
-  // Si aucune enchère depuis AUCTION_TIMEOUT secondes, l'enchère est terminée
-  if (difftime(now, auction->last_bid_time) > AUCTION_TIMEOUT)
-  {
-    return 1;
-  }
-
-  return 0; // Enchère en cours
+  return auction_finished(&auction);
 }
 
 int make_bid(int m_send) {
   unsigned int auction_id;
   unsigned int price;
 
-  if (auctionSys.auctions == NULL) {
+  if (auctionSys.chunks == NULL) {
     fprintf(stderr, "Erreur: Système d'enchères non initialisé\n");
     return -1;
   }
@@ -758,15 +1466,17 @@ int make_bid(int m_send) {
   printf("\nEnchères actives:\n");
   int active_auctions = 0;
 
-  for (int i = 0; i < auctionSys.count; i++) {
-    struct Auction *auction = &auctionSys.auctions[i];
-    if (!is_auction_finished(auction->auction_id)) {
+  int count;
+  struct Auction *auctions = copy_all_auctions(&count);
+  if (!auctions) return -1;
+  for (int i = 0; i < count; i++) {
+    if (!auction_finished(&auctions[i])) {
       printf("%d. ID: %u, Prix actuel: %u, Créateur: %d\n", active_auctions + 1,
-             auction->auction_id, auction->current_price, auction->creator_id);
+             auctions[i].auction_id, auctions[i].current_price, auctions[i].creator_id);
       active_auctions++;
     }
   }
-  pthread_mutex_unlock(&auction_mutex);
+  free(auctions);
 
   if (active_auctions == 0) {
     return 0; // No active auctions
@@ -777,25 +1487,25 @@ int make_bid(int m_send) {
   while (getchar() != '\n'); // Vider le buffer d'entrée
 
   // Vérifier que l'enchère existe
-  struct Auction *auction = find_auction(auction_id);
-  if (!auction) {
+  struct Auction auction;
+  if (copy_auction(auction_id, &auction) < 0) {
     fprintf(stderr, "Erreur: Enchère %u introuvable\n", auction_id);
     return -1;
   }
 
   // Vérifier que l'enchère n'est pas terminée
-  if (is_auction_finished(auction_id)) {
+  if (auction_finished(&auction)) {
     fprintf(stderr, "Erreur: L'enchère %u est terminée\n", auction_id);
     return -1;
   }
 
-  printf("Prix actuel: %u\n", auction->current_price);
+  printf("Prix actuel: %u\n", auction.current_price);
   printf("Entrez votre prix: ");
   scanf("%u", &price);
   while (getchar() != '\n'); // Vider le buffer d'entrée
 
-  // Vérifier que le prix est supérieur au prix actuel
-  if (price <= auction->current_price) {
+  // Vérifier que le prix est supérieur au prix actuel, qui a pu monter pendant la saisie
+  if (copy_auction(auction_id, &auction) < 0 || price <= auction.current_price) {
     fprintf(stderr, "Erreur: Le prix doit être supérieur au prix actuel\n");
     return -1;
   }
@@ -809,23 +1519,22 @@ int make_bid(int m_send) {
   msg->numv = auction_id;
   msg->prix = price;
 
-  int buffer_size = get_buffer_size(msg);
-  char *buffer = malloc(buffer_size);
-  if (!buffer) {
-    perror("Échec de l'allocation du buffer");
-    free_message(msg);
-    return -1;
+  // Un MAC avec la clé de groupe plutôt qu'une signature, bien moins coûteux
+  if (message_set_mac(msg) < 0) {
+    printf("Attention: clé de groupe inconnue, l'enchère part sans MAC\n");
+    request_group_key(m_send);
   }
 
-  if (message_to_buffer(msg, buffer, buffer_size) < 0) {
+  int buffer_size;
+  char *buffer = encode_for_auction_group(msg, &buffer_size);
+  if (!buffer) {
     perror("Échec de la conversion du message en buffer");
-    free(buffer);
     free_message(msg);
     return -1;
   }
   free_message(msg);
 
-  if (send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size) < 0) {
+  if (send_to_auction_group(m_send, buffer, buffer_size) < 0) {
     perror("Échec de l'envoi de l'enchère");
     free(buffer);
     return -1;
@@ -840,7 +1549,7 @@ int make_bid(int m_send) {
 // Fonction pour valider une enchère
 int validate_bid(int m_send, unsigned int auction_id, unsigned short bidder_id, unsigned int bid_price)
 {
-  struct Auction *auction = find_auction(auction_id);
+  struct Auction *auction = acquire_auction(auction_id);
   if (!auction)
   {
     printf("Erreur: Enchère %u inexistante\n", auction_id);
@@ -849,6 +1558,8 @@ int validate_bid(int m_send, unsigned int auction_id, unsigned short bidder_id,
 
   // Vérifier que le prix est valide (supérieur au prix actuel)
   if (bid_price <= auction->current_price) {
+    release_auction(auction);
+
     // Envoyer un message de refus (CODE_REFUS_PRIX = 15)
     struct message *refuse_msg = init_message(CODE_REFUS_PRIX);
     if (refuse_msg) {
@@ -856,11 +1567,10 @@ int validate_bid(int m_send, unsigned int auction_id, unsigned short bidder_id,
       refuse_msg->numv = auction_id;
       refuse_msg->prix = bid_price;
 
-      int buffer_size = get_buffer_size(refuse_msg);
-      char *buffer = malloc(buffer_size);
+      int buffer_size;
+      char *buffer = encode_for_auction_group(refuse_msg, &buffer_size);
       if (buffer) {
-        message_to_buffer(refuse_msg, buffer, buffer_size);
-        send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size);
+        send_to_auction_group(m_send, buffer, buffer_size);
         free(buffer);
       }
       free_message(refuse_msg);
@@ -868,6 +1578,12 @@ int validate_bid(int m_send, unsigned int auction_id, unsigned short bidder_id,
     return -1;
   }
 
+  // Dans un cas réel, on compterait les validations reçues
+  // Pour simuler le consensus, on met à jour directement
+  publish_bid(auction, bid_price, bidder_id);
+  if (auction->creator_id == pSystem.my_id) schedule_end(auction, m_send);
+  release_auction(auction);
+
   // Envoyer un message de validation (CODE_VALIDATION = 1)
   struct message *valid_msg = init_message(CODE_VALIDATION);
   if (!valid_msg)
@@ -878,189 +1594,177 @@ int validate_bid(int m_send, unsigned int auction_id, unsigned short bidder_id,
 
   valid_msg->id = pSystem.my_id;
 
-  int buffer_size = get_buffer_size(valid_msg);
-  char *buffer = malloc(buffer_size);
+  int buffer_size;
+  char *buffer = encode_for_auction_group(valid_msg, &buffer_size);
   if (!buffer)
   {
-    perror("Échec de l'allocation du buffer");
+    perror("Échec de la conversion du message en buffer");
     free_message(valid_msg);
     return -1;
   }
 
-  message_to_buffer(valid_msg, buffer, buffer_size);
-  send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size);
+  send_to_auction_group(m_send, buffer, buffer_size);
 
   free(buffer);
   free_message(valid_msg);
-
-  // Dans un cas réel, on compterait les validations reçues
-  // Pour simuler le consensus, on met à jour directement
-  auction->current_price = bid_price;
-  auction->id_dernier_prop = bidder_id;
-  auction->last_bid_time = time(NULL);
-
   return 0;
 }
 
-// Fonction exécutée par le thread de surveillance des enchères
-void *auction_monitor(void *m_send_ptr) {
-  while (monitor_running) {
-    pthread_mutex_lock(&auction_mutex);
-    
-    for (int i = 0; i < auctionSys.count; i++) {
-      struct Auction *auction = &auctionSys.auctions[i];
-      
-      // Ignorer les enchères déjà terminées
-      if (auction->last_bid_time == 0 || auction->auction_id == 0) {
-        continue;
-      }
-
-      unsigned short supervisor_id = (auction->auction_id >> 16) & 0xFFFF;
-      // Seul le superviseur gère les timeouts
-      if (supervisor_id == pSystem.my_id) {
-        time_t now = time(NULL);
-        double time_since_last_bid = difftime(now, auction->last_bid_time);
-        
-        if (time_since_last_bid > AUCTION_TIMEOUT) {
-          printf("Timeout détecté pour l'enchère %u (%.0fs depuis dernière offre)\n", 
-                 auction->auction_id, time_since_last_bid);
-          
-          // Finaliser l'enchère
-          unsigned int auction_id = auction->auction_id;
-          pthread_mutex_unlock(&auction_mutex);
-
-          int m_send = *((int *)m_send_ptr);
-          finalize_auction(m_send, auction_id);
-          mark_auction_finished(auction_id);
-          
-          pthread_mutex_lock(&auction_mutex);
-        }
-      }
-    }
-    
-    pthread_mutex_unlock(&auction_mutex);
-    sleep(2); // Vérifier toutes les 2 secondes
-  }
-  
-  return NULL;
-}
-
 // Fonction pour marquer une enchère comme terminée
 void mark_auction_finished(unsigned int auction_id) {
-  pthread_mutex_lock(&auction_mutex);
-
-  struct Auction *auction = find_auction(auction_id);
+  struct Auction *auction = acquire_auction(auction_id);
   if (!auction) {
-    pthread_mutex_unlock(&auction_mutex);
     return;
   }
 
   // Marquer l'enchère comme terminée en réinitialisant ses champs temporels
-  auction->last_bid_time = 0;  // Marqueur principal de fin
-  
-  printf("Enchère %u marquée comme terminée\n", auction_id);
+  publish_state(auction, auction->current_price, auction->id_dernier_prop, auction->start_time, 0);
+  release_end_timer(auction);
+  release_auction(auction);
 
-  pthread_mutex_unlock(&auction_mutex);
+  printf("Enchère %u marquée comme terminée\n", auction_id);
+  retire_auction(auction_id);
 }
 
 // Fonction pour créer une enchère avec un ID spécifique (pour la synchronisation)
 unsigned int init_auction_with_id(struct Pair *creator, unsigned int initial_price, unsigned int specified_id) {
-  pthread_mutex_lock(&auction_mutex);
-
   // Vérifier que creator est valide
   if (!creator) {
     fprintf(stderr, "Erreur: Créateur invalide\n");
-    pthread_mutex_unlock(&auction_mutex);
     return 0;
   }
 
+  lock_store();
+
   // Vérifier si l'enchère existe déjà
-  for (int i = 0; i < auctionSys.count; i++) {
-    if (auctionSys.auctions[i].auction_id == specified_id) {
-      // L'enchère existe déjà, on ne fait rien
-      printf("L'enchère %u existe déjà, synchronisation ignorée\n", specified_id);
-      pthread_mutex_unlock(&auction_mutex);
-      return specified_id;
-    }
+  if (find_auction(specified_id) != NULL) {
+    // L'enchère existe déjà, on ne fait rien
+    printf("L'enchère %u existe déjà, synchronisation ignorée\n", specified_id);
+    unlock_store();
+    return specified_id;
   }
 
-  // Vérifier si nous avons besoin d'augmenter la capacité
-  if (auctionSys.count >= auctionSys.capacity) {
-    size_t new_capacity = auctionSys.capacity * 2;
-    struct Auction *new_auctions = realloc(auctionSys.auctions, new_capacity * sizeof(struct Auction));
-
-    if (!new_auctions) {
-      perror("Échec de la réallocation du tableau d'enchères");
-      pthread_mutex_unlock(&auction_mutex);
-      return 0;
-    }
-
-    auctionSys.auctions = new_auctions;
-    auctionSys.capacity = new_capacity;
-
-    // Initialiser les nouveaux éléments à zéro
-    memset(&auctionSys.auctions[auctionSys.count], 0,
-           (new_capacity - auctionSys.count) * sizeof(struct Auction));
+  // Visible des lecteurs seulement une fois tous les champs remplis
+  int slot = take_slot();
+  if (slot < 0 || publish_auction(slot, specified_id, creator->id, initial_price, creator->id) < 0) {
+    unlock_store();
+    return 0;
   }
 
-  // Ajouter la nouvelle enchère à la fin du tableau
-  struct Auction *new_auction = &auctionSys.auctions[auctionSys.count];
-
-  new_auction->auction_id = specified_id;
-  new_auction->creator_id = creator->id;
-  new_auction->initial_price = initial_price;
-  new_auction->current_price = initial_price;
-  new_auction->id_dernier_prop = creator->id;
-  new_auction->start_time = time(NULL);
-  new_auction->last_bid_time = time(NULL);
-
-  // Incrémenter le compteur d'enchères APRÈS avoir initialisé tous les champs
-  auctionSys.count++;
+  unlock_store();
 
   printf("Enchère %u synchronisée avec succès (créateur: %d, prix: %u)\n",
          specified_id, creator->id, initial_price);
-
-  pthread_mutex_unlock(&auction_mutex);
   return specified_id;
 }
 
+/**
+ * Annonce de synchronisation en attente de sa signature
+ */
+struct sync_announce {
+  struct crypto_job job;    // Doit rester le premier champ
+  struct message *msg;
+  struct sync_round *round;
+  unsigned char data[MESSAGE_SIGNED_MAX];
+};
+
+/**
+ * Diffusion de toutes les enchères, envoyée quand toutes les signatures sont terminées
+ */
+struct sync_round {
+  int m_send;
+  int count;                // Annonces de la diffusion
+  int pending;              // Signatures pas encore terminées
+  struct sync_announce items[];
+};
+
+// Appelée depuis la boucle d'événements pour chaque annonce signée, la
+// dernière envoie toute la diffusion
+static void send_signed_sync(struct crypto_job *job) {
+  struct sync_announce *ann = (struct sync_announce *) job;
+  struct sync_round *round = ann->round;
+  if (!job->result || message_set_sig_raw(ann->msg, job->sig, job->slen) < 0) {
+    fprintf(stderr, "Échec de la signature de l'annonce de la vente %u\n", ann->msg->numv);
+    free_message(ann->msg);
+    ann->msg = NULL;
+  }
+  if (--round->pending > 0) return;
+
+  // Les annonces sont regroupées en datagrammes de BATCH_MTU octets au plus
+  struct batch out;
+  init_auction_batch(&out, round->m_send);
+  char **auction_buffers = calloc(round->count, sizeof(char *));
+  int *auction_sizes = calloc(round->count, sizeof(int));
+  int count = round->count;
+  if (!auction_buffers || !auction_sizes) {
+    perror("Échec de l'allocation mémoire pour les annonces");
+    count = 0;
+  }
+  for (int i = 0; i < count; i++) {
+    if (!round->items[i].msg) continue;
+    auction_buffers[i] = encode_for_auction_group(round->items[i].msg, &auction_sizes[i]);
+    if (!auction_buffers[i]) {
+      perror("Échec de la conversion du message en buffer");
+    }
+  }
+
+  // Les annonces perdues sont redemandées par leurs destinataires, ou renvoyées une fois
+  int success_count = 0;
+  for (int i = 0; i < count; i++) {
+    if (!auction_buffers[i]) continue;
+    printf("Diffusion de l'enchère %u (prix=%u)...\n",
+           round->items[i].msg->numv, round->items[i].msg->prix);
+    if (batch_add(&out, auction_buffers[i], auction_sizes[i]) < 0) {
+      perror("Échec de l'envoi de l'annonce de vente");
+    }
+  }
+  if (batch_flush(&out) < 0) {
+    perror("Échec de l'envoi de l'annonce de vente");
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (!auction_buffers[i]) continue;
+    success_count++;
+    if (repeat_if_unreliable(round->m_send, auction_buffers[i], auction_sizes[i]) <= 0) {
+      free(auction_buffers[i]);
+    }
+  }
+  printf("Diffusion terminée : %d/%d enchères diffusées avec succès\n",
+         success_count, round->count);
+  free(auction_buffers);
+  free(auction_sizes);
+  for (int i = 0; i < round->count; i++) free_message(round->items[i].msg);
+  free(round);
+}
+
 // Fonction pour diffuser toutes les enchères existantes
 int broadcast_all_auctions(int m_send)
 {
-  pthread_mutex_lock(&auction_mutex);
+  // Copier les enchères pour ne garder aucune référence pendant les opérations réseau
+  int count;
+  struct Auction *auctions_copy = copy_all_auctions(&count);
+  if (!auctions_copy) return -1;
 
-  if (auctionSys.count == 0)
+  if (count == 0)
   {
     printf("Aucune enchère à diffuser\n");
-    pthread_mutex_unlock(&auction_mutex);
+    free(auctions_copy);
     return 0;
   }
 
-  // Copier les données des enchères pour éviter de garder le mutex verrouillé
-  // pendant les opérations réseau
-  struct Auction *auctions_copy = malloc(auctionSys.count * sizeof(struct Auction));
-  if (!auctions_copy)
-  {
-    perror("Échec de l'allocation mémoire pour la copie des enchères");
-    pthread_mutex_unlock(&auction_mutex);
-    return -1;
-  }
+  printf("Diffusion de %d enchères existantes...\n", count);
 
-  // Copier seulement les informations nécessaires
-  int count = auctionSys.count;
-  for (int i = 0; i < count; i++)
+  // Chaque annonce est signée par les threads de crypto, la diffusion part
+  // quand la dernière est terminée
+  struct sync_round *round = malloc(sizeof(struct sync_round) + count * sizeof(struct sync_announce));
+  if (!round)
   {
-    auctions_copy[i].auction_id = auctionSys.auctions[i].auction_id;
-    auctions_copy[i].creator_id = auctionSys.auctions[i].creator_id;
-    auctions_copy[i].initial_price = auctionSys.auctions[i].initial_price;
+    perror("Échec de l'allocation mémoire pour les annonces");
+    free(auctions_copy);
+    return -1;
   }
-
-  // Libérer le mutex après avoir copié les données
-  pthread_mutex_unlock(&auction_mutex);
-
-  printf("Diffusion de %d enchères existantes...\n", count);
-
-  int success_count = 0;
+  round->m_send = m_send;
+  round->count = 0;
 
   for (int i = 0; i < count; i++)
   {
@@ -1075,61 +1779,38 @@ int broadcast_all_auctions(int m_send)
     auction_msg->numv = auctions_copy[i].auction_id;
     auction_msg->prix = auctions_copy[i].initial_price;
 
-    if (message_set_mess(auction_msg, "Synchronisation d'enchère") < 0 ||
-        message_set_sig(auction_msg) < 0)
+    if (message_set_mess(auction_msg, "Synchronisation d'enchère") < 0)
     {
       perror("Échec de l'initialisation des champs du message");
       free_message(auction_msg);
       continue;
     }
 
-    int auction_buffer_size = get_buffer_size(auction_msg);
-    char *auction_buffer = malloc(auction_buffer_size);
-
-    if (!auction_buffer)
-    {
-      perror("Échec de l'allocation du buffer");
-      free_message(auction_msg);
-      continue;
-    }
-
-    memset(auction_buffer, 0, auction_buffer_size);
-
-    if (message_to_buffer(auction_msg, auction_buffer, auction_buffer_size) < 0)
-    {
-      perror("Échec de la conversion du message en buffer");
-      free(auction_buffer);
-      free_message(auction_msg);
-      continue;
-    }
-
-    printf("Diffusion de l'enchère %u (prix=%u)...\n",
-           auctions_copy[i].auction_id, auctions_copy[i].initial_price);
-
-    // Envoyer plusieurs fois pour augmenter les chances de réception
-    int send_success = 0;
-    for (int j = 0; j < 2; j++) { // Réduire à 2 envois au lieu de 3
-      if (send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port,
-                         auction_buffer, auction_buffer_size) >= 0) {
-        send_success = 1;
-      }
-      usleep(200000); // Augmenter légèrement l'intervalle à 200ms
-    }
-
-    if (send_success) {
-      success_count++;
-    }
-
-    free(auction_buffer);
-    free_message(auction_msg);
+    struct sync_announce *ann = &round->items[round->count++];
+    memset(&ann->job, 0, sizeof(ann->job));
+    ann->job.op = CRYPTO_SIGN;
+    ann->job.data = ann->data;
+    ann->job.len = message_signed_data(auction_msg, ann->data);
+    ann->job.done = send_signed_sync;
+    ann->msg = auction_msg;
+    ann->round = round;
   }
-
   free(auctions_copy);
 
-  printf("Diffusion terminée : %d/%d enchères diffusées avec succès\n",
-         success_count, count);
+  int submitted = round->count;
+  if (submitted == 0)
+  {
+    free(round);
+    return 0;
+  }
+  // Compté avant de soumettre : sans threads, les callbacks s'exécutent tout de suite
+  round->pending = submitted;
+  for (int i = 0; i < submitted; i++)
+  {
+    crypto_submit(&round->items[i].job);
+  }
 
-  return success_count;
+  return submitted;
 }
 
 int send_rejection_message(int m_send, struct message *original_msg) {
@@ -1143,12 +1824,11 @@ int send_rejection_message(int m_send, struct message *original_msg) {
   reject_msg->prix = original_msg->prix;
 
   // Envoyer le message de rejet
-  int buffer_size = get_buffer_size(reject_msg);
-  char *buffer = malloc(buffer_size);
+  int buffer_size;
+  char *buffer = encode_for_auction_group(reject_msg, &buffer_size);
   if (buffer)
   {
-    message_to_buffer(reject_msg, buffer, buffer_size);
-    send_multicast(m_send, pSystem.auction_addr, pSystem.auction_port, buffer, buffer_size);
+    send_to_auction_group(m_send, buffer, buffer_size);
     free(buffer);
   }
 
@@ -1157,12 +1837,17 @@ int send_rejection_message(int m_send, struct message *original_msg) {
 }
 
 void display_auctions() {
+  // Copier les enchères pour ne pas afficher pendant la lecture
+  int count;
+  struct Auction *auctions = copy_all_auctions(&count);
+  if (!auctions) return;
+
   printf("\n=== Enchères actives ===\n");
   int active_count = 0;
 
-  for (int i = 0; i < auctionSys.count; i++) {
-    struct Auction *auction = &auctionSys.auctions[i];
-    if (!is_auction_finished(auction->auction_id)) {
+  for (int i = 0; i < count; i++) {
+    struct Auction *auction = &auctions[i];
+    if (!auction_finished(auction)) {
       printf("ID: %u, Prix actuel: %u, Créateur: %d\n", auction->auction_id,
              auction->current_price, auction->creator_id);
       active_count++;
@@ -1176,9 +1861,9 @@ void display_auctions() {
   printf("\n=== Enchères terminées ===\n");
   int finished_count = 0;
 
-  for (int i = 0; i < auctionSys.count; i++) {
-    struct Auction *auction = &auctionSys.auctions[i];
-    if (is_auction_finished(auction->auction_id)) {
+  for (int i = 0; i < count; i++) {
+    struct Auction *auction = &auctions[i];
+    if (auction_finished(auction)) {
       printf("ID: %u, Prix final: %u, Gagnant: %d\n", auction->auction_id,
              auction->current_price, auction->id_dernier_prop);
       finished_count++;
@@ -1188,4 +1873,5 @@ void display_auctions() {
   if (finished_count == 0) {
     printf("Aucune enchère terminée\n");
   }
-}
\ No newline at end of file
+  free(auctions);
+}
@@ -0,0 +1,106 @@
+#include "include/batch.h"
+#include "include/sockets.h"
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+void batch_init(struct batch *b, int sock, const struct endpoint *dest, int enabled) {
+  b->sock = sock;
+  b->dest = dest;
+  b->enabled = enabled;
+  b->send = send_multicast_batch;
+  b->room = BATCH_MTU;
+  b->count = 0;
+  b->len = BATCH_HEADER_SIZE;
+  b->queued = 0;
+}
+
+void batch_set_sender(struct batch *b, batch_send_fn send, int overhead) {
+  b->send = send;
+  b->room = BATCH_MTU - overhead;
+}
+
+// Send the datagrams ready, followed by extra ones already in b->out
+static int send_queued(struct batch *b, int extra) {
+  int ret = 0;
+  if (b->queued + extra > 0) {
+    ret = b->send(b->sock, b->dest, b->out, b->queued + extra);
+  }
+  b->queued = 0;
+  return ret < 0 ? -1 : 0;
+}
+
+// Close the datagram being filled and queue it
+static int close_datagram(struct batch *b) {
+  if (b->count == 0) return 0;
+  unsigned char *buf = b->buf[b->queued];
+  struct datagram *d = &b->out[b->queued];
+  if (b->count == 1) {
+    // No need for a container, send the message as is
+    d->data = buf + BATCH_HEADER_SIZE + 2;
+    d->len = b->len - BATCH_HEADER_SIZE - 2;
+  } else {
+    buf[0] = BATCH_MAGIC;
+    buf[1] = BATCH_VERSION;
+    buf[2] = b->count;
+    d->data = buf;
+    d->len = b->len;
+  }
+  b->queued++;
+  b->count = 0;
+  b->len = BATCH_HEADER_SIZE;
+  return b->queued == BATCH_QUEUE ? send_queued(b, 0) : 0;
+}
+
+int batch_flush(struct batch *b) {
+  int ret = close_datagram(b);
+  if (send_queued(b, 0) < 0) ret = -1;
+  return ret;
+}
+
+int batch_add(struct batch *b, const void *data, int len) {
+  if (len <= 0) return 0;
+  int ret = 0;
+  if (BATCH_HEADER_SIZE + 2 + len > b->room) {
+    // Keep the order of the messages already waiting
+    ret = close_datagram(b);
+    b->out[b->queued].data = data;
+    b->out[b->queued].len = len;
+    if (send_queued(b, 1) < 0) ret = -1;
+    return ret;
+  }
+
+  if (b->len + 2 + len > b->room || b->count == BATCH_MAX_COUNT) {
+    ret = close_datagram(b);
+  }
+  unsigned char *buf = b->buf[b->queued];
+  uint16_t n = htons(len);
+  memcpy(buf + b->len, &n, sizeof(n));
+  memcpy(buf + b->len + 2, data, len);
+  b->len += 2 + len;
+  b->count++;
+  if (!b->enabled && close_datagram(b) < 0) ret = -1;
+  return ret;
+}
+
+int is_batch_buffer(const char *buffer, int len) {
+  return buffer != NULL && len >= BATCH_HEADER_SIZE &&
+         (unsigned char) buffer[0] == BATCH_MAGIC && buffer[1] == BATCH_VERSION;
+}
+
+char *batch_next(char *buffer, int len, int *offset, int *msg_len) {
+  if (*offset == 0) *offset = BATCH_HEADER_SIZE;
+  if (len - *offset < 2) return NULL;
+
+  uint16_t n;
+  memcpy(&n, buffer + *offset, sizeof(n));
+  n = ntohs(n);
+  if (n == 0 || len - *offset - 2 < n) {
+    if (len - *offset > 0) fprintf(stderr, "Error: truncated batch\n");
+    return NULL;
+  }
+  char *msg = buffer + *offset + 2;
+  *offset += 2 + n;
+  *msg_len = n;
+  return msg;
+}
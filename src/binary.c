@@ -0,0 +1,326 @@
+#include "include/binary.h"
+#include "include/utils.h"
+#include "include/schema.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+static void put_u16(unsigned char *p, uint16_t v) {
+  v = htons(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+  v = htonl(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+static uint16_t get_u16(const unsigned char *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return ntohs(v);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return ntohl(v);
+}
+
+// A key is its text form prefixed by its length on one byte
+static unsigned char *put_key(unsigned char *p, const char *cle) {
+  size_t l = strlen(cle);
+  *p++ = l;
+  memcpy(p, cle, l);
+  return p + l;
+}
+
+static const unsigned char *get_key(const unsigned char *p, const unsigned char *end,
+                                    char *cle, size_t size) {
+  if (end - p < 1 || end - p - 1 < p[0] || p[0] >= size) return NULL;
+  memcpy(cle, p + 1, p[0]);
+  cle[p[0]] = '\0';
+  return p + 1 + p[0];
+}
+
+int is_binary_buffer(const char *buffer, int len) {
+  return buffer != NULL && len >= BINARY_HEADER_SIZE &&
+         (unsigned char) buffer[0] == BINARY_MAGIC;
+}
+
+int get_binary_size(struct message *msg) {
+  if (msg == NULL) {
+    perror("Error: msg is NULL");
+    return -1;
+  }
+
+  const struct message_schema *schema = message_schema(msg->code);
+  int infos = 1; // Peers carried by FIELD_INFO, updated by FIELD_NB
+  int size = BINARY_HEADER_SIZE;
+  for (int f = 0; f < schema->count; f++) {
+    switch (FIELD_TYPE(schema->fields[f])) {
+      case FIELD_ID:       size += 2; break;
+      case FIELD_MESS:     size += 2 + msg->lmess; break;
+      case FIELD_SIG:      size += 2 + msg->lsig; break;
+      case FIELD_IP:       size += sizeof(struct in6_addr); break;
+      case FIELD_PORT:     size += 2; break;
+      case FIELD_ENC:      size += 1; break;
+      case FIELD_NB:       size += 2; infos = msg->nb; break;
+      case FIELD_INFO:     size += infos * (2 + sizeof(struct in6_addr) + 2); break;
+      case FIELD_INFO_ENC: size += infos; break;
+      case FIELD_CLE:      size += 1 + strlen(msg->cle); break;
+      case FIELD_DH:       size += 1 + msg->ldh; break;
+      case FIELD_GKEY:     size += 1 + msg->lgkey; break;
+      case FIELD_MAC:      size += 1 + msg->lmac; break;
+      case FIELD_INFO_CLE:
+        for (int i = 0; i < infos; i++) size += 1 + strlen(msg->info[i].cle);
+        break;
+      case FIELD_NUMV:     size += 4; break;
+      case FIELD_PRIX:     size += 4; break;
+    }
+  }
+  return size;
+}
+
+int message_to_binary(struct message *msg, unsigned char *buffer, int buffer_size) {
+  if (msg == NULL || buffer == NULL) {
+    perror("Error: msg or buffer is NULL");
+    return -1;
+  }
+  int size = get_binary_size(msg);
+  if (size < 0 || size > buffer_size) {
+    fprintf(stderr, "Error: buffer too small for binary message (%d > %d)\n", size, buffer_size);
+    return -1;
+  }
+
+  const struct message_schema *schema = message_schema(msg->code);
+  int infos = 1; // Peers carried by FIELD_INFO, updated by FIELD_NB
+  struct field_blob blob;
+  unsigned char *p = buffer;
+  *p++ = BINARY_MAGIC;
+  *p++ = BINARY_VERSION;
+  *p++ = msg->code;
+
+  for (int f = 0; f < schema->count; f++) {
+    switch (FIELD_TYPE(schema->fields[f])) {
+      case FIELD_ID:
+        put_u16(p, msg->id);
+        p += 2;
+        break;
+      case FIELD_MESS:
+        put_u16(p, msg->lmess);
+        p += 2;
+        if (msg->lmess > 0) memcpy(p, msg->mess, msg->lmess);
+        p += msg->lmess;
+        break;
+      case FIELD_SIG:
+        put_u16(p, msg->lsig);
+        p += 2;
+        if (msg->lsig > 0) memcpy(p, msg->sig, msg->lsig);
+        p += msg->lsig;
+        break;
+      case FIELD_IP:
+        memcpy(p, &msg->ip, sizeof(struct in6_addr));
+        p += sizeof(struct in6_addr);
+        break;
+      case FIELD_PORT:
+        put_u16(p, msg->port);
+        p += 2;
+        break;
+      case FIELD_ENC:
+        *p++ = msg->enc;
+        break;
+      case FIELD_NB:
+        put_u16(p, msg->nb);
+        p += 2;
+        infos = msg->nb;
+        break;
+      case FIELD_INFO:
+        for (int i = 0; i < infos; i++) {
+          put_u16(p, msg->info[i].id);
+          p += 2;
+          memcpy(p, &msg->info[i].ip, sizeof(struct in6_addr));
+          p += sizeof(struct in6_addr);
+          put_u16(p, msg->info[i].port);
+          p += 2;
+        }
+        break;
+      case FIELD_INFO_ENC:
+        for (int i = 0; i < infos; i++) *p++ = msg->info[i].enc;
+        break;
+      case FIELD_CLE:
+        p = put_key(p, msg->cle);
+        break;
+      case FIELD_INFO_CLE:
+        for (int i = 0; i < infos; i++) p = put_key(p, msg->info[i].cle);
+        break;
+      case FIELD_DH:
+      case FIELD_GKEY:
+      case FIELD_MAC:
+        // Byte strings are prefixed by their length on one byte
+        message_field_blob(msg, schema->fields[f], &blob);
+        *p++ = *blob.len;
+        memcpy(p, blob.data, *blob.len);
+        p += *blob.len;
+        break;
+      case FIELD_NUMV:
+        put_u32(p, msg->numv);
+        p += 4;
+        break;
+      case FIELD_PRIX:
+        put_u32(p, msg->prix);
+        p += 4;
+        break;
+    }
+  }
+  return p - buffer;
+}
+
+int binary_to_message_in_place(struct message *msg, const unsigned char *buffer, int len,
+                               struct info *info, int max_info) {
+  if (msg == NULL || !is_binary_buffer((const char *) buffer, len)) {
+    perror("Error: invalid binary buffer");
+    return -1;
+  }
+  if (buffer[1] != BINARY_VERSION) {
+    fprintf(stderr, "Error: unsupported binary version %d\n", buffer[1]);
+    return -1;
+  }
+
+  // Initialize fields to defaults
+  memset(msg, 0, sizeof(struct message));
+  msg->enc = ENC_TEXT;
+
+  const unsigned char *p = buffer + 2;
+  const unsigned char *end = buffer + len;
+  msg->code = *p++;
+
+  const struct message_schema *schema = message_schema(msg->code);
+  int optional = 0; // Set once the optional fields are reached
+  int infos = 1;    // Peers carried by FIELD_INFO, updated by FIELD_NB
+  struct field_blob blob;
+  uint16_t l;
+
+  for (int f = 0; f < schema->count; f++) {
+    int field = FIELD_TYPE(schema->fields[f]);
+    if (schema->fields[f] & FIELD_OPTIONAL) optional = 1;
+    // The optional fields are omitted all together at the end of the message
+    if (optional && p == end) break;
+
+    switch (field) {
+      case FIELD_ID:
+        if (end - p < 2) goto truncated;
+        msg->id = get_u16(p);
+        p += 2;
+        break;
+      case FIELD_MESS:
+        // MESS points into the buffer, delimited by LMESS
+        if (end - p < 2) goto truncated;
+        l = get_u16(p);
+        p += 2;
+        if (l > UINT8_MAX || end - p < l) goto truncated;
+        msg->lmess = l;
+        if (l > 0) msg->mess = (char *) p;
+        p += l;
+        break;
+      case FIELD_SIG:
+        // SIG points into the buffer, delimited by LSIG
+        if (end - p < 2) goto truncated;
+        l = get_u16(p);
+        p += 2;
+        if (l > UINT8_MAX || end - p < l) goto truncated;
+        msg->lsig = l;
+        if (l > 0) msg->sig = (char *) p;
+        p += l;
+        break;
+      case FIELD_IP:
+        if (end - p < (int) sizeof(struct in6_addr)) goto truncated;
+        memcpy(&msg->ip, p, sizeof(struct in6_addr));
+        p += sizeof(struct in6_addr);
+        break;
+      case FIELD_PORT:
+        if (end - p < 2) goto truncated;
+        msg->port = get_u16(p);
+        p += 2;
+        break;
+      case FIELD_ENC:
+        msg->enc = *p++;
+        break;
+      case FIELD_NB:
+        if (end - p < 2) goto truncated;
+        msg->nb = get_u16(p);
+        p += 2;
+        infos = msg->nb;
+        if (infos > max_info) {
+          // Not enough room in the caller's array, msg->nb tells how much is needed
+          return -1;
+        }
+        break;
+      case FIELD_INFO:
+        if (infos > max_info) return -1;
+        if (end - p < infos * (2 + (int) sizeof(struct in6_addr) + 2)) goto truncated;
+        msg->info = info;
+        for (int i = 0; i < infos; i++) {
+          memset(&info[i], 0, sizeof(struct info));
+          info[i].enc = ENC_TEXT;
+          info[i].id = get_u16(p);
+          p += 2;
+          memcpy(&info[i].ip, p, sizeof(struct in6_addr));
+          p += sizeof(struct in6_addr);
+          info[i].port = get_u16(p);
+          p += 2;
+        }
+        break;
+      case FIELD_INFO_ENC:
+        if (end - p < infos) goto truncated;
+        for (int i = 0; i < infos; i++) info[i].enc = *p++;
+        break;
+      case FIELD_CLE:
+        p = get_key(p, end, msg->cle, sizeof(msg->cle));
+        if (p == NULL) goto truncated;
+        break;
+      case FIELD_DH:
+      case FIELD_GKEY:
+      case FIELD_MAC:
+        message_field_blob(msg, field, &blob);
+        if (end - p < 1 || end - p - 1 < p[0] || p[0] > blob.cap) goto truncated;
+        *blob.len = p[0];
+        memcpy(blob.data, p + 1, p[0]);
+        p += 1 + p[0];
+        break;
+      case FIELD_INFO_CLE:
+        for (int i = 0; i < infos && p != NULL; i++) {
+          p = get_key(p, end, info[i].cle, sizeof(info[i].cle));
+        }
+        if (p == NULL) goto truncated;
+        break;
+      case FIELD_NUMV:
+        if (end - p < 4) goto truncated;
+        msg->numv = get_u32(p);
+        p += 4;
+        break;
+      case FIELD_PRIX:
+        if (end - p < 4) goto truncated;
+        msg->prix = get_u32(p);
+        p += 4;
+        break;
+    }
+  }
+  return 0;
+
+ truncated:
+  fprintf(stderr, "Error: truncated binary message (CODE %d)\n", msg->code);
+  msg->mess = NULL;
+  msg->sig = NULL;
+  msg->info = NULL;
+  return -1;
+}
+
+int binary_to_message(struct message *msg, const unsigned char *buffer, int len) {
+  if (!is_binary_buffer((const char *) buffer, len)) {
+    perror("Error: invalid binary buffer");
+    return -1;
+  }
+  return decode_message(msg, (char *) buffer, len);
+}
@@ -0,0 +1,598 @@
+#include "include/conn.h"
+#include "include/event.h"
+#include "include/message.h"
+#include "include/sockets.h"
+#include "include/stream.h"
+#include "include/binary.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define CONN_CLOSED     0
+#define CONN_CONNECTING 1
+#define CONN_OPEN       2
+
+#define CONN_MAX_PENDING (4 * STREAM_MAX_FRAME) // Queued bytes before giving up on a peer
+
+/**
+ * A message whose fate the sender waits for
+ */
+struct conn_waiter {
+  uint64_t end;          // Written once this many bytes were written on the connection
+  int *status;           // Receives CONN_SENT or CONN_FAILED
+};
+
+/**
+ * A connection to a peer
+ */
+struct conn {
+  unsigned short id;     // Peer identifier
+  struct endpoint ep;    // Address it was opened to
+  int persistent;        // Kept for the next messages (ENC_FRAMED)
+  int sock;
+  int state;             // CONN_*
+  uint64_t since;        // When the connection was started, or last wrote (ms)
+  char *out;             // Data not written yet, from out_start to out_len
+  int out_start;
+  int out_len;
+  int out_cap;
+  uint64_t written;      // Bytes written since the connection was created
+  struct conn_waiter *waiters; // Messages not written yet, by end
+  int nwaiters;
+  int waiters_cap;
+  unsigned int held;     // Answers still to come (conn_hold()), 0 otherwise
+  struct conn *next;
+};
+
+/**
+ * An incoming connection
+ */
+struct conn_reader {
+  struct stream st;
+  conn_handler handler;
+  uint64_t since;        // When the connection was accepted (ms)
+  int messages;          // Messages received
+  int taken;             // Answered with conn_reply(), no longer read
+  struct conn_reader *next;
+};
+
+static struct conn *conns = NULL;
+static struct conn_reader *readers = NULL;
+static int check_timer = -1; // Gives up on the connections taking too long
+static unsigned int last_hold = 0;
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_conn_event(int fd, uint32_t events, void *arg);
+
+// Tell the waiters of the messages written so far, or of all of them
+static void conn_notify(struct conn *c, int status) {
+  int done = 0;
+  while (done < c->nwaiters && (status == CONN_FAILED || c->waiters[done].end <= c->written)) {
+    *c->waiters[done].status = status;
+    done++;
+  }
+  c->nwaiters -= done;
+  memmove(c->waiters, c->waiters + done, c->nwaiters * sizeof(*c->waiters));
+}
+
+// Close the socket of a connection, what was left to send is dropped
+static void conn_drop(struct conn *c) {
+  if (c->sock >= 0) {
+    event_remove(c->sock);
+    close(c->sock);
+  }
+  c->sock = -1;
+  c->state = CONN_CLOSED;
+  c->written += c->out_len - c->out_start;
+  c->out_start = 0;
+  c->out_len = 0;
+  conn_notify(c, CONN_FAILED);
+}
+
+// Unlink and free a connection
+static void conn_free(struct conn *c) {
+  conn_drop(c);
+  for (struct conn **p = &conns; *p != NULL; p = &(*p)->next) {
+    if (*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+  free(c->out);
+  free(c->waiters);
+  free(c);
+}
+
+static void conn_fail(struct conn *c, const char *reason) {
+  char ip_str[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, &c->ep.addr.sin6_addr, ip_str, sizeof(ip_str));
+  fprintf(stderr, "Échec de la connexion au pair %d (%s, port %d): %s\n",
+          c->id, ip_str, endpoint_port(&c->ep), reason);
+  if (c->persistent) conn_drop(c);
+  else conn_free(c);
+}
+
+static void reader_close(struct conn_reader *r);
+
+// Give up on the connections taking too long to be established or to write
+static void check_connecting(uint64_t now) {
+  struct conn *c = conns;
+  while (c != NULL) {
+    struct conn *next = c->next;
+    if (c->state == CONN_CONNECTING && now - c->since >= CONN_CONNECT_MS) {
+      conn_fail(c, "délai de connexion dépassé");
+    } else if (c->state == CONN_OPEN && c->out_len > c->out_start && now - c->since >= CONN_STALL_MS) {
+      conn_fail(c, "le pair ne lit plus");
+    }
+    c = next;
+  }
+  // An incoming connection says why it was opened at once
+  struct conn_reader *r = readers;
+  while (r != NULL) {
+    struct conn_reader *next = r->next;
+    if (r->messages == 0 && now - r->since >= CONN_IDLE_MS) {
+      fprintf(stderr, "Connexion entrante sans message, fermée\n");
+      reader_close(r);
+    }
+    r = next;
+  }
+}
+
+static void on_check_timer(int fd, uint32_t events, void *arg) {
+  (void) fd;
+  (void) events;
+  (void) arg;
+  check_connecting(now_ms());
+}
+
+static void start_check_timer(void) {
+  if (check_timer < 0) {
+    check_timer = event_add_timer(CONN_CHECK_MS, CONN_CHECK_MS, on_check_timer, NULL);
+  }
+}
+
+static int conn_open(struct conn *c) {
+  c->sock = setup_client_socket_nowait(&c->ep);
+  if (c->sock < 0) return -1;
+  if (event_add(c->sock, EVENT_WRITE, on_conn_event, c) < 0) {
+    close(c->sock);
+    c->sock = -1;
+    return -1;
+  }
+  start_check_timer();
+  c->state = CONN_CONNECTING;
+  c->since = now_ms();
+  return 0;
+}
+
+// Write what the socket accepts, 1 once everything is written, 0 if not yet, -1 on error
+static int conn_write(struct conn *c) {
+  while (c->out_start < c->out_len) {
+    ssize_t n = send(c->sock, c->out + c->out_start, c->out_len - c->out_start, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      return -1;
+    }
+    c->out_start += n;
+    c->written += n;
+    c->since = now_ms();
+    conn_notify(c, CONN_SENT);
+  }
+  c->out_start = 0;
+  c->out_len = 0;
+  return 1;
+}
+
+// Write, then wait for what is needed next
+static void conn_progress(struct conn *c) {
+  int ret = conn_write(c);
+  if (ret < 0) {
+    conn_fail(c, strerror(errno));
+  } else if (ret > 0 && !c->persistent && !c->held) {
+    // Older peers read until the connection is closed
+    conn_free(c);
+  } else {
+    // Readable when the peer closes the connection
+    event_modify(c->sock, ret > 0 ? EVENT_READ : EVENT_READ | EVENT_WRITE);
+  }
+}
+
+static void on_conn_event(int fd, uint32_t events, void *arg) {
+  struct conn *c = arg;
+
+  if (c->state == CONN_CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err != 0) {
+      conn_fail(c, strerror(err));
+      return;
+    }
+    c->state = CONN_OPEN;
+  }
+
+  if (events & EVENT_READ) {
+    // Peers never answer on these connections: this is the end of it
+    char discard[256];
+    ssize_t n = recv(fd, discard, sizeof(discard), 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      if (c->out_len > 0) conn_fail(c, "connexion fermée par le pair");
+      else if (c->persistent) conn_drop(c);
+      else conn_free(c);
+      return;
+    }
+  } else if (events & (EPOLLERR | EPOLLHUP)) {
+    conn_fail(c, "connexion perdue");
+    return;
+  }
+  conn_progress(c);
+}
+
+static struct conn *conn_find(unsigned short id) {
+  for (struct conn *c = conns; c != NULL; c = c->next) {
+    if (c->persistent && c->id == id) return c;
+  }
+  return NULL;
+}
+
+static struct conn *conn_new(const struct Pair *pair, int persistent) {
+  struct conn *c = calloc(1, sizeof(struct conn));
+  if (c == NULL) {
+    perror("calloc a échoué (conn)");
+    return NULL;
+  }
+  c->id = pair->id;
+  endpoint_set_in6(&c->ep, &pair->ip, pair->port);
+  c->persistent = persistent;
+  c->sock = -1;
+  c->state = CONN_CLOSED;
+  c->next = conns;
+  conns = c;
+  return c;
+}
+
+// Append data to the queue of a connection
+static int conn_queue(struct conn *c, const void *data, int len) {
+  if (c->out_start > 0 && c->out_len + len > c->out_cap) {
+    memmove(c->out, c->out + c->out_start, c->out_len - c->out_start);
+    c->out_len -= c->out_start;
+    c->out_start = 0;
+  }
+  if (c->out_len + len > c->out_cap) {
+    int cap = c->out_cap > 0 ? c->out_cap : UNKNOWN_SIZE;
+    while (cap < c->out_len + len) cap *= 2;
+    char *out = realloc(c->out, cap);
+    if (out == NULL) {
+      perror("realloc a échoué (conn)");
+      return -1;
+    }
+    c->out = out;
+    c->out_cap = cap;
+  }
+  memcpy(c->out + c->out_len, data, len);
+  c->out_len += len;
+  return 0;
+}
+
+// Be told when the last byte queued on a connection is written
+static int conn_add_waiter(struct conn *c, int *status) {
+  if (c->nwaiters == c->waiters_cap) {
+    int cap = c->waiters_cap > 0 ? c->waiters_cap * 2 : 4;
+    struct conn_waiter *waiters = realloc(c->waiters, cap * sizeof(*waiters));
+    if (waiters == NULL) {
+      perror("realloc a échoué (conn)");
+      return -1;
+    }
+    c->waiters = waiters;
+    c->waiters_cap = cap;
+  }
+  c->waiters[c->nwaiters].end = c->written + (c->out_len - c->out_start);
+  c->waiters[c->nwaiters].status = status;
+  c->nwaiters++;
+  *status = CONN_PENDING;
+  return 0;
+}
+
+int conn_send(const struct Pair *pair, const void *data, int len, int *status) {
+  int framed = (pair->encodings & ENC_FRAMED) != 0;
+  if (status != NULL) *status = CONN_FAILED;
+  if (len <= 0 || len > STREAM_MAX_FRAME) return -1;
+
+  struct conn *c = framed ? conn_find(pair->id) : NULL;
+  if (c != NULL && (endpoint_port(&c->ep) != pair->port ||
+                    memcmp(&c->ep.addr.sin6_addr, &pair->ip, sizeof(pair->ip)) != 0)) {
+    // The peer came back with another address
+    conn_free(c);
+    c = NULL;
+  }
+  if (c == NULL && (c = conn_new(pair, framed)) == NULL) return -1;
+
+  if (c->out_len - c->out_start + len > CONN_MAX_PENDING) {
+    conn_fail(c, "trop de données en attente");
+    return -1;
+  }
+  if (framed) {
+    uint32_t n = htonl(len);
+    if (conn_queue(c, &n, sizeof(n)) < 0) return -1;
+  }
+  if (conn_queue(c, data, len) < 0) return -1;
+  if (status != NULL && conn_add_waiter(c, status) < 0) return -1;
+
+  if (c->state == CONN_CLOSED && conn_open(c) < 0) {
+    conn_fail(c, "connexion impossible");
+    return -1;
+  }
+  if (c->state == CONN_OPEN) conn_progress(c);
+  return 0;
+}
+
+// Forget the waiters pointing into status, the caller stops waiting
+static void conn_forget(int *status, int count) {
+  for (struct conn *c = conns; c != NULL; c = c->next) {
+    int kept = 0;
+    for (int i = 0; i < c->nwaiters; i++) {
+      if (c->waiters[i].status >= status && c->waiters[i].status < status + count) {
+        *c->waiters[i].status = CONN_TIMEOUT;
+      } else {
+        c->waiters[kept++] = c->waiters[i];
+      }
+    }
+    c->nwaiters = kept;
+  }
+}
+
+int conn_wait(int *status, int count, int timeout_ms) {
+  uint64_t deadline = now_ms() + timeout_ms;
+  for (;;) {
+    uint64_t now = now_ms();
+    check_connecting(now);
+
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+      if (status[i] == CONN_PENDING) pending++;
+    }
+    if (pending == 0) break;
+    if (now >= deadline) {
+      conn_forget(status, count);
+      break;
+    }
+
+    // Every connection still writing, they stay registered in the event loop
+    int n = 0;
+    for (struct conn *c = conns; c != NULL; c = c->next) {
+      if (c->sock >= 0 && c->out_len > c->out_start) n++;
+    }
+    struct pollfd fds[n];
+    struct conn *which[n];
+    n = 0;
+    for (struct conn *c = conns; c != NULL; c = c->next) {
+      if (c->sock >= 0 && c->out_len > c->out_start) {
+        fds[n].fd = c->sock;
+        fds[n].events = POLLOUT | POLLIN;
+        fds[n].revents = 0;
+        which[n++] = c;
+      }
+    }
+    // Connections being established are given up at CONN_CONNECT_MS
+    uint64_t wait = deadline - now;
+    if (wait > CONN_CONNECT_MS) wait = CONN_CONNECT_MS;
+    if (poll(fds, n, (int) wait) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll a échoué (conn)");
+      conn_forget(status, count);
+      break;
+    }
+    // A handler only frees its own connection
+    for (int i = 0; i < n; i++) {
+      if (fds[i].revents == 0) continue;
+      uint32_t events = 0;
+      if (fds[i].revents & POLLOUT) events |= EVENT_WRITE;
+      if (fds[i].revents & POLLIN) events |= EVENT_READ;
+      if (fds[i].revents & POLLERR) events |= EPOLLERR;
+      if (fds[i].revents & POLLHUP) events |= EPOLLHUP;
+      on_conn_event(fds[i].fd, events, which[i]);
+    }
+  }
+
+  int sent = 0;
+  for (int i = 0; i < count; i++) {
+    if (status[i] == CONN_SENT) sent++;
+  }
+  return sent;
+}
+
+void conn_close(unsigned short id) {
+  struct conn *c = conn_find(id);
+  if (c != NULL) conn_free(c);
+}
+
+// Stop reading an incoming connection, closing it unless it was taken
+static void reader_close(struct conn_reader *r) {
+  for (struct conn_reader **p = &readers; *p != NULL; p = &(*p)->next) {
+    if (*p == r) {
+      *p = r->next;
+      break;
+    }
+  }
+  if (!r->taken) {
+    event_remove(r->st.sock);
+    close(r->st.sock);
+  }
+  stream_free(&r->st);
+  free(r);
+}
+
+// 1 if the next message is whole: a frame, or a text message up to its '\0'
+static int reader_complete(struct conn_reader *r) {
+  char *p = r->st.buf + r->st.start;
+  int avail = r->st.end - r->st.start;
+  if (avail <= 0) return 0;
+  if (p[0] == 0) return 1; // stream_pop() waits for the rest of the frame
+  // Unframed binary messages last until the connection is closed (older peers)
+  return !is_binary_buffer(p, avail) && memchr(p, '\0', avail) != NULL;
+}
+
+static void on_reader_event(int fd, uint32_t events, void *arg) {
+  (void) fd;
+  (void) events;
+  struct conn_reader *r = arg;
+  int ret = stream_fill(&r->st);
+  if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+
+  char *buffer;
+  int len;
+  int popped;
+  while ((ret <= 0 || reader_complete(r)) && (popped = stream_pop(&r->st, &buffer, &len)) != 0) {
+    if (popped < 0) {
+      ret = -1;
+      break;
+    }
+    r->messages++;
+    r->handler(r->st.sock, buffer, len);
+    if (r->taken) break;
+  }
+  if (ret <= 0 || r->taken) reader_close(r);
+}
+
+int conn_accept(int sock, conn_handler handler) {
+  struct conn_reader *r = calloc(1, sizeof(struct conn_reader));
+  if (r == NULL) {
+    perror("calloc a échoué (conn)");
+    close(sock);
+    return -1;
+  }
+  r->handler = handler;
+  r->since = now_ms();
+  int flags = fcntl(sock, F_GETFL);
+  if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+    perror("fcntl a échoué (conn)");
+    free(r);
+    close(sock);
+    return -1;
+  }
+  if (stream_init(&r->st, sock) < 0) {
+    free(r);
+    close(sock);
+    return -1;
+  }
+  if (event_add(sock, EVENT_READ, on_reader_event, r) < 0) {
+    stream_free(&r->st);
+    free(r);
+    close(sock);
+    return -1;
+  }
+  r->next = readers;
+  readers = r;
+  start_check_timer();
+  return 0;
+}
+
+// The connection answering on an incoming socket, taken from its reader
+static struct conn *conn_take(int sock) {
+  struct conn *c = NULL;
+  for (struct conn *it = conns; it != NULL; it = it->next) {
+    if (!it->persistent && it->sock == sock) c = it;
+  }
+  if (c != NULL) return c;
+
+  // The reader stops there, the connection is now written to
+  for (struct conn_reader *r = readers; r != NULL; r = r->next) {
+    if (r->st.sock == sock && !r->taken) {
+      r->taken = 1;
+      event_remove(sock);
+    }
+  }
+  struct sockaddr_in6 peer;
+  socklen_t peer_len = sizeof(peer);
+  memset(&peer, 0, sizeof(peer));
+  getpeername(sock, (struct sockaddr *) &peer, &peer_len);
+
+  struct Pair pair;
+  memset(&pair, 0, sizeof(pair));
+  pair.ip = peer.sin6_addr;
+  pair.port = ntohs(peer.sin6_port);
+  if ((c = conn_new(&pair, 0)) == NULL) {
+    close(sock);
+    return NULL;
+  }
+  c->sock = sock;
+  c->state = CONN_OPEN;
+  c->since = now_ms();
+  // Written from the loop: the next replies are queued behind this one
+  if (event_add(sock, EVENT_READ | EVENT_WRITE, on_conn_event, c) < 0) {
+    conn_free(c);
+    return NULL;
+  }
+  start_check_timer();
+  return c;
+}
+
+// Queue an answer, framed for the peers which asked for it
+static int conn_queue_reply(struct conn *c, const void *data, int len, int framed) {
+  if (len <= 0 || len > STREAM_MAX_FRAME) return -1;
+  if (framed) {
+    uint32_t n = htonl(len);
+    if (conn_queue(c, &n, sizeof(n)) < 0) return -1;
+  }
+  return conn_queue(c, data, len);
+}
+
+int conn_reply(int sock, const void *data, int len, int framed) {
+  if (len <= 0 || len > STREAM_MAX_FRAME) return -1;
+  struct conn *c = conn_take(sock);
+  if (c == NULL) return -1;
+  return conn_queue_reply(c, data, len, framed);
+}
+
+// The connection held with this handle, NULL if it is gone
+static struct conn *conn_held(unsigned int hold) {
+  for (struct conn *c = conns; c != NULL; c = c->next) {
+    if (hold != 0 && c->held == hold) return c;
+  }
+  return NULL;
+}
+
+unsigned int conn_hold(int sock) {
+  struct conn *c = conn_take(sock);
+  if (c == NULL) return 0;
+  if (c->held == 0) {
+    if (++last_hold == 0) last_hold = 1;
+    c->held = last_hold;
+  }
+  return c->held;
+}
+
+int conn_reply_held(unsigned int hold, const void *data, int len, int framed) {
+  struct conn *c = conn_held(hold);
+  if (c == NULL) return -1; // Closed by the peer meanwhile
+  if (conn_queue_reply(c, data, len, framed) < 0) return -1;
+  conn_progress(c);
+  return 0;
+}
+
+void conn_release(unsigned int hold) {
+  struct conn *c = conn_held(hold);
+  if (c == NULL) return;
+  c->held = 0;
+  conn_progress(c);
+}
+
+void conn_cleanup(void) {
+  while (conns != NULL) conn_free(conns);
+  while (readers != NULL) reader_close(readers);
+  if (check_timer >= 0) event_remove(check_timer);
+  check_timer = -1;
+}
@@ -0,0 +1,411 @@
+#include "include/crypto.h"
+#include "include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <openssl/crypto.h>
+
+static EVP_PKEY *privkey = NULL;
+static EVP_PKEY *pubkey = NULL;
+static char pubkey_text[KEY_TEXT_SIZE] = "";
+
+// Group MAC key, written once during the join and read by every thread
+static unsigned char group_key[GROUP_KEY_SIZE];
+static int group_key_known = 0;
+
+// Digest context of each thread, created on first use
+static __thread EVP_MD_CTX *thread_mdctx = NULL;
+static pthread_key_t mdctx_key;
+static pthread_once_t mdctx_once = PTHREAD_ONCE_INIT;
+
+static void mdctx_destroy(void *ctx) {
+  EVP_MD_CTX_free(ctx);
+}
+
+static void mdctx_key_create(void) {
+  if (pthread_key_create(&mdctx_key, mdctx_destroy) != 0) {
+    perror("pthread_key_create a échoué (crypto)");
+  }
+}
+
+static EVP_MD_CTX *get_mdctx(void) {
+  if (thread_mdctx == NULL) {
+    thread_mdctx = EVP_MD_CTX_new();
+    if (thread_mdctx == NULL) {
+      fprintf(stderr, "erreur EVP_MD_CTX_new\n");
+      return NULL;
+    }
+    pthread_once(&mdctx_once, mdctx_key_create);
+    pthread_setspecific(mdctx_key, thread_mdctx);
+  }
+  return thread_mdctx;
+}
+
+int crypto_init(const char *pub_file, const char *priv_file) {
+  crypto_cleanup();
+  pubkey = convert_public_key_to_evp_pkey((char *) pub_file);
+  privkey = convert_private_key_to_evp_pkey((char *) priv_file);
+  if (pubkey == NULL || privkey == NULL) {
+    fprintf(stderr, "Erreur: impossible de charger les clés de signature\n");
+    crypto_cleanup();
+    return -1;
+  }
+
+  // Text form of the key, sent in the join handshake
+  unsigned char raw[KEY_SIZE];
+  size_t raw_len = sizeof(raw);
+  if (EVP_PKEY_get_raw_public_key(pubkey, raw, &raw_len) != 1 || raw_len != KEY_SIZE) {
+    fprintf(stderr, "Erreur: clé publique Ed25519 illisible\n");
+    crypto_cleanup();
+    return -1;
+  }
+  EVP_EncodeBlock((unsigned char *) pubkey_text, raw, raw_len);
+  return 0;
+}
+
+void crypto_cleanup(void) {
+  EVP_PKEY_free(privkey);
+  EVP_PKEY_free(pubkey);
+  privkey = NULL;
+  pubkey = NULL;
+  pubkey_text[0] = '\0';
+  OPENSSL_cleanse(group_key, sizeof(group_key));
+  group_key_known = 0;
+}
+
+EVP_PKEY *crypto_public_key(void) {
+  return pubkey;
+}
+
+const char *crypto_public_key_text(void) {
+  return pubkey_text;
+}
+
+EVP_PKEY *crypto_key_from_text(const char *text) {
+  // 32 bytes give 44 characters, the decoded length includes the padding
+  unsigned char raw[KEY_SIZE + 3];
+  if (text == NULL || strlen(text) != 4 * ((KEY_SIZE + 2) / 3)) return NULL;
+  if (EVP_DecodeBlock(raw, (const unsigned char *) text, strlen(text)) < KEY_SIZE) return NULL;
+  return EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, raw, KEY_SIZE);
+}
+
+int crypto_group_key_generate(void) {
+  if (RAND_bytes(group_key, sizeof(group_key)) != 1) {
+    fprintf(stderr, "erreur RAND_bytes (clé de groupe)\n");
+    return -1;
+  }
+  group_key_known = 1;
+  return 0;
+}
+
+int crypto_has_group_key(void) {
+  return group_key_known;
+}
+
+EVP_PKEY *crypto_dh_generate(unsigned char *pub) {
+  EVP_PKEY *key = NULL;
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+  size_t len = GROUP_KEY_SIZE;
+  if (ctx == NULL || EVP_PKEY_keygen_init(ctx) != 1 || EVP_PKEY_keygen(ctx, &key) != 1 ||
+      EVP_PKEY_get_raw_public_key(key, pub, &len) != 1) {
+    fprintf(stderr, "erreur génération de la clé X25519\n");
+    EVP_PKEY_free(key);
+    key = NULL;
+  }
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+// Pad hiding the group key, derived from an X25519 exchange
+static int group_key_pad(EVP_PKEY *eph, const unsigned char *peer_pub, unsigned char *pad) {
+  static const char label[] = "AuctionP2P group key";
+  unsigned char secret[GROUP_KEY_SIZE];
+  size_t secret_len = sizeof(secret);
+  int ret = -1;
+
+  EVP_PKEY *peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peer_pub, GROUP_KEY_SIZE);
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(eph, NULL);
+  if (peer == NULL || ctx == NULL || EVP_PKEY_derive_init(ctx) != 1 ||
+      EVP_PKEY_derive_set_peer(ctx, peer) != 1 ||
+      EVP_PKEY_derive(ctx, secret, &secret_len) != 1) {
+    fprintf(stderr, "erreur échange X25519\n");
+    goto end;
+  }
+
+  // Both ephemeral keys are fresh: the pad derived from the secret is used once
+  EVP_MD_CTX *md = get_mdctx();
+  if (md == NULL || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1 ||
+      EVP_DigestUpdate(md, label, sizeof(label) - 1) != 1 ||
+      EVP_DigestUpdate(md, secret, secret_len) != 1 ||
+      EVP_DigestFinal_ex(md, pad, NULL) != 1) {
+    fprintf(stderr, "erreur dérivation de la clé de groupe\n");
+    if (md != NULL) EVP_MD_CTX_reset(md);
+    goto end;
+  }
+  EVP_MD_CTX_reset(md);
+  ret = 0;
+
+end:
+  OPENSSL_cleanse(secret, sizeof(secret));
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(peer);
+  return ret;
+}
+
+int crypto_group_key_export(EVP_PKEY *eph, const unsigned char *peer_pub, unsigned char *wrapped) {
+  unsigned char pad[SHA256_DIGEST_LENGTH];
+  if (!group_key_known || group_key_pad(eph, peer_pub, pad) < 0) return -1;
+  for (int i = 0; i < GROUP_KEY_SIZE; i++) wrapped[i] = group_key[i] ^ pad[i];
+  OPENSSL_cleanse(pad, sizeof(pad));
+  return 0;
+}
+
+int crypto_group_key_import(EVP_PKEY *eph, const unsigned char *peer_pub, const unsigned char *wrapped) {
+  unsigned char pad[SHA256_DIGEST_LENGTH];
+  if (group_key_pad(eph, peer_pub, pad) < 0) return -1;
+  for (int i = 0; i < GROUP_KEY_SIZE; i++) group_key[i] = wrapped[i] ^ pad[i];
+  OPENSSL_cleanse(pad, sizeof(pad));
+  group_key_known = 1;
+  return 0;
+}
+
+int crypto_mac(const unsigned char *data, size_t len, unsigned char *mac) {
+  if (!group_key_known) return 0;
+  unsigned char full[SHA256_DIGEST_LENGTH];
+  unsigned int full_len;
+  if (HMAC(EVP_sha256(), group_key, sizeof(group_key), data, len, full, &full_len) == NULL) {
+    fprintf(stderr, "erreur HMAC\n");
+    return 0;
+  }
+  memcpy(mac, full, MAC_SIZE);
+  return 1;
+}
+
+int crypto_mac_verify(const unsigned char *data, size_t len, const unsigned char *mac, size_t mlen) {
+  unsigned char expected[MAC_SIZE];
+  if (!group_key_known) return -1; // Not the same as a forged MAC
+  if (mlen != MAC_SIZE || !crypto_mac(data, len, expected)) return 0;
+  return CRYPTO_memcmp(expected, mac, MAC_SIZE) == 0;
+}
+
+int crypto_sign(const unsigned char *data, size_t len, unsigned char *sig, size_t *slen) {
+  EVP_MD_CTX *mdctx = get_mdctx();
+  if (privkey == NULL || mdctx == NULL) {
+    fprintf(stderr, "Erreur: contexte de signature non initialisé\n");
+    return 0;
+  }
+
+  // Ed25519 hashes with SHA-512 itself, hence no digest
+  *slen = SIGNATURE_SIZE;
+  if (EVP_DigestSignInit(mdctx, NULL, NULL, NULL, privkey) != 1 ||
+      EVP_DigestSign(mdctx, sig, slen, data, len) != 1) {
+    fprintf(stderr, "erreur EVP_DigestSign\n");
+    EVP_MD_CTX_reset(mdctx);
+    return 0;
+  }
+  EVP_MD_CTX_reset(mdctx);
+
+#ifdef SIGN_SELF_VERIFY
+  if (crypto_verify(pubkey, data, len, sig, *slen) != 1) {
+    fprintf(stderr, "Erreur: la signature produite est invalide\n");
+    return 0;
+  }
+#endif
+  return 1;
+}
+
+int crypto_verify(EVP_PKEY *key, const unsigned char *data, size_t len,
+                  const unsigned char *sig, size_t slen) {
+  EVP_MD_CTX *mdctx = get_mdctx();
+  if (key == NULL || mdctx == NULL) return 0;
+
+  int ret = EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, key) == 1 &&
+            EVP_DigestVerify(mdctx, sig, slen, data, len) == 1;
+  EVP_MD_CTX_reset(mdctx);
+  return ret;
+}
+
+// Jobs waiting for a worker
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct crypto_job *queue_head = NULL;
+static struct crypto_job *queue_tail = NULL;
+static int queue_len = 0;
+static struct crypto_job *backlog_head = NULL; // Jobs held while the queue is full
+static struct crypto_job *backlog_tail = NULL;
+static int workers_stopping = 0;
+
+// Finished jobs waiting for crypto_dispatch()
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct crypto_job *done_head = NULL;
+static struct crypto_job *done_tail = NULL;
+static int done_fd = -1;
+
+static pthread_t *workers = NULL;
+static int nb_workers = 0;
+
+static void run_job(struct crypto_job *job) {
+  for (; job != NULL; job = job->batch) {
+    if (job->op == CRYPTO_SIGN) {
+      job->result = crypto_sign(job->data, job->len, job->sig, &job->slen);
+    } else {
+      job->result = crypto_verify(job->pubkey, job->data, job->len, job->sig, job->slen);
+    }
+  }
+}
+
+static void complete_job(struct crypto_job *job) {
+  job->next = NULL;
+  pthread_mutex_lock(&done_mutex);
+  if (done_tail) done_tail->next = job;
+  else done_head = job;
+  done_tail = job;
+  pthread_mutex_unlock(&done_mutex);
+
+  uint64_t one = 1;
+  if (write(done_fd, &one, sizeof(one)) != sizeof(one)) {
+    perror("write a échoué (crypto)");
+  }
+}
+
+static void *crypto_worker(void *arg) {
+  (void) arg;
+  for (;;) {
+    pthread_mutex_lock(&queue_mutex);
+    while (queue_head == NULL && !workers_stopping) {
+      pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    struct crypto_job *job = queue_head;
+    if (job == NULL) {
+      pthread_mutex_unlock(&queue_mutex);
+      return NULL;
+    }
+    queue_head = job->next;
+    if (queue_head == NULL) queue_tail = NULL;
+    queue_len--;
+    // A place was freed: the oldest held job takes it
+    struct crypto_job *held = backlog_head;
+    if (held != NULL) {
+      backlog_head = held->next;
+      if (backlog_head == NULL) backlog_tail = NULL;
+      held->next = NULL;
+      if (queue_tail) queue_tail->next = held;
+      else queue_head = held;
+      queue_tail = held;
+      queue_len++;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    run_job(job);
+    complete_job(job);
+  }
+}
+
+int crypto_workers_start(int count) {
+  if (workers != NULL) return 0;
+  done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (done_fd < 0) {
+    perror("eventfd a échoué (crypto)");
+    return -1;
+  }
+  workers = malloc(count * sizeof(pthread_t));
+  if (workers == NULL) {
+    perror("malloc a échoué (crypto)");
+    close(done_fd);
+    done_fd = -1;
+    return -1;
+  }
+
+  workers_stopping = 0;
+  for (nb_workers = 0; nb_workers < count; nb_workers++) {
+    if (pthread_create(&workers[nb_workers], NULL, crypto_worker, NULL) != 0) {
+      perror("Échec de la création d'un thread de signature");
+      break;
+    }
+  }
+  if (nb_workers == 0) {
+    crypto_workers_stop();
+    return -1;
+  }
+  return 0;
+}
+
+void crypto_workers_stop(void) {
+  pthread_mutex_lock(&queue_mutex);
+  workers_stopping = 1;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
+
+  for (int i = 0; i < nb_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  workers = NULL;
+  nb_workers = 0;
+
+  if (done_fd >= 0) {
+    crypto_dispatch();
+    close(done_fd);
+    done_fd = -1;
+  }
+}
+
+void crypto_submit(struct crypto_job *job) {
+  job->next = NULL;
+  job->result = 0;
+  if (nb_workers == 0) {
+    run_job(job);
+    job->done(job);
+    return;
+  }
+
+  pthread_mutex_lock(&queue_mutex);
+  if (queue_len >= CRYPTO_QUEUE_SIZE) {
+    // Queue full: held until a worker takes a job, never done on the caller's thread
+    if (backlog_tail) backlog_tail->next = job;
+    else backlog_head = job;
+    backlog_tail = job;
+    pthread_mutex_unlock(&queue_mutex);
+    return;
+  }
+  if (queue_tail) queue_tail->next = job;
+  else queue_head = job;
+  queue_tail = job;
+  queue_len++;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+int crypto_completion_fd(void) {
+  return done_fd;
+}
+
+int crypto_dispatch(void) {
+  uint64_t count;
+  if (read(done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    perror("read a échoué (crypto)");
+  }
+
+  pthread_mutex_lock(&done_mutex);
+  struct crypto_job *job = done_head;
+  done_head = done_tail = NULL;
+  pthread_mutex_unlock(&done_mutex);
+
+  int n = 0;
+  while (job != NULL) {
+    // The callback may free the job
+    struct crypto_job *next = job->next;
+    job->done(job);
+    job = next;
+    n++;
+  }
+  return n;
+}
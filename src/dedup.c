@@ -0,0 +1,121 @@
+#include "include/dedup.h"
+#include "include/binary.h"
+#include "include/schema.h"
+#include "include/scan.h"
+#include "include/utils.h"
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint8_t key_tag(const struct dedup_key *key) {
+  uint32_t h = key->numv * 2654435761u ^ key->prix * 2246822519u ^
+               ((uint32_t) key->id << 8 | key->code) * 3266489917u;
+  return h >> 24;
+}
+
+static int key_equal(const struct dedup_key *a, const struct dedup_key *b) {
+  return a->numv == b->numv && a->prix == b->prix && a->id == b->id && a->code == b->code;
+}
+
+// Slot of a message processed within the window, -1 if none
+static int find_slot(const struct dedup *d, const struct dedup_key *key, uint64_t now) {
+  uint8_t tag = key_tag(key);
+  const uint8_t *p = d->tags;
+  const uint8_t *end = d->tags + DEDUP_SIZE;
+  while ((p = memchr(p, tag, end - p)) != NULL) {
+    int i = p - d->tags;
+    if (d->seen[i] != 0 && now - d->seen[i] <= DEDUP_WINDOW_MS && key_equal(&d->keys[i], key)) {
+      return i;
+    }
+    p++;
+  }
+  return -1;
+}
+
+void dedup_init(struct dedup *d) {
+  memset(d, 0, sizeof(struct dedup));
+}
+
+// Auction messages start with ID, then NUMV and PRIX when present. The
+// group key exchange also has a NUMV, but it names a peer and is retried
+static int has_key(uint8_t code) {
+  if (code == CODE_DEMANDE_CLE_GROUPE || code == CODE_CLE_GROUPE) return 0;
+  const struct message_schema *schema = message_schema(code);
+  return schema->count > 0 && FIELD_TYPE(schema->fields[0]) == FIELD_ID &&
+         schema_has_field(code, FIELD_NUMV);
+}
+
+int dedup_key_from_buffer(const char *buffer, int len, struct dedup_key *key) {
+  memset(key, 0, sizeof(struct dedup_key));
+
+  if (is_binary_buffer(buffer, len)) {
+    const unsigned char *p = (const unsigned char *) buffer;
+    key->code = p[2];
+    if (!has_key(key->code) || len < BINARY_HEADER_SIZE + 2) return -1;
+    uint16_t id;
+    uint32_t v;
+    memcpy(&id, p + 3, sizeof(id));
+    key->id = ntohs(id);
+    if (len >= BINARY_HEADER_SIZE + 6) {
+      memcpy(&v, p + 5, sizeof(v));
+      key->numv = ntohl(v);
+    }
+    if (len >= BINARY_HEADER_SIZE + 10 && schema_has_field(key->code, FIELD_PRIX)) {
+      memcpy(&v, p + 9, sizeof(v));
+      key->prix = ntohl(v);
+    }
+    return 0;
+  }
+
+  // CODE|ID|NUMV|PRIX, read without touching the buffer
+  int off[4];
+  int end = strnlen(buffer, len);
+  int n = scan_separators(buffer, 0, end, SEPARATOR[0], off, 4);
+  if (n == 0) return -1;
+  key->code = parse_uint(buffer, off[0]);
+  if (!has_key(key->code)) return -1;
+
+  uint32_t values[3] = { 0, 0, 0 };
+  for (int i = 0; i < 3 && i < n; i++) {
+    int start = off[i] + 1;
+    int stop = i + 1 < n ? off[i + 1] : end;
+    if (stop <= start) return -1; // Empty token, let the decoder handle it
+    values[i] = parse_uint(buffer + start, stop - start);
+  }
+  key->id = values[0];
+  key->numv = values[1];
+  key->prix = schema_has_field(key->code, FIELD_PRIX) ? values[2] : 0;
+  return 0;
+}
+
+int dedup_key_from_message(const struct message *msg, struct dedup_key *key) {
+  memset(key, 0, sizeof(struct dedup_key));
+  if (!has_key(msg->code)) return -1;
+  key->code = msg->code;
+  key->id = msg->id;
+  key->numv = msg->numv;
+  key->prix = msg->prix;
+  return 0;
+}
+
+int dedup_seen(const struct dedup *d, const struct dedup_key *key) {
+  return find_slot(d, key, now_ms()) >= 0;
+}
+
+int dedup_add(struct dedup *d, const struct dedup_key *key) {
+  uint64_t now = now_ms();
+  if (find_slot(d, key, now) >= 0) return 1;
+
+  int i = d->next;
+  d->keys[i] = *key;
+  d->seen[i] = now;
+  d->tags[i] = key_tag(key);
+  d->next = (i + 1) % DEDUP_SIZE;
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include "include/epoch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/**
+ * An object waiting for the readers which may see it
+ */
+struct retired {
+  epoch_release release;
+  void *arg;
+  uint64_t epoch;             // Epoch it was retired in
+  struct retired *next;
+};
+
+static uint64_t global_epoch = 0;
+static long readers[2];                  // Readers in progress, by parity of their epoch
+static __thread int depth = 0;           // Nesting of epoch_enter() in this thread
+static __thread uint64_t reader_epoch;   // Epoch this thread reads in
+
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct retired *retired = NULL;   // Most recent first
+
+void epoch_enter(void) {
+  if (depth++ > 0) return;
+  for (;;) {
+    uint64_t e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&readers[e & 1], 1, __ATOMIC_SEQ_CST);
+    // The epoch advanced before we were counted: we may be invisible to it
+    if (__atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) == e) {
+      reader_epoch = e;
+      return;
+    }
+    __atomic_sub_fetch(&readers[e & 1], 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+void epoch_exit(void) {
+  if (--depth > 0) return;
+  __atomic_sub_fetch(&readers[reader_epoch & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+// The readers in progress are in the current epoch or the previous one:
+// move on once the previous one has none left
+static void try_advance(void) {
+  uint64_t e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&readers[(e + 1) & 1], __ATOMIC_SEQ_CST) != 0) return;
+  __atomic_compare_exchange_n(&global_epoch, &e, e + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+int epoch_retire(epoch_release release, void *arg) {
+  struct retired *r = malloc(sizeof(struct retired));
+  if (r == NULL) {
+    perror("malloc a échoué (epoch)");
+    return -1;
+  }
+  r->release = release;
+  r->arg = arg;
+  r->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock(&retired_lock);
+  r->next = retired;
+  retired = r;
+  pthread_mutex_unlock(&retired_lock);
+  return 0;
+}
+
+int epoch_reclaim(void) {
+  // Two steps in a row when nobody reads: what was just retired is released
+  try_advance();
+  try_advance();
+  uint64_t e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+  // Take the objects no reader can see, release them without the lock
+  pthread_mutex_lock(&retired_lock);
+  struct retired *safe = NULL;
+  struct retired **link = &retired;
+  while (*link != NULL) {
+    struct retired *r = *link;
+    if (r->epoch + 2 <= e) {
+      *link = r->next;
+      r->next = safe;
+      safe = r;
+    } else {
+      link = &r->next;
+    }
+  }
+  pthread_mutex_unlock(&retired_lock);
+
+  int count = 0;
+  while (safe != NULL) {
+    struct retired *next = safe->next;
+    safe->release(safe->arg);
+    free(safe);
+    safe = next;
+    count++;
+  }
+  return count;
+}
+
+void epoch_cleanup(void) {
+  pthread_mutex_lock(&retired_lock);
+  struct retired *r = retired;
+  retired = NULL;
+  pthread_mutex_unlock(&retired_lock);
+  while (r != NULL) {
+    struct retired *next = r->next;
+    r->release(r->arg);
+    free(r);
+    r = next;
+  }
+}
@@ -0,0 +1,215 @@
+#include "include/event.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#define SOURCE_FD     0
+#define SOURCE_TIMER  1
+#define SOURCE_WAKEUP 2
+
+/**
+ * A registered descriptor
+ */
+struct event_source {
+  int fd;
+  int kind;                    // SOURCE_*
+  event_handler handler;       // NULL once removed
+  void *arg;
+  struct event_source *next;   // Removed sources waiting to be freed
+};
+
+static int epoll_fd = -1;
+static int running = 0;
+static int dispatching = 0;                  // Handlers of a wakeup are being called
+static struct event_source **sources = NULL; // Indexed by descriptor
+static int sources_size = 0;
+static struct event_source *removed = NULL;  // Freed once no handler can see them
+
+int event_init(void) {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    perror("epoll_create1 a échoué");
+    return -1;
+  }
+  return 0;
+}
+
+static void free_removed(void) {
+  while (removed != NULL) {
+    struct event_source *next = removed->next;
+    free(removed);
+    removed = next;
+  }
+}
+
+void event_cleanup(void) {
+  for (int fd = 0; fd < sources_size; fd++) {
+    if (sources[fd] != NULL) event_remove(fd);
+  }
+  free_removed();
+  free(sources);
+  sources = NULL;
+  sources_size = 0;
+  if (epoll_fd >= 0) close(epoll_fd);
+  epoll_fd = -1;
+}
+
+static int add_source(int fd, uint32_t events, int kind, event_handler handler, void *arg) {
+  if (fd < 0 || handler == NULL) return -1;
+  if (fd >= sources_size) {
+    int size = sources_size > 0 ? sources_size : 16;
+    while (size <= fd) size *= 2;
+    struct event_source **grown = realloc(sources, size * sizeof(*sources));
+    if (grown == NULL) {
+      perror("realloc a échoué (event)");
+      return -1;
+    }
+    memset(grown + sources_size, 0, (size - sources_size) * sizeof(*sources));
+    sources = grown;
+    sources_size = size;
+  }
+  if (sources[fd] != NULL) {
+    fprintf(stderr, "Erreur: descripteur %d déjà enregistré\n", fd);
+    return -1;
+  }
+
+  struct event_source *src = malloc(sizeof(struct event_source));
+  if (src == NULL) {
+    perror("malloc a échoué (event)");
+    return -1;
+  }
+  src->fd = fd;
+  src->kind = kind;
+  src->handler = handler;
+  src->arg = arg;
+  src->next = NULL;
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = src;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("epoll_ctl a échoué (ajout)");
+    free(src);
+    return -1;
+  }
+  sources[fd] = src;
+  return 0;
+}
+
+int event_add(int fd, uint32_t events, event_handler handler, void *arg) {
+  return add_source(fd, events, SOURCE_FD, handler, arg);
+}
+
+int event_modify(int fd, uint32_t events) {
+  if (fd < 0 || fd >= sources_size || sources[fd] == NULL) return -1;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = sources[fd];
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    perror("epoll_ctl a échoué (modification)");
+    return -1;
+  }
+  return 0;
+}
+
+int event_remove(int fd) {
+  if (fd < 0 || fd >= sources_size || sources[fd] == NULL) return -1;
+  struct event_source *src = sources[fd];
+  sources[fd] = NULL;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  if (src->kind != SOURCE_FD) close(fd);
+
+  // Events of this wakeup may still point to it
+  src->handler = NULL;
+  src->next = removed;
+  removed = src;
+  if (!dispatching) free_removed();
+  return 0;
+}
+
+int event_set_timer(int fd, int first_ms, int interval_ms) {
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = first_ms / 1000;
+  its.it_value.tv_nsec = (long) (first_ms % 1000) * 1000000;
+  its.it_interval.tv_sec = interval_ms / 1000;
+  its.it_interval.tv_nsec = (long) (interval_ms % 1000) * 1000000;
+  if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+    perror("timerfd_settime a échoué");
+    return -1;
+  }
+  return 0;
+}
+
+int event_add_timer(int first_ms, int interval_ms, event_handler handler, void *arg) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    perror("timerfd_create a échoué");
+    return -1;
+  }
+  if (event_set_timer(fd, first_ms, interval_ms) < 0 ||
+      add_source(fd, EVENT_READ | EVENT_EDGE, SOURCE_TIMER, handler, arg) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int event_add_wakeup(event_handler handler, void *arg) {
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    perror("eventfd a échoué (event)");
+    return -1;
+  }
+  if (add_source(fd, EVENT_READ | EVENT_EDGE, SOURCE_WAKEUP, handler, arg) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void event_wakeup(int fd) {
+  uint64_t one = 1;
+  if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("write a échoué (event)");
+  }
+}
+
+int event_run(void) {
+  struct epoll_event events[EVENT_MAX];
+  running = 1;
+  while (running) {
+    int n = epoll_wait(epoll_fd, events, EVENT_MAX, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait a échoué");
+      running = 0;
+      return -1;
+    }
+
+    dispatching = 1;
+    for (int i = 0; i < n; i++) {
+      struct event_source *src = events[i].data.ptr;
+      if (src->handler == NULL) continue; // Removed by a previous handler
+      if (src->kind != SOURCE_FD) {
+        // Edge-triggered: empty the counter before calling the handler
+        uint64_t count;
+        if (read(src->fd, &count, sizeof(count)) < 0) continue;
+      }
+      src->handler(src->fd, events[i].events, src->arg);
+    }
+    dispatching = 0;
+    free_removed();
+  }
+  return 0;
+}
+
+void event_stop(void) {
+  running = 0;
+}
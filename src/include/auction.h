@@ -5,6 +5,7 @@
 #include <time.h>
 #include "pairs.h"
 #include "message.h"
+#include "wheel.h"
 
 /**
  * @brief Structure to store auction information
@@ -17,16 +18,45 @@ struct Auction {
   unsigned short id_dernier_prop; // Identifier of the peer who made the last bid
   time_t start_time;              // Auction start time
   time_t last_bid_time;           // Last bid timestamp
+  unsigned int seq;               // Sequence lock of the price, last bidder and times: odd while they change
+  struct wheel_timer *end_timer;  // Auctions we supervise: next end warning or end, NULL otherwise
+  int warned;                     // The end warning was sent since the last bid
+  int live;                       // In the store; 0 once retired, the slot is reused when no reader can see it
   // Potential additional fields for supervisor, etc.
 };
 
+#define AUCTION_INDEX_MIN 16  // Initial size of the index by auction ID (power of 2)
+#define AUCTION_CHUNK_BITS 6
+#define AUCTION_CHUNK (1 << AUCTION_CHUNK_BITS) // Auctions per block of the arena
+#define AUCTION_CHUNKS_MIN 4  // Initial size of the block table
+
+/**
+ * @brief Open-addressing table by auction ID
+ *
+ * Its size is stored with it: a reader without lock sees both from the
+ * same pointer.
+ */
+struct AuctionIndex {
+  int size;             // A power of 2 at least twice count
+  int slots[];          // Slot + 1, 0 if empty
+};
+
 /**
  * @brief Structure to manage multiple auctions
+ *
+ * Auctions live in blocks of AUCTION_CHUNK allocated on demand: a block is
+ * never moved nor freed before cleanup, so a pointer to an auction stays
+ * valid. Slot i is auction i % AUCTION_CHUNK of block i / AUCTION_CHUNK.
  */
 struct AuctionSystem {
-  struct Auction *auctions;    // Array of auctions
-  int count;            // Current number of auctions
-  int capacity;         // Maximum capacity of the auctions array
+  struct Auction **chunks;     // Table of the blocks
+  int chunks_size;             // Entries of the table
+  int count;                   // Slots handed out, live or retired
+  int capacity;                // Slots in the allocated blocks
+  struct AuctionIndex *index;  // Live auctions by ID
+  int *free_slots;             // Retired slots no reader can see any more, reused first
+  int free_count;
+  int free_capacity;
 };
 
 /**
@@ -48,7 +78,9 @@ void cleanup_auction_system();
 /**
  * @brief Handle incoming auction messages
  *
- * Processes messages related to auctions received from peers.
+ * Processes messages related to auctions received from peers. The repairs
+ * asked for and sent back (see reliable.h) arrive on m_send, which is
+ * handled the same way.
  *
  * @param auc_sock The socket on which the message was received
  * @param m_send The socket to use for sending responses
@@ -148,7 +180,11 @@ unsigned int generate_auction_id();
 /**
  * @brief Find an auction by its ID
  *
- * Searches for an auction with the specified ID in the auction system.
+ * Looks the ID up in the hash index of the auction system: the cost does
+ * not depend on the number of auctions. For auction.c only: the store lock
+ * must be held, and the lock of the auction's stripe to use its fields.
+ * The auction never moves: the pointer stays valid after the store lock is
+ * released, as long as the caller stays in an epoch (see epoch.h).
  *
  * @param auction_id The auction identifier to search for
  * @return Pointer to the auction if found, NULL otherwise
@@ -208,32 +244,25 @@ int finalize_auction(int m_send, unsigned int auction_id);
  */
 int quit_auction_system(int m_send);
 
-/**
- * @brief Monitoring function for auctions
- *
- * Thread function that periodically checks the status of auctions and 
- * triggers warnings or finalization as needed.
- *
- * @param m_send A pointer to the socket to use for sending messages
- */
-void *auction_monitor(void *m_send);
-
 /**
  * @brief Broadcast all existing auctions to all peers
  *
  * Sends information about all existing auctions to the multicast group
- * to ensure all peers are synchronized.
+ * to ensure all peers are synchronized. The announcements are signed by the
+ * crypto workers and sent together from the event loop once all are signed.
  *
  * @param m_send The socket to use for sending the auction information
- * @return The number of auctions broadcasted, or negative value on error
+ * @return The number of auctions queued for broadcast, or negative value on error
  */
 int broadcast_all_auctions(int m_send);
 
 /**
  * @brief mark an auction as finished
  * 
- * This function marks an auction as finished by resetting its fields.
- * It is typically called when the auction has ended or been finalized.
+ * This function marks an auction as finished by resetting its fields,
+ * then retires it: it leaves the index and its slot is reused once no
+ * reader can still see it. It is typically called when the auction has
+ * ended or been finalized.
  * 
  * @param auction_id The identifier of the auction to mark as finished
  * 
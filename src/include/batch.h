@@ -0,0 +1,109 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "sockets.h"
+
+/**
+ * Several messages in one datagram
+ *
+ * A batch starts with a 3 bytes header:
+ *   MAGIC (0xA6) | VERSION | COUNT
+ * followed by COUNT messages, each one prefixed by its length on 16 bits
+ * (network byte order) and encoded as usual (text with its '\0', or binary).
+ * Batches are only sent when every receiver advertised ENC_BATCH; a batch
+ * holding a single message is sent as that message alone.
+ *
+ * The datagrams of a batch are held until BATCH_QUEUE of them are ready, or
+ * until batch_flush(), and then leave with a single system call.
+ */
+#define BATCH_MAGIC   0xA6
+#define BATCH_VERSION 1
+#define BATCH_HEADER_SIZE 3
+#define BATCH_MTU 1232 // IPv6 minimum MTU (1280) minus the IPv6 and UDP headers
+#define BATCH_MAX_COUNT 255
+#define BATCH_QUEUE 8   // Datagrams sent together
+
+/**
+ * Function sending datagrams to a multicast group, send_multicast_batch() by default
+ */
+typedef int (*batch_send_fn)(int sock, const struct endpoint *dest, const struct datagram *d, int count);
+
+/**
+ * Messages waiting to be sent to a multicast group
+ */
+struct batch {
+  int sock;                         // Socket used to send
+  const struct endpoint *dest;      // Multicast group and port
+  int enabled;                      // Every receiver understands batches
+  batch_send_fn send;               // Sends the datagrams
+  int room;                         // Bytes of a datagram the batch may use
+  int count;                        // Messages in the datagram being filled
+  int len;                          // Bytes used in that datagram
+  int queued;                       // Datagrams ready to be sent
+  struct datagram out[BATCH_QUEUE + 1];         // Datagrams ready, and one more
+  unsigned char buf[BATCH_QUEUE][BATCH_MTU];    // Header and messages of each datagram
+};
+
+/**
+ * @brief Prepare an empty batch
+ *
+ * @param b The batch
+ * @param sock Socket used to send
+ * @param dest Multicast group and port, must outlive the batch
+ * @param enabled 0 to send every message in its own datagram
+ */
+void batch_init(struct batch *b, int sock, const struct endpoint *dest, int enabled);
+
+/**
+ * @brief Send the datagrams of a batch through another function
+ * @param b The batch, empty
+ * @param send The function sending the datagrams
+ * @param overhead Bytes the function adds to each datagram
+ */
+void batch_set_sender(struct batch *b, batch_send_fn send, int overhead);
+
+/**
+ * @brief Add an encoded message to a batch
+ *
+ * A new datagram is started when the message does not fit in the current
+ * one anymore; a disabled batch puts each message in its own datagram. A
+ * message too large for any datagram is sent right away, after the
+ * datagrams already waiting.
+ *
+ * @param b The batch
+ * @param data The encoded message
+ * @param len Length of the encoded message
+ * @return 0 on success, -1 if a send failed
+ */
+int batch_add(struct batch *b, const void *data, int len);
+
+/**
+ * @brief Send the datagrams waiting in a batch and empty it
+ *
+ * @param b The batch
+ * @return 0 on success (or nothing to send), -1 if the send failed
+ */
+int batch_flush(struct batch *b);
+
+/**
+ * @brief Check whether a received datagram is a batch
+ *
+ * @param buffer The received datagram
+ * @param len Number of bytes received
+ * @return 1 if the datagram is a batch, 0 otherwise
+ */
+int is_batch_buffer(const char *buffer, int len);
+
+/**
+ * @brief Iterate over the messages of a received batch
+ *
+ * @param buffer The received batch
+ * @param len Number of bytes received
+ * @param offset Position in the batch, 0 to get the first message
+ * @param msg_len Receives the length of the message
+ * @return Pointer to the next message inside buffer, NULL at the end or if the batch is truncated
+ */
+char *batch_next(char *buffer, int len, int *offset, int *msg_len);
+
+#endif /* BATCH_H */
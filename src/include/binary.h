@@ -0,0 +1,77 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include "message.h"
+
+/**
+ * Binary wire format
+ *
+ * Every binary message starts with a 3 bytes header:
+ *   MAGIC (0xA5) | VERSION | CODE
+ * followed by the fields of the code, as listed by its schema (schema.h).
+ * Integers are written in network byte order, IPv6 addresses as their raw
+ * 16 bytes, MESS and SIG are prefixed by their length on 16 bits and ENC
+ * takes a single byte. The magic byte can never start a text message,
+ * which only begins with an ASCII digit.
+ */
+#define BINARY_MAGIC   0xA5
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 3
+
+/**
+ * @brief Check whether a received buffer uses the binary format
+ *
+ * @param buffer The received buffer
+ * @param len Number of bytes received
+ * @return 1 if the buffer is a binary message, 0 otherwise
+ */
+int is_binary_buffer(const char *buffer, int len);
+
+/**
+ * @brief Compute the exact size of the binary encoding of a message
+ *
+ * @param msg The message structure to serialize
+ * @return The size of the encoded message, or -1 on error
+ */
+int get_binary_size(struct message *msg);
+
+/**
+ * @brief Convert a message structure to the binary format
+ *
+ * @param msg The message structure to serialize
+ * @param buffer The buffer to fill with the serialized data
+ * @param buffer_size The size of the buffer
+ * @return Number of bytes written on success, -1 on error
+ */
+int message_to_binary(struct message *msg, unsigned char *buffer, int buffer_size);
+
+/**
+ * @brief Decode a binary buffer without any allocation
+ *
+ * MESS and SIG point into the buffer and are only delimited by LMESS and
+ * LSIG, peers are written into the caller's info array.
+ *
+ * @param msg The message structure to populate
+ * @param buffer The buffer to deserialize, must outlive msg
+ * @param len Number of bytes in the buffer
+ * @param info Array receiving the peers of CODE 5, 6 and 7
+ * @param max_info Number of entries available in info
+ * @return 0 on success, -1 on error (msg->nb > max_info if info is too small)
+ */
+int binary_to_message_in_place(struct message *msg, const unsigned char *buffer, int len,
+                               struct info *info, int max_info);
+
+/**
+ * @brief Convert a binary buffer to a message structure
+ *
+ * MESS, SIG and the info array are allocated and must be released
+ * with free_message().
+ *
+ * @param msg The message structure to populate
+ * @param buffer The buffer to deserialize
+ * @param len Number of bytes in the buffer
+ * @return 0 on success, -1 on error
+ */
+int binary_to_message(struct message *msg, const unsigned char *buffer, int len);
+
+#endif /* BINARY_H */
@@ -0,0 +1,145 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include "pairs.h"
+
+/**
+ * TCP connections between peers
+ *
+ * Every peer which advertised ENC_FRAMED keeps one connection, opened on
+ * the first message sent to it and reused for the next ones: a message
+ * costs a write instead of a connect. Connections are non-blocking and
+ * driven by the event loop; a connection the peer closed, or whose address
+ * changed, is opened again on the next message. Older peers read a single
+ * message per connection and get a new one for each message.
+ *
+ * Incoming connections are read the same way, so a peer keeping its
+ * connection open never blocks the main loop; one sending nothing is
+ * closed after CONN_IDLE_MS. A handler may answer on the connection it
+ * was called for with conn_reply(), as the join protocol does.
+ *
+ * To be used from the thread running event_run() only.
+ */
+#define CONN_CONNECT_MS 3000   // Time allowed to establish a connection
+#define CONN_STALL_MS 5000     // Time allowed without writing anything queued
+#define CONN_IDLE_MS 5000      // Time allowed to an incoming connection to send a message
+#define CONN_CHECK_MS 1000     // Interval between two checks of these delays
+#define CONN_BROADCAST_MS 2000 // Time allowed to reach every peer of a broadcast
+
+// Fate of a message, see conn_send()
+#define CONN_PENDING 0         // Not written yet
+#define CONN_SENT 1            // Written on the connection
+#define CONN_FAILED -1         // The connection failed before it was written
+#define CONN_TIMEOUT -2        // Still not written when conn_wait() gave up
+
+/**
+ * @brief Function called with each message received on an incoming connection
+ *
+ * @param sock The connection, for conn_reply()
+ * @param buffer The message, followed by a '\0'
+ * @param len Length of the message
+ */
+typedef void (*conn_handler)(int sock, char *buffer, int len);
+
+/**
+ * @brief Send a message to a peer
+ *
+ * The message is copied; it is written as soon as the connection allows,
+ * framed if the peer has ENC_FRAMED. Sending to several peers in a row
+ * starts every connection at once.
+ *
+ * @param pair The peer
+ * @param data The encoded message
+ * @param len Length of the encoded message
+ * @param status If not NULL, receives CONN_PENDING, then CONN_SENT or
+ *               CONN_FAILED; must stay valid until then or until conn_wait()
+ * @return 0 if the message was queued, -1 on error (*status is CONN_FAILED)
+ */
+int conn_send(const struct Pair *pair, const void *data, int len, int *status);
+
+/**
+ * @brief Wait for the fate of messages sent with conn_send()
+ *
+ * Returns once no status is CONN_PENDING, or at the deadline: the ones
+ * still pending become CONN_TIMEOUT (their connection goes on in the
+ * event loop). The time taken is the one of the slowest peer answering,
+ * not the sum over the peers.
+ *
+ * @param status The statuses given to conn_send()
+ * @param count Number of statuses
+ * @param timeout_ms Time allowed
+ * @return Number of messages written (CONN_SENT)
+ */
+int conn_wait(int *status, int count, int timeout_ms);
+
+/**
+ * @brief Close the connection to a peer, dropping what it had left to send
+ *
+ * @param id Peer identifier
+ */
+void conn_close(unsigned short id);
+
+/**
+ * @brief Read the messages of an incoming connection in the event loop
+ *
+ * The connection is closed once the peer closes it.
+ *
+ * @param sock The accepted socket
+ * @param handler Function called with each message
+ * @return 0 on success, -1 on error (the socket is then closed)
+ */
+int conn_accept(int sock, conn_handler handler);
+
+/**
+ * @brief Answer on an incoming connection
+ *
+ * The connection is no longer read: the handler gets no more messages
+ * from it. The answers are queued in order and written from the event
+ * loop, then the connection is closed; it is dropped if the peer stops
+ * reading for CONN_STALL_MS.
+ *
+ * @param sock The connection given to the handler
+ * @param data The encoded message
+ * @param len Length of the encoded message
+ * @param framed Prefix the message with its length (peer has ENC_FRAMED)
+ * @return 0 if the message was queued, -1 on error
+ */
+int conn_reply(int sock, const void *data, int len, int framed);
+
+/**
+ * @brief Keep an incoming connection for answers that are not ready yet
+ *
+ * As for conn_reply(), the connection is no longer read. It stays open
+ * once what is queued is written, until conn_release(), so that answers
+ * computed later (signatures) still reach the peer. The handle tells a
+ * connection closed meanwhile from a new one on the same socket.
+ *
+ * @param sock The connection given to the handler
+ * @return A handle for conn_reply_held() and conn_release(), 0 on error
+ */
+unsigned int conn_hold(int sock);
+
+/**
+ * @brief Answer on a connection kept with conn_hold()
+ *
+ * @param hold The handle of conn_hold()
+ * @param data The encoded message
+ * @param len Length of the encoded message
+ * @param framed Prefix the message with its length (peer has ENC_FRAMED)
+ * @return 0 if the message was queued, -1 if the connection is gone or on error
+ */
+int conn_reply_held(unsigned int hold, const void *data, int len, int framed);
+
+/**
+ * @brief Let a connection kept with conn_hold() close once written
+ *
+ * @param hold The handle of conn_hold()
+ */
+void conn_release(unsigned int hold);
+
+/**
+ * @brief Close every connection
+ */
+void conn_cleanup(void);
+
+#endif /* CONN_H */
@@ -0,0 +1,230 @@
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stddef.h>
+#include <openssl/evp.h>
+
+#define PUBLIC_KEY_FILE  "pub-ed25519-key.pem"
+#define PRIVATE_KEY_FILE "priv-ed25519-key.pem"
+#define SIGNATURE_SIZE 64 // Size of an Ed25519 signature
+#define KEY_SIZE 32       // Size of a raw Ed25519 public key
+#define KEY_TEXT_SIZE 60  // Room for a public key in base64 (struct info, struct message)
+#define GROUP_KEY_SIZE 32 // Size of the group MAC key and of X25519 keys
+#define MAC_SIZE 16       // HMAC-SHA256 truncated to 128 bits
+
+#define CRYPTO_WORKERS 2       // Threads started by crypto_workers_start()
+#define CRYPTO_QUEUE_SIZE 256  // Jobs waiting for a worker at most
+
+#define CRYPTO_SIGN 1   // Sign data with our private key
+#define CRYPTO_VERIFY 2 // Verify a signature with the key of the signer
+
+/**
+ * Process-wide signing context
+ *
+ * The key pair is read once by crypto_init(); signing and verifying then
+ * only cost the Ed25519 operation. Each thread reuses its own EVP_MD_CTX.
+ * Build with -DSIGN_SELF_VERIFY to check every signature produced.
+ */
+
+/**
+ * @brief Load the key pair used to sign our messages
+ *
+ * @param pub_file File containing the public key in PEM format
+ * @param priv_file File containing the private key in PEM format
+ * @return 0 on success, -1 on error
+ */
+int crypto_init(const char *pub_file, const char *priv_file);
+
+/**
+ * @brief Release the key pair
+ */
+void crypto_cleanup(void);
+
+/**
+ * @brief Our public key
+ *
+ * @return The public key loaded by crypto_init(), NULL if not loaded
+ */
+EVP_PKEY *crypto_public_key(void);
+
+/**
+ * @brief Our public key as exchanged with the other peers
+ *
+ * @return The raw public key in base64, "" if not loaded
+ */
+const char *crypto_public_key_text(void);
+
+/**
+ * @brief Build a public key from its text form
+ *
+ * @param text Raw Ed25519 public key in base64
+ * @return The key, to release with EVP_PKEY_free(), NULL if invalid
+ */
+EVP_PKEY *crypto_key_from_text(const char *text);
+
+/**
+ * @brief Sign data with our private key
+ *
+ * @param data The data to sign
+ * @param len Length of the data
+ * @param sig Buffer receiving the signature, at least SIGNATURE_SIZE bytes
+ * @param slen Receives the length of the signature
+ * @return 1 on success, 0 on error
+ */
+int crypto_sign(const unsigned char *data, size_t len, unsigned char *sig, size_t *slen);
+
+/**
+ * @brief Verify a signature
+ *
+ * @param pubkey The public key of the signer
+ * @param data The signed data
+ * @param len Length of the data
+ * @param sig The signature
+ * @param slen Length of the signature
+ * @return 1 if the signature is valid, 0 otherwise
+ */
+int crypto_verify(EVP_PKEY *pubkey, const unsigned char *data, size_t len,
+                  const unsigned char *sig, size_t slen);
+
+/**
+ * Group MAC key
+ *
+ * Bids are sent at high rates, they carry a MAC with a key shared by the
+ * whole group rather than a signature. The first peer creates the key; a
+ * peer joining receives it during the handshake, wrapped with a secret
+ * agreed by an X25519 exchange which both sides sign with Ed25519.
+ */
+
+/**
+ * @brief Create a new group key (first peer of a network)
+ *
+ * @return 0 on success, -1 on error
+ */
+int crypto_group_key_generate(void);
+
+/**
+ * @brief Tell whether the group key is known
+ *
+ * @return 1 if known, 0 otherwise
+ */
+int crypto_has_group_key(void);
+
+/**
+ * @brief Wrap our group key for a peer joining
+ *
+ * @param eph Our ephemeral X25519 key
+ * @param peer_pub Ephemeral X25519 public key of the joiner
+ * @param wrapped Receives the wrapped key, GROUP_KEY_SIZE bytes
+ * @return 0 on success, -1 if the group key is unknown or on error
+ */
+int crypto_group_key_export(EVP_PKEY *eph, const unsigned char *peer_pub, unsigned char *wrapped);
+
+/**
+ * @brief Unwrap the group key received when joining and use it
+ *
+ * @param eph Our ephemeral X25519 key
+ * @param peer_pub Ephemeral X25519 public key of the peer which wrapped it
+ * @param wrapped The wrapped key, GROUP_KEY_SIZE bytes
+ * @return 0 on success, -1 on error
+ */
+int crypto_group_key_import(EVP_PKEY *eph, const unsigned char *peer_pub, const unsigned char *wrapped);
+
+/**
+ * @brief Create an ephemeral X25519 key for the join handshake
+ *
+ * @param pub Receives the raw public key, GROUP_KEY_SIZE bytes
+ * @return The key, to release with EVP_PKEY_free(), NULL on error
+ */
+EVP_PKEY *crypto_dh_generate(unsigned char *pub);
+
+/**
+ * @brief Compute the MAC of data with the group key
+ *
+ * @param data The data
+ * @param len Length of the data
+ * @param mac Receives the MAC, MAC_SIZE bytes
+ * @return 1 on success, 0 if the group key is unknown or on error
+ */
+int crypto_mac(const unsigned char *data, size_t len, unsigned char *mac);
+
+/**
+ * @brief Check the MAC of data with the group key
+ *
+ * @param data The data
+ * @param len Length of the data
+ * @param mac The MAC received
+ * @param mlen Length of the MAC
+ * @return 1 if the MAC is valid, 0 if not, -1 if the group key is unknown
+ */
+int crypto_mac_verify(const unsigned char *data, size_t len, const unsigned char *mac, size_t mlen);
+
+/**
+ * Asynchronous signing and verifying
+ *
+ * Jobs are queued to worker threads so that the event loop never waits for
+ * an Ed25519 operation. A finished job is put on a completion list and the
+ * descriptor returned by crypto_completion_fd() becomes readable; the event
+ * loop then calls crypto_dispatch() which runs the callbacks on its thread,
+ * in the order the jobs finished.
+ *
+ * Jobs chained through their batch field are done by one worker, in order,
+ * and complete together: only the callback of the first job is run. This
+ * lets a burst of received messages pay for a single hand-off.
+ */
+struct crypto_job {
+  int op;                          // CRYPTO_SIGN or CRYPTO_VERIFY
+  const unsigned char *data;       // Data to sign or verify, kept by the caller
+  size_t len;                      // Length of the data
+  unsigned char sig[SIGNATURE_SIZE]; // Signature produced, or to verify
+  size_t slen;                     // Length of the signature
+  EVP_PKEY *pubkey;                // Key of the signer (CRYPTO_VERIFY)
+  int result;                      // 1 if signed / valid, 0 otherwise
+  void (*done)(struct crypto_job *job); // Completion callback
+  void *arg;                       // Free for the caller
+  struct crypto_job *batch;        // Further jobs done along with this one
+  struct crypto_job *next;         // Queue and completion links
+};
+
+/**
+ * @brief Start the worker threads and the completion descriptor
+ *
+ * @param count Number of worker threads
+ * @return 0 on success, -1 on error
+ */
+int crypto_workers_start(int count);
+
+/**
+ * @brief Stop the worker threads
+ *
+ * Jobs still queued are done first and every pending callback is run
+ * before returning.
+ */
+void crypto_workers_stop(void);
+
+/**
+ * @brief Queue a job for the workers
+ *
+ * When the queue is full the job is held and enters the queue as soon as a
+ * worker takes another one, so the caller never waits. Without workers the
+ * job is done and its callback run right away.
+ *
+ * @param job The job, or the first job of a batch, owned by the caller
+ *            until its callback runs
+ */
+void crypto_submit(struct crypto_job *job);
+
+/**
+ * @brief Descriptor readable when finished jobs are waiting
+ *
+ * @return The eventfd to poll, -1 if the workers are not started
+ */
+int crypto_completion_fd(void);
+
+/**
+ * @brief Run the callbacks of the finished jobs
+ *
+ * @return Number of callbacks run
+ */
+int crypto_dispatch(void);
+
+#endif /* CRYPTO_H */
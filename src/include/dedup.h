@@ -0,0 +1,86 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include "message.h"
+
+/**
+ * Suppression of repeated auction messages
+ *
+ * Peers without the envelope of reliable.h may repeat a message, resent
+ * announcements come again and multicast loops our own messages back, so
+ * a receiver sees many messages more than once. The
+ * filter remembers the last DEDUP_SIZE messages processed; a copy received
+ * within DEDUP_WINDOW_MS is dropped before being decoded or verified.
+ */
+#define DEDUP_SIZE 256         // Messages remembered
+#define DEDUP_WINDOW_MS 5000   // A copy received later is processed again
+
+/**
+ * Identity of an auction message
+ */
+struct dedup_key {
+  uint32_t numv;  // Auction number
+  uint32_t prix;  // Price
+  uint16_t id;    // Sender ID
+  uint8_t code;   // Message code
+};
+
+/**
+ * Ring of the messages processed recently
+ */
+struct dedup {
+  struct dedup_key keys[DEDUP_SIZE];
+  uint64_t seen[DEDUP_SIZE];  // When each message was processed (ms)
+  uint8_t tags[DEDUP_SIZE];   // Hash byte of each key, scanned first
+  int next;                   // Slot overwritten next
+};
+
+/**
+ * @brief Empty a filter
+ *
+ * @param d The filter
+ */
+void dedup_init(struct dedup *d);
+
+/**
+ * @brief Read the identity of an encoded message without decoding it
+ *
+ * Only messages carrying NUMV (auction messages) have an identity: the
+ * others differ by fields which are not part of the key.
+ *
+ * @param buffer The encoded message, text or binary
+ * @param len Length of the message
+ * @param key Receives the identity
+ * @return 0 on success, -1 if the message has no identity
+ */
+int dedup_key_from_buffer(const char *buffer, int len, struct dedup_key *key);
+
+/**
+ * @brief Identity of a decoded message
+ *
+ * @param msg The message
+ * @param key Receives the identity
+ * @return 0 on success, -1 if the message has no identity
+ */
+int dedup_key_from_message(const struct message *msg, struct dedup_key *key);
+
+/**
+ * @brief Tell whether a message was processed recently
+ *
+ * @param d The filter
+ * @param key Identity of the message
+ * @return 1 if it was, 0 otherwise
+ */
+int dedup_seen(const struct dedup *d, const struct dedup_key *key);
+
+/**
+ * @brief Remember a message being processed
+ *
+ * @param d The filter
+ * @param key Identity of the message
+ * @return 1 if it was already processed recently (drop it), 0 otherwise
+ */
+int dedup_add(struct dedup *d, const struct dedup_key *key);
+
+#endif /* DEDUP_H */
@@ -0,0 +1,70 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+
+/**
+ * Epoch-based reclamation
+ *
+ * Lets readers use shared objects without taking the lock of their
+ * writers. A reader brackets its accesses with epoch_enter() and
+ * epoch_exit(); a writer which unlinks an object hands it to
+ * epoch_retire() instead of freeing or reusing it at once. The object is
+ * released once every reader which could still see it has left.
+ *
+ * A global epoch advances only when no reader of the previous one remains,
+ * so an object retired in epoch E is safe from epoch E + 2. Readers are
+ * counted per parity of their epoch: entering costs two atomic operations,
+ * whatever the number of threads.
+ */
+
+/**
+ * @brief Function releasing a retired object
+ *
+ * @param arg Value given to epoch_retire()
+ */
+typedef void (*epoch_release)(void *arg);
+
+/**
+ * @brief Start reading shared objects
+ *
+ * Objects found from now on stay valid until the matching epoch_exit().
+ * Calls may be nested. A reader should not stay long: nothing retired
+ * meanwhile is released before it leaves.
+ */
+void epoch_enter(void);
+
+/**
+ * @brief Stop reading shared objects
+ */
+void epoch_exit(void);
+
+/**
+ * @brief Release an object once no reader can see it
+ *
+ * The object must already be unreachable for new readers.
+ *
+ * @param release Function releasing it, called from epoch_reclaim()
+ * @param arg Value passed to the function
+ * @return 0 on success, -1 if it could not be recorded: the object is then
+ *         never released, which is safe
+ */
+int epoch_retire(epoch_release release, void *arg);
+
+/**
+ * @brief Advance the epoch if possible and release what is safe
+ *
+ * The release functions run in the calling thread, with the locks it holds.
+ *
+ * @return Number of objects released
+ */
+int epoch_reclaim(void);
+
+/**
+ * @brief Release every retired object
+ *
+ * No thread may be reading.
+ */
+void epoch_cleanup(void);
+
+#endif /* EPOCH_H */
@@ -0,0 +1,131 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/**
+ * Event loop
+ *
+ * Every descriptor the program waits on is registered once with a handler;
+ * event_run() then waits with epoll and calls the handler of each ready
+ * descriptor, so the cost of a wakeup does not grow with the number of
+ * descriptors.
+ *
+ * Sockets are level-triggered by default: a handler may read only part of
+ * what is waiting and be called again. EVENT_EDGE is for descriptors whose
+ * handler always empties them; timers and wakeups are read by the loop
+ * itself and are always edge-triggered.
+ */
+#define EVENT_MAX 64 // Ready descriptors handled per wakeup
+
+#define EVENT_READ  EPOLLIN
+#define EVENT_WRITE EPOLLOUT
+#define EVENT_EDGE  EPOLLET
+
+/**
+ * @brief Function called when a descriptor is ready
+ *
+ * @param fd The descriptor
+ * @param events What it is ready for (EVENT_READ, EVENT_WRITE, EPOLLHUP, EPOLLERR)
+ * @param arg Value given when registering
+ */
+typedef void (*event_handler)(int fd, uint32_t events, void *arg);
+
+/**
+ * @brief Create the event loop
+ *
+ * @return 0 on success, -1 on error
+ */
+int event_init(void);
+
+/**
+ * @brief Release the event loop, its timers and wakeups
+ *
+ * The other descriptors registered are left open.
+ */
+void event_cleanup(void);
+
+/**
+ * @brief Call a handler when a descriptor is ready
+ *
+ * @param fd The descriptor
+ * @param events EVENT_READ and/or EVENT_WRITE, with EVENT_EDGE if the handler empties it
+ * @param handler Function to call
+ * @param arg Value passed to the handler
+ * @return 0 on success, -1 on error
+ */
+int event_add(int fd, uint32_t events, event_handler handler, void *arg);
+
+/**
+ * @brief Change what a registered descriptor is waited for
+ *
+ * @param fd The descriptor
+ * @param events New events, as for event_add()
+ * @return 0 on success, -1 on error
+ */
+int event_modify(int fd, uint32_t events);
+
+/**
+ * @brief Stop waiting on a descriptor
+ *
+ * Can be called from any handler, including the one of fd. Timers and
+ * wakeups are closed, other descriptors are left open.
+ *
+ * @param fd The descriptor
+ * @return 0 on success, -1 if it was not registered
+ */
+int event_remove(int fd);
+
+/**
+ * @brief Create a timer
+ *
+ * @param first_ms Delay before the first call, 0 to create it disarmed
+ * @param interval_ms Delay between the next calls, 0 for a single call
+ * @param handler Function to call when it expires
+ * @param arg Value passed to the handler
+ * @return The timer descriptor, -1 on error
+ */
+int event_add_timer(int first_ms, int interval_ms, event_handler handler, void *arg);
+
+/**
+ * @brief Arm a timer again
+ *
+ * @param fd The timer descriptor
+ * @param first_ms Delay before the next call, 0 to disarm it
+ * @param interval_ms Delay between the calls after it, 0 for a single call
+ * @return 0 on success, -1 on error
+ */
+int event_set_timer(int fd, int first_ms, int interval_ms);
+
+/**
+ * @brief Create a wakeup other threads can trigger
+ *
+ * @param handler Function called on the loop thread after event_wakeup()
+ * @param arg Value passed to the handler
+ * @return The wakeup descriptor, -1 on error
+ */
+int event_add_wakeup(event_handler handler, void *arg);
+
+/**
+ * @brief Trigger a wakeup, from any thread
+ *
+ * Several triggers before the loop gets to it call the handler once.
+ *
+ * @param fd The wakeup descriptor
+ */
+void event_wakeup(int fd);
+
+/**
+ * @brief Wait for events and call the handlers until event_stop()
+ *
+ * @return 0 once stopped, -1 on error
+ */
+int event_run(void);
+
+/**
+ * @brief Make event_run() return after the current handlers
+ */
+void event_stop(void);
+
+#endif /* EVENT_H */
@@ -0,0 +1,70 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+/**
+ * Public keys of the other peers, indexed by peer ID
+ *
+ * Keys are learnt during the join handshake (CODE 4, 5, 6 and 7) and kept
+ * parsed, so verifying a message never has to decode the key again.
+ */
+#define KEYS_BUCKETS 256 // Hash buckets, peer IDs are spread by their low bits
+
+/**
+ * @brief Remember the public key of a peer
+ *
+ * An empty key is ignored, a different key replaces the known one.
+ *
+ * @param id The peer ID
+ * @param text Raw Ed25519 public key in base64
+ * @return 0 on success, -1 if the key is invalid or on error
+ */
+int keys_set(uint16_t id, const char *text);
+
+/**
+ * @brief Remember the public key of a peer not known yet
+ *
+ * For keys which no trusted signature vouches for: a different key already
+ * known for the peer is kept.
+ *
+ * @param id The peer ID
+ * @param text Raw Ed25519 public key in base64
+ * @return 0 on success, 1 if another key is known for the peer, -1 if the
+ *         key is invalid or on error
+ */
+int keys_add(uint16_t id, const char *text);
+
+/**
+ * @brief Get the public key of a peer
+ *
+ * @param id The peer ID
+ * @return A reference to the key, to release with EVP_PKEY_free(), NULL if unknown
+ */
+EVP_PKEY *keys_get(uint16_t id);
+
+/**
+ * @brief Get the text form of the public key of a peer
+ *
+ * @param id The peer ID
+ * @param text Receives the key in base64, "" if unknown
+ * @param size Size of text
+ * @return 0 if the key is known, -1 otherwise
+ */
+int keys_get_text(uint16_t id, char *text, size_t size);
+
+/**
+ * @brief Forget the public key of a peer
+ *
+ * @param id The peer ID
+ */
+void keys_remove(uint16_t id);
+
+/**
+ * @brief Forget every key
+ */
+void keys_clear(void);
+
+#endif /* KEYS_H */
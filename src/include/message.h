@@ -32,10 +32,26 @@
 #define CODE_ANNUL_SUPERVISEUR  16  // Cancellation due to supervisor disappearance
 #define CODE_ANNUL_DEMANDE      17  // Cancel own request
 #define CODE_RETRAIT_PAIRS      18  // Remove absent peers
+#define CODE_DEMANDE_CLE_GROUPE 21  // Ask a known peer for the group key again
+#define CODE_CLE_GROUPE         22  // Group key wrapped for the peer which asked
 
 #define UNKNOWN_SIZE 1024 // Default size for unknown buffer sizes
 #define SEPARATOR "|"
 
+/**
+ * Wire encodings a peer can speak, advertised as a bitmask (ENC field)
+ * during the join handshake (CODE 4, 5, 6 and 7)
+ */
+#define ENC_TEXT       0x01 // '|' separated ASCII format
+#define ENC_BINARY     0x02 // Fixed-layout binary format (see binary.h)
+#define ENC_BATCH      0x04 // Several messages per datagram (see batch.h)
+#define ENC_FRAMED     0x08 // Length-prefixed messages on TCP (see stream.h)
+#define ENC_RELIABLE   0x10 // Sequenced auction datagrams, repaired on loss (see reliable.h)
+#define ENC_SUPPORTED  (ENC_TEXT | ENC_BINARY | ENC_BATCH | ENC_FRAMED | ENC_RELIABLE) // Encodings spoken by this build
+
+#define MESSAGE_KEY_SIZE 32 // X25519 public key and wrapped group key (GROUP_KEY_SIZE)
+#define MESSAGE_MAC_SIZE 16 // MAC with the group key (MAC_SIZE)
+
 /**
  * Structure to hold peer information
  * Used in the message structure to store peer details
@@ -45,6 +61,7 @@ struct info {
   struct in6_addr ip;   // Peer IP address
   uint16_t port;        // Peer port number
   char cle[60];         // Key
+  uint8_t enc;          // Supported encodings (ENC_* bitmask)
 };
 
 /**
@@ -61,12 +78,34 @@ struct message {
   struct in6_addr ip;   // IP address
   uint16_t port;        // Port number
   char cle[60];         // Key
+  uint8_t enc;          // Supported encodings of the sender (ENC_* bitmask)
+  uint8_t ldh;          // DH length, 0 if absent
+  uint8_t dh[MESSAGE_KEY_SIZE];   // Ephemeral X25519 public key (join handshake)
+  uint8_t lgkey;        // GKEY length, 0 if absent
+  uint8_t gkey[MESSAGE_KEY_SIZE]; // Group MAC key wrapped for the joiner
+  uint8_t lmac;         // MAC length, 0 if absent
+  uint8_t mac[MESSAGE_MAC_SIZE];  // MAC with the group key (bids)
   uint32_t numv;        // Auction number
   uint32_t prix;        // Price
   int nb;               // Number of elements
   struct info *info;    // Array of peer information
 };
 
+/**
+ * Number of peers a message view can hold without allocating
+ */
+#define MESSAGE_VIEW_INFO 32
+
+/**
+ * Caller-owned decoded message, meant to live on the stack
+ * msg.mess and msg.sig point into the received buffer and msg.info into
+ * the embedded array: a view must never be passed to free_message()
+ */
+struct message_view {
+  struct message msg;                   // Decoded message
+  struct info info[MESSAGE_VIEW_INFO];  // Storage for msg.info
+};
+
 /**
  * @brief Display the content of a message
  *
@@ -77,6 +116,9 @@ void print_message(struct message* msg);
 /**
  * @brief Create a new message structure with the given code
  *
+ * The structure comes from the per-thread pool (pool.h) and must be
+ * released with free_message().
+ *
  * @param code The code to set in the message (see defines above)
  * @return Pointer to the newly created message
  */
@@ -92,13 +134,62 @@ struct message* init_message(const int code);
 int message_set_mess(struct message* msg, const char* mess);
 
 /**
- * @brief Set the signature in the message structure
+ * Largest data covered by a signature, see message_signed_data()
+ */
+#define MESSAGE_INFO_DIGEST_SIZE 32 // SHA-256 of the peer list
+#define MESSAGE_SIGNED_MAX (1 + 2 + 4 + 4 + 1 + UINT8_MAX + 16 + 2 + 1 + 1 + 60 + \
+                            MESSAGE_INFO_DIGEST_SIZE + 2 * (1 + MESSAGE_KEY_SIZE))
+
+/**
+ * @brief Build the data covered by the signature of a message
+ *
+ * CODE, ID, NUMV and PRIX in network byte order, then LMESS and MESS, IP,
+ * PORT, ENC, LCLE and CLE when the code carries them. A peer list (INFO,
+ * with its ENC and CLE) is covered by its SHA-256 digest. DH and GKEY come
+ * last, each prefixed by its length. The result does not depend on the
+ * wire encoding. It is also what the MAC of a bid covers.
+ *
+ * @param msg The message
+ * @param data Receives the data, at least MESSAGE_SIGNED_MAX bytes
+ * @return Length of the data, -1 if the digest of the peer list failed
+ */
+int message_signed_data(const struct message* msg, unsigned char* data);
+
+/**
+ * @brief Sign the message with our private key
  *
  * @param msg Pointer to the message to modify
  * @return 0 on success, -1 on error
  */
 int message_set_sig(struct message* msg);
 
+/**
+ * @brief Set the MAC of the message with the group key
+ *
+ * @param msg Pointer to the message to modify
+ * @return 0 on success, -1 if the group key is unknown or on error
+ */
+int message_set_mac(struct message* msg);
+
+/**
+ * @brief Check the MAC of a message with the group key
+ *
+ * @param msg The message
+ * @return 1 if the message carries a valid MAC, 0 if not, -1 if the group
+ *         key is unknown and the MAC cannot be checked
+ */
+int message_check_mac(const struct message* msg);
+
+/**
+ * @brief Set a signature already computed in the message structure
+ *
+ * @param msg Pointer to the message to modify
+ * @param sig The signature of the message, see message_signed_data()
+ * @param slen Length of the signature
+ * @return 0 on success, -1 on error
+ */
+int message_set_sig_raw(struct message* msg, const unsigned char* sig, size_t slen);
+
 /**
  * @brief Set the ip address in the message structure
  *
@@ -127,10 +218,12 @@ int message_set_ip(struct message* msg, struct in6_addr ip);
 int message_set_cle(struct message* msg, const char* cle);
 
 /**
- * @brief Set the auction number in the message structure
+ * @brief Set the number of peers and allocate the info array
+ *
+ * Any previous info array is released.
  *
  * @param msg Pointer to the message to modify
- * @param numv The auction number to set
+ * @param nb The number of peers
  * @return 0 on success, -1 on error
  */
 int message_set_nb(struct message *msg, int nb);
@@ -159,6 +252,9 @@ int message_set_info(struct message *msg, int index, struct info *info);
 /**
  * @brief Free the memory allocated for a message structure
  *
+ * MESS, SIG and the info array are released too, the structure and the
+ * info array go back to the pool.
+ *
  * @param msg Pointer to the message to free
  * @return 0 on success, -1 on error
  */
@@ -2,6 +2,7 @@
 #define PAIRS_H
 
 #include <netinet/in.h>
+#include "sockets.h"
 
 /**
  * @brief Structure to store peer information
@@ -11,6 +12,7 @@ struct Pair {
   struct in6_addr ip;     // Peer IPv6 address
   unsigned short port;    // Peer communication port
   int active;             // Peer status (1 = active, 0 = inactive)
+  unsigned char encodings; // Wire encodings spoken by the peer (ENC_* bitmask)
 };
 
 /**
@@ -25,10 +27,8 @@ struct PairSystem {
   struct in6_addr my_ip;      // Local peer IPv6 address
   unsigned short my_port;     // Local peer communication port
 
-  char liaison_addr[46];      // Multicast liaison address
-  int liaison_port;           // Multicast liaison port
-  char auction_addr[46];      // Multicast auction address
-  int auction_port;           // Multicast auction port
+  struct endpoint liaison;    // Multicast liaison group and port
+  struct endpoint auction;    // Multicast auction group and port
 };
 
 /**
@@ -54,14 +54,16 @@ int join_pairs(int m_sender);
 /**
  * @brief Handle join requests from other peers
  *
- * Processes incoming join requests on the given socket and updates
- * the peer system accordingly.
+ * Answers a join request (CODE 3) waiting on the liaison socket with our
+ * address (CODE 4), without waiting for anything. The joiner then
+ * connects to its contact and sends CODE 5, handled by
+ * process_pair_message() in the event loop, so that several joins can be
+ * in flight at once.
  *
- * @param sock Socket to use for communication
- * @param server_sock Socket for server communication
- * @return 1 if a peer was added, 0 if no peer was added, negative value on error
+ * @param sock Liaison socket
+ * @return 1 if a request was answered, 0 if there was none, negative value on error
  */
-int handle_join(int sock, int server_sock);
+int handle_join(int sock);
 
 /**
  * @brief Add a new peer to the system
@@ -71,31 +73,73 @@ int handle_join(int sock, int server_sock);
  * @param id Peer identifier
  * @param ip Peer IPv6 address
  * @param port Peer communication port
+ * @param encodings Wire encodings advertised by the peer (ENC_* bitmask)
  * @return 0 on success, negative value on error
  */
-int add_pair(unsigned short id, struct in6_addr ip, unsigned short port);
+int add_pair(unsigned short id, struct in6_addr ip, unsigned short port, unsigned char encodings);
 
 /**
  * @brief Send a new peer to the system
  *
- * Sends the details of a new peer to the multicast group.
+ * Sends the details of a new peer to every active peer, on the connection
+ * kept with each of them (see conn.h). All the peers are sent to at once
+ * and waited for at most CONN_BROADCAST_MS; the outcome for each peer is
+ * printed.
  *
  * @param id Peer identifier
  * @param ip Peer IPv6 address
  * @param port Peer communication port
- * @return 0 on success, negative value on error
+ * @param encodings Wire encodings advertised by the peer (ENC_* bitmask)
+ * @return Number of peers the message was written to, negative value on error
+ */
+int send_new_pair(unsigned short id, struct in6_addr ip, unsigned short port, unsigned char encodings);
+
+/**
+ * @brief Choose the encoding to use with a given peer
+ *
+ * @param pair The peer we are about to send to
+ * @return ENC_BINARY if the peer speaks it, ENC_TEXT otherwise
+ */
+int pair_encoding(const struct Pair *pair);
+
+/**
+ * @brief Choose the encoding to use on the multicast groups
+ *
+ * Binary is only used when every active peer advertised it, so that
+ * mixed networks keep working.
+ *
+ * @return ENC_BINARY if every active peer speaks it, ENC_TEXT otherwise
+ */
+int pairs_group_encoding();
+
+/**
+ * @brief Encodings understood by every active peer
+ *
+ * @return Intersection of the ENC_* bitmasks of the active peers
+ */
+unsigned char pairs_group_capabilities();
+
+/**
+ * @brief Tell whether a peer is known and active
+ *
+ * @param id Peer identifier
+ * @return 1 if it is, 0 otherwise
  */
-int send_new_pair(unsigned short id, struct in6_addr ip, unsigned short port);
+int pairs_is_active(unsigned short id);
 
 /**
- * @brief Receive information from a peer (TCP)
+ * @brief Process one message received from a peer on TCP
  *
- * Sends the current peer system information to a specified peer.
+ * Handles CODE 5 (a peer joining through us, answered on its connection
+ * with CODE 50/51 and CODE 7), CODE 6 (a new peer) and CODE 13 (a peer
+ * leaving).
  *
- * @param sock Socket to use for sending
+ * @param sock The connection the message came from
+ * @param buffer The encoded message, decoded in place
+ * @param len Length of the message
  * @return 0 on success, negative value on error
  */
-int recv_message(int sock);
+int process_pair_message(int sock, char *buffer, int len);
 
 /**
  * @brief Quit the peer system
@@ -0,0 +1,72 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "message.h"
+
+/**
+ * Per-thread pools of message structures and small info arrays
+ *
+ * Each thread keeps its own freelists, so getting and releasing an object
+ * never takes a lock. An object may be released by another thread than the
+ * one which got it, it then joins the releasing thread's freelist. Freelists
+ * are bounded; extra objects go back to malloc.
+ */
+#define POOL_INFO_SMALL 8  // Info arrays up to this size are pooled
+#define POOL_MAX_FREE 256  // Objects kept per freelist and per thread
+
+/**
+ * Pool counters, summed over all threads
+ */
+struct pool_stats {
+  unsigned long hits;        // Objects served from a freelist
+  unsigned long misses;      // Objects served by malloc
+  long outstanding;          // Objects currently in use
+};
+
+/**
+ * @brief Get a message structure from the pool
+ *
+ * The structure is not initialized, see init_message().
+ *
+ * @return Pointer to the structure, or NULL on error
+ */
+struct message *pool_get_message(void);
+
+/**
+ * @brief Give a message structure back to the pool
+ *
+ * Its mess, sig and info fields are not released, see free_message().
+ *
+ * @param msg The structure to release, may be NULL
+ */
+void pool_put_message(struct message *msg);
+
+/**
+ * @brief Get an array of info structures from the pool
+ *
+ * Arrays of up to POOL_INFO_SMALL entries are recycled, larger ones are
+ * allocated with malloc.
+ *
+ * @param nb Number of entries needed
+ * @return Pointer to the array, or NULL on error
+ */
+struct info *pool_get_info(int nb);
+
+/**
+ * @brief Give an array obtained with pool_get_info() back to the pool
+ *
+ * @param info The array to release, may be NULL
+ */
+void pool_put_info(struct info *info);
+
+/**
+ * @brief Read the pool counters
+ *
+ * The counters of running threads are read without synchronization, the
+ * result is a close snapshot, not an exact one.
+ *
+ * @param stats Structure receiving the counters
+ */
+void pool_get_stats(struct pool_stats *stats);
+
+#endif /* POOL_H */
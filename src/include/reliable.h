@@ -0,0 +1,125 @@
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "sockets.h"
+
+/**
+ * Loss repair on the auction group
+ *
+ * Every datagram sent to the group by a peer whose receivers all advertised
+ * ENC_RELIABLE is wrapped in a 13 bytes envelope:
+ *   MAGIC (0xA7) | VERSION | TYPE | SENDER (16) | EPOCH (32) | SEQ (32)
+ * followed by the datagram (a message or a batch), integers in network byte
+ * order. SEQ counts the datagrams of the sender, EPOCH is drawn at start so
+ * that a restarted peer is not mistaken for an old one.
+ *
+ * A receiver keeps, per sender (found by its full ID), the highest SEQ seen
+ * and which of the RELIABLE_WINDOW previous ones arrived. A hole is asked
+ * for again with a NACK sent in unicast to the address the datagram came
+ * from: its SEQ is the first missing one, its body a 64 bits mask of the
+ * missing ones from there (bit i for SEQ + i) followed by the ID of the
+ * receiver. The sender answers from the last RELIABLE_HISTORY datagrams it
+ * sent, in unicast too, so repairs only cost what was lost. It answers only
+ * active peers, each at most once per RELIABLE_NACK_MS, so a NACK cannot
+ * make it send more than its window to anyone.
+ * A sender that went quiet sends a few heartbeats carrying its last SEQ,
+ * which lets the receivers notice that the end of a burst was lost.
+ */
+#define RELIABLE_MAGIC   0xA7
+#define RELIABLE_VERSION 1
+#define RELIABLE_HEADER_SIZE 13
+#define RELIABLE_NACK_SIZE (RELIABLE_HEADER_SIZE + 10)
+
+#define RELIABLE_DATA      0 // A datagram for the group, or its retransmission
+#define RELIABLE_HEARTBEAT 1 // Last SEQ sent, no datagram
+#define RELIABLE_NACK      2 // Holes of a receiver, SENDER is the peer asked
+
+#define RELIABLE_HISTORY 256       // Datagrams kept for retransmission
+#define RELIABLE_WINDOW 64         // SEQ tracked below the highest one
+#define RELIABLE_PEERS 256         // Senders tracked at most
+#define RELIABLE_IDLE_MS 60000     // A sender silent this long may give its state to a new one
+#define RELIABLE_HEARTBEAT_MS 1000 // Interval between heartbeats
+#define RELIABLE_HEARTBEATS 3      // Heartbeats sent after the last datagram
+#define RELIABLE_NACK_MS 200       // Interval between two NACKs to a sender, or answered for a receiver
+
+/**
+ * @brief Start numbering our datagrams
+ *
+ * @param id Our peer ID, put in every envelope
+ * @param group Auction group, for the heartbeats; must stay valid
+ */
+void reliable_init(uint16_t id, const struct endpoint *group);
+
+/**
+ * @brief Set who may ask for retransmissions
+ *
+ * NACKs from an ID for which is_peer gives 0 are ignored. Until it is set,
+ * every NACK is answered.
+ *
+ * @param is_peer Tells whether an ID is an active peer
+ */
+void reliable_set_peer_check(int (*is_peer)(uint16_t id));
+
+/**
+ * @brief Send a datagram to a multicast group in an envelope
+ *
+ * Same contract as send_multicast().
+ *
+ * @param sock Socket used to send, also the one polled for the NACKs
+ * @param dest Multicast group and port
+ * @param data The datagram
+ * @param len Length of the datagram
+ * @return 0 on success, -1 on error
+ */
+int reliable_send(int sock, const struct endpoint *dest, const void *data, size_t len);
+
+/**
+ * @brief Send several datagrams to a multicast group, each in its envelope
+ *
+ * Same contract as send_multicast_batch(), which batches use to send.
+ *
+ * @param sock Socket used to send, also the one polled for the NACKs
+ * @param dest Multicast group and port
+ * @param d The datagrams
+ * @param count Number of datagrams
+ * @return 0 on success, -1 on error
+ */
+int reliable_send_batch(int sock, const struct endpoint *dest, const struct datagram *d, int count);
+
+/**
+ * @brief Check whether a received datagram is in an envelope
+ *
+ * @param buffer The received datagram
+ * @param len Number of bytes received
+ * @return 1 if it is, 0 otherwise
+ */
+int is_reliable_buffer(const char *buffer, int len);
+
+/**
+ * @brief Open a received envelope
+ *
+ * Heartbeats and NACKs are handled here: the NACKs and retransmissions they
+ * call for are sent from sock. A datagram received a second time gives 0.
+ *
+ * @param sock Socket used to answer
+ * @param buffer The received datagram
+ * @param len Number of bytes received
+ * @param from Address it came from
+ * @param payload Receives the datagram to process, inside buffer
+ * @return Length of the datagram to process, 0 if there is none
+ */
+int reliable_receive(int sock, char *buffer, int len, const struct sockaddr_in6 *from,
+                     char **payload);
+
+/**
+ * @brief Send a heartbeat if it is time to
+ *
+ * To call about once per RELIABLE_HEARTBEAT_MS from the event loop.
+ *
+ * @param sock Socket used to send
+ */
+void reliable_tick(int sock);
+
+#endif /* RELIABLE_H */
@@ -0,0 +1,74 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+
+/**
+ * Separator scan and integer parsing for the text protocol
+ *
+ * The separator offsets are found with SSE2 or AVX2 when the CPU supports
+ * them, the implementation is picked once at runtime.
+ */
+#define SCAN_CHUNK 64 // Separator offsets kept by a tokenizer between two scans
+
+/**
+ * Tokenizer over a NUL-terminated buffer, modified in place
+ */
+struct scan_tokens {
+  char *buf;               // Buffer being tokenized
+  int len;                 // Length of the buffer, without its '\0'
+  char sep;                // Separator
+  int start;               // Start of the next token
+  int from;                // Where the next scan starts
+  int n;                   // Offsets found by the last scan
+  int i;                   // Next offset to use
+  int off[SCAN_CHUNK];     // Separator offsets
+};
+
+/**
+ * @brief Find the offsets of a separator in a buffer
+ *
+ * @param buf The buffer to scan
+ * @param from Offset where the scan starts
+ * @param len Offset where the scan stops
+ * @param sep The separator
+ * @param off Array receiving the offsets
+ * @param max Size of off, the scan stops once it is full
+ * @return Number of offsets written
+ */
+int scan_separators(const char *buf, int from, int len, char sep, int *off, int max);
+
+/**
+ * @brief Start tokenizing a buffer
+ *
+ * @param t The tokenizer
+ * @param buf The NUL-terminated buffer, separators are replaced by '\0'
+ * @param sep The separator
+ */
+void scan_init(struct scan_tokens *t, char *buf, char sep);
+
+/**
+ * @brief Get the next token
+ *
+ * Like strtok_r(), empty tokens are skipped and the token is terminated
+ * in place by a '\0'.
+ *
+ * @param t The tokenizer
+ * @param len Receives the length of the token, may be NULL
+ * @return The token, or NULL at the end of the buffer
+ */
+char *scan_next(struct scan_tokens *t, int *len);
+
+/**
+ * @brief Parse a decimal token
+ *
+ * Tokens made of up to 10 digits are parsed without a branch per digit,
+ * any other token is handed to strtoul() so the result is unchanged.
+ *
+ * @param s The token
+ * @param len Length of the token
+ * @return The value, truncated to 32 bits
+ */
+uint32_t parse_uint(const char *s, int len);
+
+#endif /* SCAN_H */
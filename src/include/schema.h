@@ -0,0 +1,97 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <stdint.h>
+#include "message.h"
+
+/**
+ * Fields a message can carry, in wire order
+ * The text and binary codecs only differ in how each field is rendered.
+ */
+enum message_field {
+  FIELD_ID = 1,     // ID
+  FIELD_MESS,       // LMESS | MESS
+  FIELD_SIG,        // LSIG | SIG (SIG omitted when LSIG is 0)
+  FIELD_IP,         // IP
+  FIELD_PORT,       // PORT
+  FIELD_ENC,        // ENC of the sender
+  FIELD_NB,         // NB
+  FIELD_INFO,       // [ID | IP | PORT] for each peer
+  FIELD_INFO_ENC,   // [ENC] for each peer, after all the peers
+  FIELD_CLE,        // CLE, public key of the sender
+  FIELD_INFO_CLE,   // [CLE] for each peer, after their ENC
+  FIELD_DH,         // DH, ephemeral X25519 public key
+  FIELD_GKEY,       // GKEY, group MAC key wrapped for the joiner
+  FIELD_MAC,        // MAC with the group key
+  FIELD_NUMV,       // NUMV
+  FIELD_PRIX,       // PRIX
+  FIELD_COUNT
+};
+
+#define FIELD_OPTIONAL 0x80 // The field and the ones after it may be missing (older peers)
+#define FIELD_TYPE(f) ((f) & ~FIELD_OPTIONAL)
+#define SCHEMA_MAX_FIELDS 12
+
+/**
+ * Ordered list of the fields carried by a message code
+ */
+struct message_schema {
+  uint8_t count;                     // Number of fields
+  uint8_t fields[SCHEMA_MAX_FIELDS]; // Fields, possibly flagged FIELD_OPTIONAL
+};
+
+/**
+ * @brief Get the schema of a message code
+ *
+ * Unknown codes have an empty schema (CODE only).
+ *
+ * @param code The message code
+ * @return Pointer to the static schema of the code
+ */
+const struct message_schema *message_schema(uint8_t code);
+
+/**
+ * @brief Get the name of a field, for error messages
+ *
+ * @param field The field (FIELD_OPTIONAL flag is ignored)
+ * @return The field name as written in the protocol description
+ */
+const char *field_name(int field);
+
+/**
+ * Byte string field of fixed maximum size (DH, GKEY, MAC)
+ */
+struct field_blob {
+  uint8_t *data; // Bytes of the field in the message
+  uint8_t *len;  // Length of the field, 0 if absent
+  int cap;       // Size of data
+};
+
+/**
+ * @brief Get the storage of a byte string field
+ *
+ * @param msg The message
+ * @param field FIELD_DH, FIELD_GKEY or FIELD_MAC
+ * @param blob Receives the storage of the field
+ * @return 0 on success, -1 if the field is not a byte string
+ */
+int message_field_blob(struct message *msg, int field, struct field_blob *blob);
+
+/**
+ * @brief Tell whether a message code carries a field
+ *
+ * @param code The message code
+ * @param field The field (FIELD_OPTIONAL flag is ignored)
+ * @return 1 if the code carries the field, 0 otherwise
+ */
+int schema_has_field(uint8_t code, int field);
+
+/**
+ * @brief Number of peers described by a message
+ *
+ * @param msg The message
+ * @return msg->nb if the code carries NB, 1 if it carries a single peer, 0 otherwise
+ */
+int message_info_count(const struct message *msg);
+
+#endif /* SCHEMA_H */
@@ -4,22 +4,77 @@
 #include <netinet/in.h>
 #include <stdlib.h>
 
+/**
+ * A destination resolved once
+ *
+ * Holds the address, the port and, for link-local addresses, the interface,
+ * ready to be given to sendto() or connect() for every message.
+ */
+struct endpoint {
+  struct sockaddr_in6 addr;
+};
+
+/**
+ * @brief Choose the interface of the multicast groups and link-local peers
+ *
+ * Without a call, the first interface up with multicast and an IPv6
+ * address is used, the loopback aside.
+ *
+ * @param name Interface name (e.g. "eth0")
+ * @return 0 on success, -1 if there is no such interface
+ */
+int sockets_set_interface(const char *name);
+
+/**
+ * @brief Get the interface of the multicast groups and link-local peers
+ *
+ * @return Interface index, 0 to let the kernel choose
+ */
+unsigned int sockets_interface(void);
+
+/**
+ * @brief Resolve an IPv6 address given as text
+ *
+ * @param ep The endpoint
+ * @param addr IPv6 address
+ * @param port Port number
+ * @return 0 on success, -1 if the address is invalid
+ */
+int endpoint_set(struct endpoint *ep, const char *addr, int port);
+
+/**
+ * @brief Resolve an IPv6 address
+ *
+ * @param ep The endpoint
+ * @param ip IPv6 address
+ * @param port Port number
+ */
+void endpoint_set_in6(struct endpoint *ep, const struct in6_addr *ip, int port);
+
+/**
+ * @brief Get the port of an endpoint
+ *
+ * @param ep The endpoint
+ * @return Port number
+ */
+int endpoint_port(const struct endpoint *ep);
+
 /**
  * @brief Set up a multicast receiver socket
  *
  * Creates and configures a socket to receive multicast packets
  * from the specified multicast group and port.
  *
- * @param addr Multicast group address
- * @param port Multicast port number
+ * @param group Multicast group and port
  * @return Socket file descriptor on success, negative value on error
  */
-int setup_multicast_receiver(const char *addr, int port);
+int setup_multicast_receiver(const struct endpoint *group);
 
 /**
  * @brief Set up a multicast sender socket
  *
- * Creates and configures a socket to send multicast packets.
+ * Creates and configures a socket to send multicast packets on the
+ * interface of sockets_interface().
  *
  * @return Socket file descriptor on success, negative value on error
  */
@@ -39,14 +94,13 @@ int setup_unicast_receiver(int port);
 /**
  * @brief Set up a unicast sender socket
  *
- * Creates and configures a socket for unicast communication.
- * The socket is configured in non-blocking mode.
+ * Creates a UDP socket connected to the destination, so that messages
+ * are sent with send().
  *
- * @param s_addr Address to bind to (IPv6 address)
- * @param port Port number to bind to
+ * @param dest Destination address and port
  * @return Socket file descriptor on success, negative value on error
  */
-int setup_unicast_sender(const char *s_addr, int port);
+int setup_unicast_sender(const struct endpoint *dest);
 
 /**
  * @brief Set up a unicast TCP socket
@@ -64,11 +118,21 @@ int setup_server_socket(int port);
  *
  * Creates and configures a socket to connect to a specified address and port.
  *
- * @param addr Address to connect to
- * @param port Port number to connect to
+ * @param ep Address and port to connect to
+ * @return Socket file descriptor on success, negative value on error
+ */
+int setup_client_socket(const struct endpoint *ep);
+
+/**
+ * @brief Start a non-blocking TCP connection
+ *
+ * Returns at once; the socket becomes writable when the connection is
+ * established or failed (SO_ERROR tells which).
+ *
+ * @param ep Server address and port
  * @return Socket file descriptor on success, negative value on error
  */
-int setup_client_socket(const char *addr, int port);
+int setup_client_socket_nowait(const struct endpoint *ep);
 
 /**
  * @brief Send data to a multicast group
@@ -76,13 +140,12 @@ int setup_client_socket(const char *addr, int port);
  * Send the specified data to the given multicast group and port.
  *
  * @param sock Socket to use for sending
- * @param addr Multicast group address
- * @param port Multicast port number
+ * @param dest Multicast group and port
  * @param data Pointer to the data to send
  * @param len Length of the data to send
  * @return Number of bytes sent on success, negative value on error
  */
-int send_multicast(int sock, const char *addr, int port, const void *data, size_t len);
+int send_multicast(int sock, const struct endpoint *dest, const void *data, size_t len);
 
 /**
  * @brief Receive data from a multicast group
@@ -97,4 +160,88 @@ int send_multicast(int sock, const char *addr, int port, const void *data, size_
  */
 int receive_multicast(int sock, char *buffer, size_t buffer_size, struct sockaddr_in6 *sender_addr);
 
+/**
+ * @brief Receive a datagram already waiting on a socket
+ *
+ * Same as receive_multicast() but never blocks.
+ *
+ * @param sock Socket to use for receiving
+ * @param buffer Buffer to store received data
+ * @param buffer_size Size of the buffer
+ * @param sender_addr Structure to store sender's address information
+ * @return Number of bytes received, -1 if nothing is waiting or on error
+ */
+int receive_multicast_nowait(int sock, char *buffer, size_t buffer_size, struct sockaddr_in6 *sender_addr);
+
+/**
+ * I/O backends, chosen at run time with sockets_set_backend()
+ */
+#define SOCKETS_CLASSIC 0 // recvmmsg() and sendmmsg()
+#define SOCKETS_URING   1 // io_uring, see uring.h
+
+/**
+ * @brief Choose how batches of datagrams are sent and received
+ *
+ * @param which SOCKETS_CLASSIC or SOCKETS_URING
+ * @return 0 on success, -1 if the backend is not available (unchanged)
+ */
+int sockets_set_backend(int which);
+
+/**
+ * @brief Get the descriptor to wait on before receiving from a socket
+ *
+ * With SOCKETS_URING the socket is received from then on through its own
+ * ring, whose descriptor is returned; otherwise, or if that fails, the
+ * socket itself.
+ *
+ * @param sock The socket
+ * @return The descriptor telling when receive_multicast_batch() has datagrams
+ */
+int sockets_receive_fd(int sock);
+
+/**
+ * @brief Release what the backend holds
+ */
+void sockets_cleanup(void);
+
+/**
+ * A datagram to send, or a buffer to receive one in
+ */
+struct datagram {
+  const void *data;  // Content of the datagram
+  size_t len;        // Length of the content
+};
+
+/**
+ * @brief Send several datagrams to a multicast group at once
+ *
+ * The datagrams leave in order with as few system calls as possible
+ * (sendmmsg).
+ *
+ * @param sock Socket to use for sending
+ * @param dest Multicast group and port
+ * @param d The datagrams
+ * @param count Number of datagrams
+ * @return 0 on success, -1 if a datagram could not be sent
+ */
+int send_multicast_batch(int sock, const struct endpoint *dest, const struct datagram *d, int count);
+
+/**
+ * @brief Receive the datagrams waiting on a socket at once
+ *
+ * Waits for the first datagram, then takes the ones already waiting
+ * without blocking, in a single system call (recvmmsg). A socket received
+ * through io_uring never waits: its completions are read from memory.
+ *
+ * @param sock Socket to use for receiving
+ * @param buffers count buffers of buffer_size bytes, one after the other
+ * @param buffer_size Size of each buffer
+ * @param count Number of buffers
+ * @param lens Receives the length of each datagram
+ * @param senders Receives the address of the sender of each datagram
+ * @return Number of datagrams received, -1 on error or timeout
+ */
+int receive_multicast_batch(int sock, char *buffers, size_t buffer_size, int count,
+                            int *lens, struct sockaddr_in6 *senders);
+
 #endif /* MULTICAST_H */
@@ -0,0 +1,85 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+/**
+ * Message framing on TCP connections
+ *
+ * Peers which advertised ENC_FRAMED receive every message prefixed by its
+ * length on 32 bits (network byte order). The first byte of a frame is
+ * always 0, which no unframed message starts with, so the reader accepts
+ * both: an unframed text message ends at its '\0', or at the end of the
+ * data received so far when it has none (older peers).
+ */
+#define STREAM_HEADER_SIZE 4
+#define STREAM_MAX_FRAME (1 << 20) // Largest accepted message
+
+/**
+ * Buffered reader over a TCP socket
+ */
+struct stream {
+  int sock;      // Socket to read from
+  char *buf;     // Received data
+  int cap;       // Size of buf
+  int start;     // First byte not consumed yet
+  int end;       // End of the received data
+};
+
+/**
+ * @brief Prepare a reader on a socket
+ *
+ * @param s The reader
+ * @param sock The connected socket
+ * @return 0 on success, -1 on error
+ */
+int stream_init(struct stream *s, int sock);
+
+/**
+ * @brief Release the buffer of a reader (the socket is not closed)
+ *
+ * @param s The reader
+ */
+void stream_free(struct stream *s);
+
+/**
+ * @brief Read once from the socket into the reader
+ *
+ * @param s The reader
+ * @return Number of bytes read, 0 if the peer closed the connection, -1 on error
+ */
+int stream_fill(struct stream *s);
+
+/**
+ * @brief Extract the next complete message from the data already read
+ *
+ * The message points into the reader's buffer and stays valid until the
+ * next stream_fill(), it is always followed by a '\0'.
+ *
+ * @param s The reader
+ * @param msg Receives the message
+ * @param len Receives the length of the message
+ * @return 1 if a message was extracted, 0 if more data is needed, -1 on a framing error
+ */
+int stream_pop(struct stream *s, char **msg, int *len);
+
+/**
+ * @brief Wait for the next complete message
+ *
+ * @param s The reader
+ * @param msg Receives the message, see stream_pop()
+ * @param len Receives the length of the message
+ * @return 1 if a message was read, 0 if the connection was closed, -1 on error
+ */
+int stream_read(struct stream *s, char **msg, int *len);
+
+/**
+ * @brief Send a whole message on a TCP socket
+ *
+ * @param sock The connected socket
+ * @param data The encoded message
+ * @param len Length of the encoded message
+ * @param framed Prefix the message with its length (peer has ENC_FRAMED)
+ * @return 0 on success, -1 on error
+ */
+int stream_send(int sock, const void *data, int len, int framed);
+
+#endif /* STREAM_H */
@@ -0,0 +1,91 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <netinet/in.h>
+#include "sockets.h"
+
+/**
+ * io_uring backend of sockets.c
+ *
+ * Selected at run time with sockets_set_backend(SOCKETS_URING), used
+ * through the functions of sockets.h only.
+ *
+ * Receiving: a socket gets its own ring with one multishot recvmsg and a
+ * ring of URING_BUFFERS provided buffers. The kernel fills a buffer for
+ * each datagram and posts a completion without being asked again; the
+ * event loop waits on the ring descriptor and the completions are read
+ * from shared memory, so a burst of datagrams costs no system call.
+ *
+ * Sending: the datagrams of a batch are queued as sendmsg requests and
+ * submitted with a single io_uring_enter() which also waits for them, so
+ * the caller may reuse its buffers as with sendmmsg().
+ */
+#define URING_ENTRIES 64        // Requests in flight per ring
+#define URING_BUFFERS 64        // Receive buffers per socket (power of 2)
+#define URING_BUFFER_SIZE 2048  // recvmsg header, sender address and datagram
+#define URING_RECEIVERS 4       // Sockets received through io_uring at most
+
+/**
+ * @brief Create the ring used to send
+ *
+ * @return 0 on success, -1 if io_uring is not available
+ */
+int uring_init(void);
+
+/**
+ * @brief Release every ring
+ */
+void uring_cleanup(void);
+
+/**
+ * @brief Tell whether the ring used to send works
+ *
+ * @return 1 if it does, 0 if it was never created or failed
+ */
+int uring_sending(void);
+
+/**
+ * @brief Send datagrams to one address with a single submission
+ *
+ * @param sock Socket to use for sending
+ * @param dest Destination of every datagram
+ * @param d The datagrams
+ * @param count Number of datagrams
+ * @return 0 on success, -1 if a datagram could not be sent
+ */
+int uring_send_batch(int sock, const struct sockaddr_in6 *dest, const struct datagram *d, int count);
+
+/**
+ * @brief Start receiving a socket through io_uring
+ *
+ * @param sock The socket
+ * @return The descriptor to wait on before uring_receive_batch(), -1 on error
+ */
+int uring_receive_start(int sock);
+
+/**
+ * @brief Tell whether a socket is received through io_uring
+ *
+ * @param sock The socket
+ * @return 1 if it is, 0 otherwise
+ */
+int uring_receiving(int sock);
+
+/**
+ * @brief Take the datagrams already received on a socket
+ *
+ * Same contract as receive_multicast_batch() but never waits.
+ *
+ * @param sock The socket, started with uring_receive_start()
+ * @param buffers count buffers of buffer_size bytes, one after the other
+ * @param buffer_size Size of each buffer
+ * @param count Number of buffers
+ * @param lens Receives the length of each datagram
+ * @param senders Receives the address of the sender of each datagram
+ * @return Number of datagrams received, -1 if none
+ */
+int uring_receive_batch(int sock, char *buffers, size_t buffer_size, int count,
+                        int *lens, struct sockaddr_in6 *senders);
+
+#endif /* URING_H */
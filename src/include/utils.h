@@ -32,33 +32,6 @@ EVP_PKEY *convert_public_key_to_evp_pkey(char *pubkey);
  */
 int generate_ed25519_key(char* public_key_name, char* private_key_name);
 
-/**
- * @brief Sign a message using the provided private key
- *
- * This function signs a message with the given private key and returns
- * the signature.
- *
- * @param privkey The private key to use for signing
- * @param msg The message to sign
- * @param sig Pointer to store the signature
- * @param slen Pointer to store the length of the signature
- * @return 1 on success, 0 on error
- */
-int sign(EVP_PKEY *privkey, unsigned char *msg, unsigned char **sig, size_t *slen);
-
-/**
- * @brief Verify a signature using the provided public key
- *
- * This function verifies a signature against a message using the given public key.
- *
- * @param pubkey The public key to use for verification
- * @param msg The message that was signed
- * @param sig The signature to verify
- * @param slen The length of the signature
- * @return 1 if the signature is valid, 0 if invalid, -1 on error
- */
-int verify(EVP_PKEY *pubkey, unsigned char *msg, unsigned char *sig, size_t slen);
-
 /**
  * @brief Count the number of digits in an unsigned integer
  *
@@ -105,6 +78,89 @@ int message_to_buffer(struct message *msg, char *buffer, int buffer_size);
  */
 int buffer_to_message(struct message* msg, char *buffer);
 
+/**
+ * @brief Decode a text buffer in place, without any allocation
+ *
+ * The buffer is tokenized in place: MESS and SIG point into it, peers are
+ * written into the caller's info array.
+ *
+ * @param msg The message structure to populate
+ * @param buffer The null-terminated buffer to deserialize, must outlive msg
+ * @param info Array receiving the peers of CODE 5, 6 and 7
+ * @param max_info Number of entries available in info
+ * @return 0 on success, -1 on error (msg->nb > max_info if info is too small)
+ */
+int buffer_to_message_in_place(struct message *msg, char *buffer, struct info *info, int max_info);
+
+/**
+ * @brief Give a decoded message its own copy of MESS, SIG and info
+ *
+ * Turns a message decoded in place into one that can be released with
+ * free_message().
+ *
+ * @param msg The message to detach from its receive buffer
+ * @return 0 on success, -1 on error
+ */
+int message_detach(struct message *msg);
+
+/**
+ * @brief Compute the size of a message in the given encoding
+ *
+ * @param msg The message structure to serialize
+ * @param encoding ENC_TEXT or ENC_BINARY
+ * @return The size of the buffer needed, or -1 on error
+ */
+int get_encoded_size(struct message *msg, int encoding);
+
+/**
+ * @brief Serialize a message in the given encoding
+ *
+ * @param msg The message structure to serialize
+ * @param encoding ENC_TEXT or ENC_BINARY
+ * @param buffer The buffer to fill with the serialized data
+ * @param buffer_size The size of the buffer
+ * @return Number of bytes to send on success, -1 on error
+ */
+int encode_message(struct message *msg, int encoding, char *buffer, int buffer_size);
+
+/**
+ * @brief Deserialize a received buffer, whatever its encoding
+ *
+ * The encoding is detected from the first byte of the buffer. Text buffers
+ * must be null-terminated.
+ *
+ * @param msg The message structure to populate
+ * @param buffer The received buffer
+ * @param len Number of bytes received
+ * @return 0 on success, -1 on error
+ */
+int decode_message(struct message *msg, char *buffer, int len);
+
+/**
+ * @brief Decode a received buffer in place, whatever its encoding
+ *
+ * @param msg The message structure to populate
+ * @param buffer The received buffer (text must be null-terminated), must outlive msg
+ * @param len Number of bytes received
+ * @param info Array receiving the peers of CODE 5, 6 and 7
+ * @param max_info Number of entries available in info
+ * @return 0 on success, -1 on error
+ */
+int decode_message_in_place(struct message *msg, char *buffer, int len, struct info *info, int max_info);
+
+/**
+ * @brief Decode a received buffer into a message view, with no heap allocation
+ *
+ * This is the receive path decoder: the view borrows the buffer, which may
+ * be modified, and holds up to MESSAGE_VIEW_INFO peers.
+ *
+ * @param view The caller-owned view to populate
+ * @param buffer The received buffer (text must be null-terminated), must outlive the view
+ * @param len Number of bytes received
+ * @return 0 on success, -1 on error
+ */
+int decode_message_view(struct message_view *view, char *buffer, int len);
+
 /**
  * @brief Affiche le nombre de descripteurs de fichiers ouverts par le processus
  * 
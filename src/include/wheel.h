@@ -0,0 +1,94 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+/**
+ * Hierarchical timer wheel
+ *
+ * Many timers, each rescheduled often (an auction end moves with every
+ * bid), behind a single timerfd of the event loop. Time is cut into ticks
+ * of WHEEL_TICK_MS; level 0 has one slot per tick for the next WHEEL_SLOTS
+ * ticks, each level above covers WHEEL_SLOTS times the span of the one
+ * below, and its slots are moved down when the level below wraps. Adding,
+ * moving or cancelling a timer is constant time, and a tick only touches
+ * the timers which expire in it.
+ *
+ * The timerfd is armed for the next tick with work to do, so an idle wheel
+ * never wakes the loop. Timers are owned by the caller, the wheel only links
+ * them. They may be scheduled and cancelled from any thread; handlers are
+ * called from the thread running event_run(), without the lock of the wheel.
+ */
+#define WHEEL_TICK_MS 10                 // Resolution of the timers
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)    // Slots per level
+#define WHEEL_LEVELS 4                   // 64^4 ticks: about 46 hours at most
+
+struct wheel_timer;
+
+/**
+ * @brief Function called when a timer expires
+ *
+ * The timer is no longer scheduled: the handler may schedule it again or
+ * free it. Another thread may have scheduled it again in between (see
+ * wheel_pending()), or freed it: the owner decides, under its own lock,
+ * whether the expiry still stands.
+ *
+ * @param timer The timer
+ * @param arg Value given to wheel_timer_init()
+ */
+typedef void (*wheel_handler)(struct wheel_timer *timer, void *arg);
+
+/**
+ * A timer, owned by the caller
+ */
+struct wheel_timer {
+  uint64_t expires;            // Tick at which it fires
+  wheel_handler handler;
+  void *arg;
+  struct wheel_timer *next;    // Next timer of the same slot
+  struct wheel_timer **pprev;  // Link pointing to it, NULL when not scheduled
+};
+
+/**
+ * @brief Register the timerfd of the wheel with the event loop
+ *
+ * @return 0 on success, -1 on error
+ */
+int wheel_init(void);
+
+/**
+ * @brief Prepare a timer, not scheduled
+ *
+ * @param timer The timer
+ * @param handler Function called when it expires
+ * @param arg Value passed to the handler
+ */
+void wheel_timer_init(struct wheel_timer *timer, wheel_handler handler, void *arg);
+
+/**
+ * @brief Schedule a timer, or move it if it already is
+ *
+ * The handler is called at the first tick after the delay, never before.
+ *
+ * @param timer The timer
+ * @param delay_ms Delay from now
+ */
+void wheel_schedule(struct wheel_timer *timer, int delay_ms);
+
+/**
+ * @brief Unschedule a timer, if it is scheduled
+ *
+ * @param timer The timer
+ */
+void wheel_cancel(struct wheel_timer *timer);
+
+/**
+ * @brief Tell whether a timer is scheduled
+ *
+ * @param timer The timer
+ * @return 1 if it is, 0 otherwise
+ */
+int wheel_pending(const struct wheel_timer *timer);
+
+#endif /* WHEEL_H */
@@ -0,0 +1,125 @@
+#include "include/keys.h"
+#include "include/crypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+struct key_entry {
+  uint16_t id;
+  EVP_PKEY *key;
+  char text[KEY_TEXT_SIZE];
+  struct key_entry *next;
+};
+
+static struct key_entry *buckets[KEYS_BUCKETS];
+static pthread_mutex_t keys_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Entry of a peer, called with keys_mutex held
+static struct key_entry **find_entry(uint16_t id) {
+  struct key_entry **e = &buckets[id % KEYS_BUCKETS];
+  while (*e != NULL && (*e)->id != id) e = &(*e)->next;
+  return e;
+}
+
+// Store the key of a peer, a different known one is kept unless replace is set
+static int store_key(uint16_t id, const char *text, int replace) {
+  if (text == NULL || text[0] == '\0') return 0;
+
+  pthread_mutex_lock(&keys_mutex);
+  struct key_entry **e = find_entry(id);
+  if (*e != NULL && strcmp((*e)->text, text) == 0) {
+    pthread_mutex_unlock(&keys_mutex);
+    return 0; // Already known
+  }
+  if (*e != NULL && !replace) {
+    pthread_mutex_unlock(&keys_mutex);
+    fprintf(stderr, "Clé du pair %d non remplacée: message non authentifié\n", id);
+    return 1;
+  }
+  pthread_mutex_unlock(&keys_mutex);
+
+  // Parse outside of the lock
+  EVP_PKEY *key = crypto_key_from_text(text);
+  if (key == NULL) {
+    fprintf(stderr, "Erreur: clé publique invalide pour le pair %d\n", id);
+    return -1;
+  }
+
+  pthread_mutex_lock(&keys_mutex);
+  e = find_entry(id);
+  if (*e != NULL && !replace) {
+    // Another key arrived meanwhile
+    pthread_mutex_unlock(&keys_mutex);
+    EVP_PKEY_free(key);
+    return strcmp((*e)->text, text) == 0 ? 0 : 1;
+  }
+  if (*e == NULL) {
+    *e = calloc(1, sizeof(struct key_entry));
+    if (*e == NULL) {
+      pthread_mutex_unlock(&keys_mutex);
+      perror("calloc a échoué (keys)");
+      EVP_PKEY_free(key);
+      return -1;
+    }
+    (*e)->id = id;
+  }
+  EVP_PKEY_free((*e)->key);
+  (*e)->key = key;
+  snprintf((*e)->text, sizeof((*e)->text), "%s", text);
+  pthread_mutex_unlock(&keys_mutex);
+  return 0;
+}
+
+int keys_set(uint16_t id, const char *text) {
+  return store_key(id, text, 1);
+}
+
+int keys_add(uint16_t id, const char *text) {
+  return store_key(id, text, 0);
+}
+
+EVP_PKEY *keys_get(uint16_t id) {
+  EVP_PKEY *key = NULL;
+  pthread_mutex_lock(&keys_mutex);
+  struct key_entry *e = *find_entry(id);
+  if (e != NULL && EVP_PKEY_up_ref(e->key) == 1) key = e->key;
+  pthread_mutex_unlock(&keys_mutex);
+  return key;
+}
+
+int keys_get_text(uint16_t id, char *text, size_t size) {
+  pthread_mutex_lock(&keys_mutex);
+  struct key_entry *e = *find_entry(id);
+  snprintf(text, size, "%s", e != NULL ? e->text : "");
+  pthread_mutex_unlock(&keys_mutex);
+  return e != NULL ? 0 : -1;
+}
+
+void keys_remove(uint16_t id) {
+  pthread_mutex_lock(&keys_mutex);
+  struct key_entry **e = find_entry(id);
+  struct key_entry *entry = *e;
+  if (entry != NULL) *e = entry->next;
+  pthread_mutex_unlock(&keys_mutex);
+
+  if (entry != NULL) {
+    EVP_PKEY_free(entry->key);
+    free(entry);
+  }
+}
+
+void keys_clear(void) {
+  pthread_mutex_lock(&keys_mutex);
+  for (int i = 0; i < KEYS_BUCKETS; i++) {
+    struct key_entry *e = buckets[i];
+    while (e != NULL) {
+      struct key_entry *next = e->next;
+      EVP_PKEY_free(e->key);
+      free(e);
+      e = next;
+    }
+    buckets[i] = NULL;
+  }
+  pthread_mutex_unlock(&keys_mutex);
+}
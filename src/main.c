@@ -1,9 +1,13 @@
 #include "include/auction.h"
+#include "include/conn.h"
+#include "include/crypto.h"
+#include "include/event.h"
+#include "include/reliable.h"
 #include "include/message.h"
 #include "include/sockets.h"
 #include "include/utils.h"
+#include "include/wheel.h"
 #include <arpa/inet.h>
-#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,7 +16,6 @@
 #include <unistd.h>
 
 // Global variables
-int running = 1;
 int m_recv = -1;
 int m_send = -1;
 int server_sock = -1;
@@ -20,7 +23,6 @@ int server_sock = -1;
 int auc_sock = -1;                // Socket pour recevoir les messages d'enchère
 extern struct PairSystem pSystem; // Declare pSystem as external
 extern struct AuctionSystem auctionSys; // Declare auctionSys as external
-extern pthread_mutex_t auction_mutex;   // Declare auction_mutex as external
 
 /**
  * @brief Join an existing P2P network or create a new one
@@ -127,15 +129,137 @@ void print_commands() {
   fflush(stdout);
 }
 
+/**
+ * @brief Handle a join request received on the liaison group
+ */
+static void on_join_request(int fd, uint32_t events, void *arg) {
+  (void) events;
+  (void) arg;
+  if (handle_join(fd) > 0) {
+    printf("\n🤝 Demande de connexion reçue, en attente du pair\n");
+  }
+}
+
+/**
+ * @brief Handle a command typed by the user
+ */
+static void on_command(int fd, uint32_t events, void *arg) {
+  (void) events;
+  (void) arg;
+  char input;
+  if (read(fd, &input, 1) <= 0) return;
+
+  if (input == 'q' || input == 'Q') {
+    quit_pairs();
+    event_stop();
+  } else if (input == '1') {
+    // Créer une enchère
+    int result = create_auction(m_send);
+    if (result < 0) printf("❌ Échec de la création de l'enchère. Veuillez réessayer.\n");
+    else if (result == 0) printf("ℹ️  Aucune enchère active pour créer une nouvelle enchère.\n");
+    else printf("✅ Enchère créée avec succès.\n");
+    print_commands();
+  } else if (input == '2') {
+    // Faire une offre
+    int result = make_bid(m_send);
+    if (result < 0) printf("❌ Échec de l'offre. Veuillez réessayer.\n");
+    else if (result == 0) printf("ℹ️  Aucune enchère active pour faire une offre.\n");
+    else printf("✅ Offre faite avec succès.\n");
+    print_commands();
+  } else if (input == '3') {
+    // Afficher les enchères
+    display_auctions();
+    print_commands();
+  }
+}
+
+/**
+ * @brief Handle a message received from a peer on TCP
+ */
+static void on_pair_message(int sock, char *buffer, int len) {
+  if (process_pair_message(sock, buffer, len) == 0) print_pairs();
+}
+
+/**
+ * @brief Handle a connection on the TCP server socket
+ */
+static void on_connection(int fd, uint32_t events, void *arg) {
+  (void) events;
+  (void) arg;
+  int client_sock = accept(fd, NULL, NULL);
+  if (client_sock < 0) {
+    perror("❌ Échec de l'acceptation de la connexion");
+    return;
+  }
+  // Peers may keep the connection for their next messages: read it in the loop
+  if (conn_accept(client_sock, on_pair_message) < 0) {
+    perror("❌ Échec de la réception du message du client");
+  }
+}
+
+/**
+ * @brief Handle datagrams received on the auction group, or the repairs
+ * received on the sender socket
+ */
+static void on_auction_message(int fd, uint32_t events, void *arg) {
+  (void) fd; // The socket itself, or its io_uring ring
+  (void) events;
+  int sock = *(int *) arg;
+  int result = handle_auction_message(sock, m_send);
+  if (result > 0 && sock == auc_sock) {
+    printf("> ");
+    fflush(stdout);
+  }
+}
+
+/**
+ * @brief Run the callbacks of the finished signatures
+ */
+static void on_crypto_done(int fd, uint32_t events, void *arg) {
+  (void) fd;
+  (void) events;
+  (void) arg;
+  crypto_dispatch();
+}
+
+/**
+ * @brief Announce our last sequence number if messages were just sent
+ */
+static void on_heartbeat(int fd, uint32_t events, void *arg) {
+  (void) fd;
+  (void) events;
+  (void) arg;
+  reliable_tick(m_send);
+}
+
 /**
  * @brief Main function to run the P2P system
  *
  * Initializes the P2P system, attempts to join an existing network,
  * and handles incoming connections and messages.
  *
+ * @param argc Number of arguments
+ * @param argv Arguments: -u receives and sends the auction datagrams through io_uring,
+ *             -i <interface> is the interface of the multicast groups
  * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
  */
-int main() {
+int main(int argc, char *argv[]) {
+  int use_uring = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "ui:")) != -1) {
+    if (opt == 'u') {
+      use_uring = 1;
+    } else if (opt == 'i') {
+      // Before any address is resolved: link-local ones are bound to it
+      if (sockets_set_interface(optarg) < 0) return EXIT_FAILURE;
+    } else {
+      fprintf(stderr, "Usage: %s [-u] [-i interface]\n"
+                      "  -u  io_uring pour les datagrammes d'enchères\n"
+                      "  -i  interface des groupes multicast (détectée sinon)\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
   printf("╔═══════════════════════════════════════════════╗\n");
   printf("║        🌐 Système P2P d'Enchères              ║\n");
   printf("║             Bienvenue !                       ║\n");
@@ -147,12 +271,21 @@ int main() {
     fprintf(stderr, "❌ Échec de l'initialisation du système de pairs\n");
     return EXIT_FAILURE;
   }
+  // Sign and verify outside of the event loop
+  if (crypto_workers_start(CRYPTO_WORKERS) < 0) {
+    fprintf(stderr, "⚠️  Threads de signature indisponibles, signature synchrone\n");
+  }
   // Initialize the auction system
   if (init_auction_system() < 0) {
     fprintf(stderr, "❌ Échec de l'initialisation du système d'enchères\n");
     return EXIT_FAILURE;
   }
 
+  // Classic syscalls unless io_uring was asked for and works
+  if (use_uring && sockets_set_backend(SOCKETS_URING) < 0) {
+    fprintf(stderr, "⚠️  io_uring indisponible, recvmmsg/sendmmsg utilisés\n");
+  }
+
   // Configure sender socket to respond to requests
   m_send = setup_multicast_sender();
   if (m_send < 0) {
@@ -167,15 +300,22 @@ int main() {
     return EXIT_FAILURE;
   } else if (ret == 1) { // No existing network found, create a new one
     printf("\n🆕 Réseau P2P non trouvé, création d'un nouveau réseau...\n");
+    // First peer: the key every bid of this network is authenticated with
+    if (crypto_group_key_generate() < 0) {
+      fprintf(stderr, "⚠️  Clé de groupe indisponible, les enchères partiront sans MAC\n");
+    }
   } else if (ret == 0) { // Successfully joined an existing network
     printf("\n✅ Réseau P2P trouvé, vous êtes maintenant connecté.\n");
   } else {
     fprintf(stderr, "❌ Erreur lors de la connexion au réseau P2P\n");
     return EXIT_FAILURE;
   }
+  // Our ID is known: number what we send to the auction group
+  reliable_init(pSystem.my_id, &pSystem.auction);
+  reliable_set_peer_check(pairs_is_active);
 
   // Configure multicast receiver socket for connections
-  m_recv = setup_multicast_receiver(pSystem.liaison_addr, pSystem.liaison_port);
+  m_recv = setup_multicast_receiver(&pSystem.liaison);
   if (m_recv < 0) {
     fprintf(stderr, "❌ Échec de la création du socket récepteur multicast\n");
     close(m_send);
@@ -192,7 +332,7 @@ int main() {
   }
 
   // Configure multicast receiver socket for auctions
-  auc_sock = setup_multicast_receiver(pSystem.auction_addr, pSystem.auction_port);
+  auc_sock = setup_multicast_receiver(&pSystem.auction);
   if (auc_sock < 0) {
     fprintf(stderr, "❌ Échec de la création du socket récepteur multicast pour enchères\n");
     close(m_recv);
@@ -204,102 +344,47 @@ int main() {
   // Print network information
   print_network_info();
 
-  // Configuration for poll
-  struct pollfd fds[4];
-
-  // Monitor network socket
-  fds[0].fd = m_recv;
-  fds[0].events = POLLIN;
-
-  // Monitor standard input (to detect exit command)
-  fds[1].fd = STDIN_FILENO;
-  fds[1].events = POLLIN;
-
-  // Monitor server socket for incoming connections
-  fds[2].fd = server_sock;
-  fds[2].events = POLLIN;
-
-  // Monitor server socket for auction
-  fds[3].fd = auc_sock;
-  fds[3].events = POLLIN;
+  // Every source the program waits on, with its handler
+  if (event_init() < 0) {
+    fprintf(stderr, "❌ Échec de la création de la boucle d'événements\n");
+    close(m_recv);
+    close(m_send);
+    close(server_sock);
+    close(auc_sock);
+    return EXIT_FAILURE;
+  }
+  int ok = event_add(m_recv, EVENT_READ, on_join_request, NULL) == 0 &&
+           event_add(STDIN_FILENO, EVENT_READ, on_command, NULL) == 0 &&
+           event_add(server_sock, EVENT_READ, on_connection, NULL) == 0 &&
+           event_add(sockets_receive_fd(auc_sock), EVENT_READ, on_auction_message, &auc_sock) == 0 &&
+           // Repair requests and retransmissions arrive on the sender socket
+           event_add(m_send, EVENT_READ, on_auction_message, &m_send) == 0 &&
+           event_add_timer(RELIABLE_HEARTBEAT_MS, RELIABLE_HEARTBEAT_MS, on_heartbeat, NULL) >= 0 &&
+           wheel_init() == 0; // Ends of the auctions we supervise
+  // crypto_dispatch() empties the completion list: edge-triggered
+  if (ok && crypto_completion_fd() >= 0) {
+    ok = event_add(crypto_completion_fd(), EVENT_READ | EVENT_EDGE, on_crypto_done, NULL) == 0;
+  }
+  if (!ok) {
+    fprintf(stderr, "❌ Échec de l'enregistrement des sockets\n");
+    event_cleanup();
+    close(m_recv);
+    close(m_send);
+    close(server_sock);
+    close(auc_sock);
+    return EXIT_FAILURE;
+  }
 
   print_commands();
 
-  running = 1;
-  while (running) {
-    int poll_result = poll(fds, 4, 1000); // 1 second timeout
-
-    if (poll_result < 0) {
-      perror("❌ Erreur lors de l'appel à poll");
-      break;
-    }
-
-    // Check if data is available on the network socket
-    if (fds[0].revents & POLLIN) {
-      int result = handle_join(m_recv, server_sock);
-      if (result > 0) {
-        printf("\n🤝 Demande de connexion reçue et traitée\n");
-        print_pairs();
-      }
-    }
-
-    // Check if data is available on stdin
-    if (fds[1].revents & POLLIN) {
-      char input;
-      if (read(STDIN_FILENO, &input, 1) > 0) {
-        if (input == 'q' || input == 'Q') {
-          quit_pairs();
-          running = 0;
-        } else {
-          if (input == '1') {
-            // Créer une enchère
-            int result = create_auction(m_send);
-            if (result < 0) printf("❌ Échec de la création de l'enchère. Veuillez réessayer.\n");
-            else if (result == 0) printf("ℹ️  Aucune enchère active pour créer une nouvelle enchère.\n");
-            else printf("✅ Enchère créée avec succès.\n");
-            print_commands();
-          } else if (input == '2') {
-            // Faire une offre
-            int result = make_bid(m_send);
-            if (result < 0) printf("❌ Échec de l'offre. Veuillez réessayer.\n");
-            else if (result == 0) printf("ℹ️  Aucune enchère active pour faire une offre.\n");
-            else printf("✅ Offre faite avec succès.\n");
-            print_commands();
-          } else if (input == '3') {
-            // Afficher les enchères
-            display_auctions();
-            print_commands();
-          }
-        }
-      }
-    }
-
-    // Check if there is a new connection on the server socket
-    if (fds[2].revents & POLLIN) {
-      int client_sock = accept(server_sock, NULL, NULL);
-      if (client_sock < 0) {
-        perror("❌ Échec de l'acceptation de la connexion");
-        continue;
-      }
-      // Handle the new connection in a separate thread or process
-      if (recv_message(client_sock) < 0) {
-        perror("❌ Échec de la réception du message du client");
-      } else {
-        print_pairs();
-      }
-      // For simplicity, we will just close it immediately here
-      close(client_sock);
-    }
-
-    // Vérifier si des données sont disponibles sur le socket d'enchères
-    if (fds[3].revents & POLLIN) {
-      int result = handle_auction_message(auc_sock, m_send);
-      if (result > 0) {
-        printf("> ");
-        fflush(stdout);
-      }
-    }
+  if (event_run() < 0) {
+    fprintf(stderr, "❌ Erreur dans la boucle d'événements\n");
   }
+  // Pending signatures and verifications complete while the sockets are still open
+  crypto_workers_stop();
+  conn_cleanup();
+  event_cleanup();
+  sockets_cleanup();
 
   // Small delay before closing sockets to avoid reuse issues
   sleep(1);
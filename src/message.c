@@ -1,11 +1,15 @@
 #include "include/message.h"
 #include "include/utils.h"
+#include "include/pool.h"
+#include "include/crypto.h"
+#include "include/schema.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
@@ -29,7 +33,7 @@ void print_message(struct message* msg) {
 }
 
 struct message* init_message(const int code) {
-  struct message* msg = malloc(sizeof(struct message));
+  struct message* msg = pool_get_message();
   if(msg == NULL) {
     perror("Allocation ratée");
     return NULL;
@@ -42,6 +46,17 @@ struct message* init_message(const int code) {
   msg->mess = NULL; // Initialize at NULL before allocation
   msg->sig = NULL;
   msg->lsig = 0;
+  msg->ip = in6addr_any;
+  msg->port = 0;
+  memset(msg->cle, 0, sizeof(msg->cle));
+  msg->enc = ENC_TEXT;
+  msg->ldh = 0;
+  msg->lgkey = 0;
+  msg->lmac = 0;
+  msg->numv = 0;
+  msg->prix = 0;
+  msg->nb = 0;
+  msg->info = NULL;
 
   return msg;
 }
@@ -68,38 +83,162 @@ int message_set_mess(struct message* msg, const char* mess) {
   return 0;
 }
 
+// SHA-256 of the peers listed by a message, with their encodings and keys
+// when the code carries them
+static int info_digest(const struct message* msg, unsigned char* digest) {
+  int count = message_info_count(msg);
+  int with_enc = schema_has_field(msg->code, FIELD_INFO_ENC);
+  int with_cle = schema_has_field(msg->code, FIELD_INFO_CLE);
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  if (ctx == NULL || EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+    EVP_MD_CTX_free(ctx);
+    return -1;
+  }
+  uint16_t nb = htons(count);
+  EVP_DigestUpdate(ctx, &nb, sizeof(nb));
+  for (int i = 0; i < count && msg->info != NULL; i++) {
+    const struct info *info = &msg->info[i];
+    unsigned char entry[2 + sizeof(info->ip) + 2 + 1 + 1 + sizeof(info->cle)];
+    unsigned char *p = entry;
+    uint16_t id = htons(info->id);
+    uint16_t port = htons(info->port);
+    memcpy(p, &id, sizeof(id));
+    p += sizeof(id);
+    memcpy(p, &info->ip, sizeof(info->ip));
+    p += sizeof(info->ip);
+    memcpy(p, &port, sizeof(port));
+    p += sizeof(port);
+    if (with_enc) *p++ = info->enc;
+    if (with_cle) {
+      uint8_t lcle = strnlen(info->cle, sizeof(info->cle));
+      *p++ = lcle;
+      memcpy(p, info->cle, lcle);
+      p += lcle;
+    }
+    EVP_DigestUpdate(ctx, entry, p - entry);
+  }
+  int ok = EVP_DigestFinal_ex(ctx, digest, NULL) == 1;
+  EVP_MD_CTX_free(ctx);
+  return ok ? 0 : -1;
+}
+
+int message_signed_data(const struct message* msg, unsigned char* data) {
+  uint16_t id = htons(msg->id);
+  uint32_t numv = htonl(msg->numv);
+  uint32_t prix = htonl(msg->prix);
+  // MESS is only covered when the code carries it
+  uint8_t lmess = schema_has_field(msg->code, FIELD_MESS) && msg->mess != NULL ? msg->lmess : 0;
+
+  unsigned char *p = data;
+  *p++ = msg->code;
+  memcpy(p, &id, sizeof(id));
+  p += sizeof(id);
+  memcpy(p, &numv, sizeof(numv));
+  p += sizeof(numv);
+  memcpy(p, &prix, sizeof(prix));
+  p += sizeof(prix);
+  *p++ = lmess;
+  if (lmess > 0) memcpy(p, msg->mess, lmess);
+  p += lmess;
+
+  // Address, encodings and key of the sender, when the code carries them
+  if (schema_has_field(msg->code, FIELD_IP)) {
+    memcpy(p, &msg->ip, sizeof(msg->ip));
+    p += sizeof(msg->ip);
+  }
+  if (schema_has_field(msg->code, FIELD_PORT)) {
+    uint16_t port = htons(msg->port);
+    memcpy(p, &port, sizeof(port));
+    p += sizeof(port);
+  }
+  if (schema_has_field(msg->code, FIELD_ENC)) *p++ = msg->enc;
+  if (schema_has_field(msg->code, FIELD_CLE)) {
+    uint8_t lcle = strnlen(msg->cle, sizeof(msg->cle));
+    *p++ = lcle;
+    memcpy(p, msg->cle, lcle);
+    p += lcle;
+  }
+  // The peer list has no bound: its digest is signed in its place
+  if (schema_has_field(msg->code, FIELD_INFO)) {
+    if (info_digest(msg, p) < 0) return -1;
+    p += MESSAGE_INFO_DIGEST_SIZE;
+  }
+  // Keys exchanged during the join
+  if (schema_has_field(msg->code, FIELD_DH)) {
+    *p++ = msg->ldh;
+    memcpy(p, msg->dh, msg->ldh);
+    p += msg->ldh;
+  }
+  if (schema_has_field(msg->code, FIELD_GKEY)) {
+    *p++ = msg->lgkey;
+    memcpy(p, msg->gkey, msg->lgkey);
+    p += msg->lgkey;
+  }
+  return p - data;
+}
+
 int message_set_sig(struct message* msg) {
   if(msg == NULL) {
     perror("Message est NULL");
     return -1;
   }
 
-  // Free the previous signature if it exists
-  if(msg->sig != NULL) {
-    free(msg->sig);
+  // Keys are loaded once by crypto_init(), no file access here
+  unsigned char data[MESSAGE_SIGNED_MAX];
+  int len = message_signed_data(msg, data);
+  if (len < 0) {
+    fprintf(stderr, "Échec du calcul des données signées\n");
+    return -1;
+  }
+  unsigned char sig[SIGNATURE_SIZE];
+  size_t slen;
+  if (crypto_sign(data, len, sig, &slen) != 1) {
+    fprintf(stderr, "Échec de la signature du message\n");
+    return -1;
   }
-  
-  // retrieve public and private keys (assumed to be in PEM format)
-  EVP_PKEY *pubkey = convert_public_key_to_evp_pkey("pub-ed25519-key.pem");
-  EVP_PKEY *privkey = convert_private_key_to_evp_pkey("priv-ed25519-key.pem") ;
+  return message_set_sig_raw(msg, sig, slen);
+}
 
-  /* signature */
-  if (sign(privkey, (unsigned char*)msg->mess, (unsigned char**)&msg->sig, (size_t*)&msg->lsig) != 1) {
-    perror("Allocation ratée pour sig");
-    EVP_PKEY_free(privkey);
-    EVP_PKEY_free(pubkey);
+int message_set_mac(struct message* msg) {
+  if(msg == NULL) {
+    perror("Message est NULL");
     return -1;
   }
+  msg->lmac = 0;
+  unsigned char data[MESSAGE_SIGNED_MAX];
+  int len = message_signed_data(msg, data);
+  if (!crypto_mac(data, len, msg->mac)) return -1;
+  msg->lmac = MAC_SIZE;
+  return 0;
+}
 
-  if (verify(pubkey, (unsigned char*)msg->mess, (unsigned char*)msg->sig, (size_t)msg->lsig) != 1) {
-    perror("Allocation ratée pour sig");
-    EVP_PKEY_free(privkey);
-    EVP_PKEY_free(pubkey);
+int message_check_mac(const struct message* msg) {
+  if(msg == NULL || msg->lmac == 0) return 0;
+  unsigned char data[MESSAGE_SIGNED_MAX];
+  int len = message_signed_data(msg, data);
+  return crypto_mac_verify(data, len, msg->mac, msg->lmac);
+}
+
+int message_set_sig_raw(struct message* msg, const unsigned char* sig, size_t slen) {
+  if(msg == NULL) {
+    perror("Message est NULL");
     return -1;
   }
 
-  EVP_PKEY_free(privkey);
-  EVP_PKEY_free(pubkey);
+  // Free the previous signature if it exists
+  if(msg->sig != NULL) {
+    free(msg->sig);
+    msg->sig = NULL;
+  }
+  msg->lsig = 0;
+
+  msg->sig = malloc(slen);
+  if(msg->sig == NULL) {
+    perror("Allocation ratée pour sig");
+    return -1;
+  }
+  memcpy(msg->sig, sig, slen);
+  msg->lsig = slen;
   return 0;
 }
 
@@ -137,8 +276,15 @@ int message_set_nb(struct message *msg, int nb) {
     perror("Message est NULL");
     return -1;
   }
+  // Release the previous array if it exists
+  pool_put_info(msg->info);
   msg->nb = nb;
-  msg->info = malloc(nb * sizeof(struct info));
+  msg->info = pool_get_info(nb);
+  if(msg->info == NULL) {
+    perror("Allocation ratée pour info");
+    msg->nb = 0;
+    return -1;
+  }
   return 0;
 }
 
@@ -159,7 +305,8 @@ int init_info(struct info *info, int id, struct in6_addr ip, uint16_t port) {
   if (port > 0) {
     info->port = port; // Set port if valid
   }
-  // TODO : Handle cle
+  info->enc = ENC_TEXT; // Text is always understood
+  memset(info->cle, 0, sizeof(info->cle));
   return 0;
 }
 
@@ -185,8 +332,9 @@ int free_message(struct message* msg) {
   if(msg->sig != NULL) {
     free(msg->sig);
   }
+  pool_put_info(msg->info);
 
-  // Free the message structure itself
-  free(msg);
+  // Give the message structure back to the pool
+  pool_put_message(msg);
   return 0;
 }
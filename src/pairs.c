@@ -2,7 +2,12 @@
 #include "include/sockets.h"
 #include "include/message.h"
 #include "include/utils.h"
+#include "include/stream.h"
+#include "include/crypto.h"
+#include "include/keys.h"
+#include "include/pool.h"
 #include "include/auction.h"
+#include "include/conn.h"
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,6 +24,43 @@
 struct PairSystem pSystem;
 extern struct AuctionSystem auctionSys;
 
+// Ephemeral X25519 key sent in CODE 5, to unwrap the group key of CODE 7
+static EVP_PKEY *join_dh = NULL;
+
+static int announce_pair(unsigned short id, struct in6_addr ip, unsigned short port,
+                         unsigned char encodings);
+
+// Check the signature of a join message with the public key given as text
+static int check_join_signature(struct message *msg, const char *cle) {
+  EVP_PKEY *key = crypto_key_from_text(cle);
+  if (key == NULL || msg->sig == NULL) {
+    EVP_PKEY_free(key);
+    return 0;
+  }
+  unsigned char data[MESSAGE_SIGNED_MAX];
+  int len = message_signed_data(msg, data);
+  int ret = len >= 0 && crypto_verify(key, data, len, (unsigned char *) msg->sig, msg->lsig);
+  EVP_PKEY_free(key);
+  return ret;
+}
+
+// Take the group key wrapped for us in CODE 7
+static void receive_group_key(struct message *response) {
+  char cle[KEY_TEXT_SIZE];
+  if (join_dh == NULL || response->ldh != MESSAGE_KEY_SIZE || response->lgkey != MESSAGE_KEY_SIZE ||
+      keys_get_text(response->id, cle, sizeof(cle)) < 0) {
+    printf("    Pas de clé de groupe reçue, les enchères partiront sans MAC\n");
+  } else if (!check_join_signature(response, cle)) {
+    fprintf(stderr, "    Signature invalide sur les informations du système, clé de groupe ignorée\n");
+  } else if (crypto_group_key_import(join_dh, response->dh, response->gkey) == 0) {
+    printf("    Clé de groupe reçue\n");
+  }
+  EVP_PKEY_free(join_dh);
+  join_dh = NULL;
+}
+
+static int receive_pair_message(struct message *msg);
+
 int init_pairs() {
   pSystem.pairs = malloc(10 * sizeof(struct Pair));
   if (!pSystem.pairs) {
@@ -38,15 +80,19 @@ int init_pairs() {
   inet_pton(AF_INET6, "::1", &pSystem.my_ip);
   pSystem.my_port = 8000;
 
-  // Default multicast addresses
-  strcpy(pSystem.liaison_addr, "ff12::");
-  pSystem.liaison_port = 8080;
-  strcpy(pSystem.auction_addr, "ff12::");
-  pSystem.auction_port = 8081;
+  // Default multicast addresses, resolved once for every message
+  endpoint_set(&pSystem.liaison, "ff12::", 8080);
+  endpoint_set(&pSystem.auction, "ff12::", 8081);
 
   // Generate keys that will be used for signing messages
   // Ensure the keys are generated only once
-  generate_ed25519_key("pub-ed25519-key.pem", "priv-ed25519-key.pem");
+  generate_ed25519_key(PUBLIC_KEY_FILE, PRIVATE_KEY_FILE);
+  // Load them once for every message we will sign
+  if (crypto_init(PUBLIC_KEY_FILE, PRIVATE_KEY_FILE) < 0) {
+    free(pSystem.pairs);
+    pSystem.pairs = NULL;
+    return -1;
+  }
 
   return 0;
 }
@@ -88,7 +134,7 @@ int join_pairs(int m_sender) {
   free_message(request);
 
   // Send the multicast request
-  int result = send_multicast(m_sender, pSystem.liaison_addr, pSystem.liaison_port, buffer, buffer_size);
+  int result = send_multicast(m_sender, &pSystem.liaison, buffer, buffer_size);
   if (result < 0) {
     perror("send_multicast a échoué");
     free(buffer);
@@ -123,22 +169,15 @@ int join_pairs(int m_sender) {
       // Ensure null-termination
       resp_buffer[len] = '\0';
       printf("    Réponse reçue en unicast (%d octets)\n", len);
-      // Initialize a message structure to hold the response
-      struct message *response = malloc(sizeof(struct message));
-      if (response == NULL) {
-        perror("malloc a échoué");
-        close(u_recv);
-        free(buffer);
-        return -1;
-      }
-      // Convert the buffer to a message
-      if (buffer_to_message(response, resp_buffer) < 0) {
+      // Decode the response in place, it only lives in this loop
+      struct message_view response_view;
+      if (decode_message_view(&response_view, resp_buffer, len) < 0) {
         perror("buffer_to_message a échoué");
-        free_message(response);
         close(u_recv);
         free(buffer);
         return -1;
       }
+      struct message *response = &response_view.msg;
       // Valid response, no longer needed
       close(u_recv);
 
@@ -146,22 +185,21 @@ int join_pairs(int m_sender) {
       if (response->code == CODE_REPONSE_LIAISON) { // CODE = 4 (response)
         free(buffer); // Free the buffer as we have a valid response
         printf("    Réponse de connexion reçue (CODE = 4)\n");
-        // Get sender's address
-        char sender_ip_str[INET6_ADDRSTRLEN];
-        inet_ntop(AF_INET6, &sender.sin6_addr, sender_ip_str, sizeof(sender_ip_str));
         // Save the sender as a new pair
-        if (add_pair(response->id, sender.sin6_addr, response->port) < 0) {
+        if (add_pair(response->id, sender.sin6_addr, response->port, response->enc) < 0) {
           perror("add_pair a échoué");
           return -1;
         }
+        keys_set(response->id, response->cle);
+        unsigned char contact_enc = response->enc;
 
-        int client_sock = setup_client_socket(sender_ip_str, response->port);
+        struct endpoint contact;
+        endpoint_set_in6(&contact, &sender.sin6_addr, response->port);
+        int client_sock = setup_client_socket(&contact);
         if (client_sock < 0) {
           perror("setup_client_socket a échoué");
-          free_message(response);
           return -1;
         }
-        free_message(response);
 
         // Send a message to the sender with code 5
         printf("    Envoi d'un message d'information en TCP... (CODE = 5)\n");
@@ -172,35 +210,35 @@ int join_pairs(int m_sender) {
           return -1;
         }
         // Initialize the info
-        // TODO Add cle, public key for TLS
-        struct info *my_info = malloc(sizeof(struct info));
-        if (my_info == NULL) {
-          perror("malloc a échoué (info pair)");
-          free_message(info_msg);
-          close(client_sock);
-          return -1;
-        }
-        if (init_info(my_info, pSystem.my_id, pSystem.my_ip, pSystem.my_port) < 0) {
+        struct info my_info;
+        if (init_info(&my_info, pSystem.my_id, pSystem.my_ip, pSystem.my_port) < 0) {
           perror("init_info a échoué");
-          free(my_info);
           free_message(info_msg);
           close(client_sock);
           return -1;
         }
+        my_info.enc = ENC_SUPPORTED; // Advertise our encodings
+        // Our public key, for the peers to check our signatures
+        snprintf(my_info.cle, sizeof(my_info.cle), "%s", crypto_public_key_text());
+        // Ephemeral key for the contact to send us the group key, signed with ours
+        EVP_PKEY_free(join_dh);
+        join_dh = crypto_dh_generate(info_msg->dh);
+        if (join_dh != NULL) info_msg->ldh = MESSAGE_KEY_SIZE;
         if (message_set_nb(info_msg, 1) < 0) {
           perror("message_set_nb a échoué");
-          free(my_info);
           free_message(info_msg);
           close(client_sock);
           return -1;
         }
-        if (message_set_info(info_msg, 0, my_info)) {
+        if (message_set_info(info_msg, 0, &my_info)) {
           perror("message_set_info a échoué");
-          free(my_info);
           free_message(info_msg);
           close(client_sock);
           return -1;
         }
+        if (message_set_sig(info_msg) < 0) {
+          fprintf(stderr, "    Échec de la signature de l'information du pair\n");
+        }
 
         int info_buffer_size = get_buffer_size(info_msg);
         char info_buffer[info_buffer_size];
@@ -213,114 +251,92 @@ int join_pairs(int m_sender) {
         }
         free_message(info_msg);
 
-        // Send the message (CODE = 5)
-        if (send(client_sock, info_buffer, info_buffer_size, 0) <= 0) {
+        // Send the message (CODE = 5), framed if the contact reads frames
+        if (stream_send(client_sock, info_buffer, info_buffer_size, contact_enc & ENC_FRAMED) < 0) {
           perror("send a échoué (info pair)");
           close(client_sock);
           return -1;
         }
 
-        // Wait for response from sender (CODE = 50 or CODE = 51)
-        buffer = malloc(UNKNOWN_SIZE);
-        if (buffer == NULL) {
-          perror("malloc a échoué (buffer)");
+        // Wait for response from sender (CODE = 50 or CODE = 51), then CODE = 7
+        // Both can arrive in one read, or CODE 7 in several reads
+        struct stream st;
+        if (stream_init(&st, client_sock) < 0) {
           close(client_sock);
           return -1;
         }
-
-        len = recv(client_sock, buffer, UNKNOWN_SIZE - 1, 0);
-        if (len > 0) {
-          buffer[len] = '\0'; // Ensure null-terminated string
-          printf("    Réponse reçue de l'expéditeur (%d octets)\n", len);
-
-          struct message *response = malloc(sizeof(struct message));
-          if (response == NULL) {
-            perror("malloc a échoué");
-            close(client_sock);
-            free(buffer);
-            return -1;
-          }
-          if (buffer_to_message(response, buffer) < 0) {
-            perror("buffer_to_message a échoué");
-            free_message(response);
-            close(client_sock);
-            free(buffer);
-            return -1;
-          }
-          free(buffer); // Converted to message, no longer needed
-
-          if (response->code == CODE_ID_ACCEPTED) {
-            printf("    ID accepté: %d\n", pSystem.my_id);
-          } else if (response->code == CODE_ID_CHANGED) {
-            printf("    ID changé: %d\n", response->id);
-            pSystem.my_id = response->id;
-          } else {
-            printf("  Code de réponse inattendu: %d\n", response->code);
-            free_message(response);
-            close(client_sock);
-            return -1;
-          }
-          free_message(response);
-          // Add the peer to the system
-        } else {
+        char *frame;
+        int frame_len;
+        if (stream_read(&st, &frame, &frame_len) <= 0) {
           perror("recv a échoué");
+          stream_free(&st);
           close(client_sock);
-          free(buffer);
           return -1;
         }
+        printf("    Réponse reçue de l'expéditeur (%d octets)\n", frame_len);
 
-        buffer = malloc(UNKNOWN_SIZE);
-        if (buffer == NULL) {
-          perror("malloc a échoué (buffer)");
+        struct message_view id_view;
+        if (decode_message_view(&id_view, frame, frame_len) < 0) {
+          perror("buffer_to_message a échoué");
+          stream_free(&st);
+          close(client_sock);
+          return -1;
+        }
+        if (id_view.msg.code == CODE_ID_ACCEPTED) {
+          printf("    ID accepté: %d\n", pSystem.my_id);
+        } else if (id_view.msg.code == CODE_ID_CHANGED) {
+          printf("    ID changé: %d\n", id_view.msg.id);
+          pSystem.my_id = id_view.msg.id;
+        } else {
+          printf("  Code de réponse inattendu: %d\n", id_view.msg.code);
+          stream_free(&st);
           close(client_sock);
           return -1;
         }
+
         // Recv info about the auction system (CODE = 7)
-        len = recv(client_sock, buffer, UNKNOWN_SIZE - 1, 0);
-        if (len > 0) {
-          buffer[len] = '\0'; // Ensure null-terminated string
-          printf("    Informations sur le système reçues (%d octets)\n", len);
+        if (stream_read(&st, &frame, &frame_len) > 0) {
+          printf("    Informations sur le système reçues (%d octets)\n", frame_len);
 
-          struct message *response = malloc(sizeof(struct message));
+          struct message *response = init_message(CODE_INFO_SYSTEME);
           if (response == NULL) {
-            perror("malloc a échoué");
+            perror("init_message a échoué");
+            stream_free(&st);
             close(client_sock);
-            free(buffer);
             return -1;
           }
-          if (buffer_to_message(response, buffer) < 0) {
+          if (decode_message(response, frame, frame_len) < 0) {
             perror("buffer_to_message a échoué (info système)");
             free_message(response);
+            stream_free(&st);
             close(client_sock);
-            free(buffer);
             return -1;
           }
-          free(buffer); // Converted to message, no longer needed
 
           if (response->code == CODE_INFO_SYSTEME) { // CODE = 7 for system info
             printf("    Mise à jour des informations du système d'enchères...\n");
+            receive_group_key(response);
             // Update the system information
-            char ip_str[INET6_ADDRSTRLEN];
-            inet_ntop(AF_INET6, &response->ip, ip_str, sizeof(ip_str));
-            strcpy(pSystem.auction_addr, ip_str);
-            pSystem.auction_port = response->port;
-            int max = 1;
-            if (response->nb > 0) {
-              max = response->nb; // Update max if we have more than one pair
-            }
-            pSystem.count = max; // Update the count of pairs + 1 for the one we're connected to
-            // Update the pairs list
+            endpoint_set_in6(&pSystem.auction, &response->ip, response->port);
+            // Update the pairs list, add_pair() counts the new ones
             for (int i = 0; i < response->nb; i++) {
-              if (add_pair(response->info[i].id, response->info[i].ip, response->info[i].port) < 0) {
+              if (add_pair(response->info[i].id, response->info[i].ip, response->info[i].port,
+                           response->info[i].enc) < 0) {
                 perror("add_pair a échoué (info système)");
                 free_message(response);
+                stream_free(&st);
                 close(client_sock);
                 return -1;
               }
+              if (response->info[i].id != pSystem.my_id) {
+                keys_set(response->info[i].id, response->info[i].cle);
+              }
             }
           }
-        free_message(response);
+          free_message(response);
         }
+        stream_free(&st);
+        close(client_sock);
         close(u_recv);
         return 0;
       } else {
@@ -329,7 +345,6 @@ int join_pairs(int m_sender) {
         }
         printf("  Message reçu mais code incorrect: %d\n", response->code);
       }
-      free_message(response);
     } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
       printf("    Timeout atteint, tentative %d/%d\n", attempts, MAX_ATTEMPTS);
     } else {
@@ -338,7 +353,7 @@ int join_pairs(int m_sender) {
 
     if (attempts < MAX_ATTEMPTS) {
       // Resend the request for each new attempt
-      if (send_multicast(m_sender, pSystem.liaison_addr, pSystem.liaison_port, buffer, strlen(buffer)) < 0) {
+      if (send_multicast(m_sender, &pSystem.liaison, buffer, strlen(buffer)) < 0) {
         printf("    Échec du renvoi de la demande\n");
       } else {
         printf("    Demande de connexion renvoyée (tentative %d/%d)\n", attempts + 1, MAX_ATTEMPTS);
@@ -356,33 +371,27 @@ int join_pairs(int m_sender) {
   return -1; // Connection failed
 }
 
-int handle_join(int m_recv, int server_sock) {
+int handle_join(int m_recv) {
   // Sender address
   struct sockaddr_in6 sender;
   char buffer[UNKNOWN_SIZE]; // Static buffer with fixed size
   memset(buffer, 0, UNKNOWN_SIZE);
 
-  int len = receive_multicast(m_recv, buffer, UNKNOWN_SIZE, &sender);
+  int len = receive_multicast_nowait(m_recv, buffer, UNKNOWN_SIZE - 1, &sender);
   if (len <= 0) {
     return 0; // No data or error
   }
 
-  struct message *request = malloc(sizeof(struct message));
-  if (request == NULL) {
-    perror("malloc a échoué");
-    return -1;
-  }
-  // Extract requester information
-  if (buffer_to_message(request, buffer) < 0) {
+  // Extract requester information, decoded in place in the receive buffer
+  struct message_view request_view;
+  if (decode_message_view(&request_view, buffer, len) < 0) {
     perror("buffer_to_message a échoué");
-    free_message(request);
     return -1;
   }
+  struct message *request = &request_view.msg;
 
   // Check message code
   if (request->code == CODE_DEMANDE_LIAISON) { // CODE = 3 for connection request
-    // Free request, no need to keep it
-    free_message(request);
     // Obtain sender's IP address
     char sender_ip_str[INET6_ADDRSTRLEN];
     inet_ntop(AF_INET6, &sender.sin6_addr, sender_ip_str, sizeof(sender_ip_str));
@@ -397,6 +406,8 @@ int handle_join(int m_recv, int server_sock) {
     }
 
     response->id = pSystem.my_id;
+    response->enc = ENC_SUPPORTED; // Advertise our encodings
+    message_set_cle(response, crypto_public_key_text());
     message_set_ip(response, pSystem.my_ip);
     message_set_port(response, pSystem.my_port);
 
@@ -414,289 +425,405 @@ int handle_join(int m_recv, int server_sock) {
     free_message(response);
 
     // Send the response (CODE 4) en unicast vers sender
-    int u_send = setup_unicast_sender(sender_ip_str, pSystem.my_port);
+    struct endpoint requester;
+    endpoint_set_in6(&requester, &sender.sin6_addr, pSystem.my_port);
+    int u_send = setup_unicast_sender(&requester);
     if (u_send < 0) {
       perror("setup_unicast_sender a échoué");
       return -1;
     }
-    sender.sin6_port = htons(pSystem.my_port);
-    int len = sendto(u_send, resp_buffer, strlen(resp_buffer), 0,
-                     (struct sockaddr *)&sender, sizeof(sender));
+    int len = send(u_send, resp_buffer, strlen(resp_buffer), 0);
     close(u_send);
     if (len <= 0) {
       perror("sendto a échoué");
       return -1;
     }
     printf("  Réponse de la demande de connexion envoyée... (CODE = 4)\n");
+    // If we are its contact, the joiner connects to us and sends CODE 5:
+    // the join goes on in answer_join(), without waiting here
+    return 1;
 
-    struct sockaddr_in6 client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    int client_sock = accept(server_sock, (struct sockaddr *)&client_addr, &client_addr_len);
-    if (client_sock < 0) {
-      perror("accept a échoué");
-      return -1;
+  } else if (request->code == CODE_REPONSE_LIAISON) { // CODE = 4
+    // Ignorer tous les messages qui ont notre ID
+    if (request->id == pSystem.my_id) {
+      printf("Message ignoré : message avec notre propre ID (%d)\n", pSystem.my_id);
+      return 0;
     }
+  }
 
-    // Wait for code 5 (Info Pair)
-    char info_buffer[UNKNOWN_SIZE];
-    memset(info_buffer, 0, UNKNOWN_SIZE);
-    int info_len = recv(client_sock, info_buffer, UNKNOWN_SIZE - 1, 0);
-    if (info_len <= 0) {
-      perror("recv a échoué");
-      close(client_sock);
-      return -1;
-    }
-    info_buffer[info_len] = '\0'; // Ensure null termination
-    printf("    Information reçue du pair (%d octets)\n", info_len);
-    struct message *info_msg = malloc(sizeof(struct message));
-    if (info_msg == NULL) {
-      perror("malloc a échoué");
-      close(client_sock);
-      return -1;
-    }
-    if (buffer_to_message(info_msg, info_buffer) < 0) {
-      perror("buffer_to_message a échoué");
-      free_message(info_msg);
-      close(client_sock);
-      return -1;
-    }
-    if (info_msg->code == CODE_INFO_PAIR_BROADCAST) { // CODE = 6 if it is a broadcast instead
-      if (info_msg->info[0].id == pSystem.my_id) {
-        printf("Message ignoré : message avec notre propre ID (%d)\n", pSystem.my_id);
-        free_message(info_msg);
-        return 0; // Ignore messages with our own ID
-      }
-      // Add the new peer to the system
-      if (add_pair(info_msg->info[0].id, info_msg->info[0].ip, info_msg->info[0].port) < 0) {
-        perror("add_pair a échoué");
-        free_message(info_msg);
-        return -1;
-      }
-      free_message(info_msg);
-      close(client_sock);
-      return 1; // Successfully added the peer
-    }
-    // Check if ID is valid
-    int client_id = info_msg->info[0].id;
-    int found = 1;
-    while (found == 1) {
-      found = 0;
-      if (pSystem.my_id == client_id) {
-        // If the ID is the same as our own, increment it
-        printf("    ID %d est notre propre ID, génération d'un nouvel ID...\n", client_id);
-        client_id++;
-        found = 1; // Set found to 1 to continue checking
-      } else {
-        for (int i = 0; i < pSystem.count; i++) {
-          if (pSystem.pairs[i].id == client_id) {
-            found = 1;
-            break;
-          }
-        }
-        if (found) {
-          // Generate a new ID not in use
-          printf("    ID %d déjà utilisé, génération d'un nouvel ID...\n", client_id);
-          client_id++;
-        }
-      }
-    }
-    // Init the response (50 if the ID is not used, 51 otherwise)
-    if (info_msg->info[0].id == client_id) {
-      response = init_message(CODE_ID_ACCEPTED);
-    } else {
-      response = init_message(CODE_ID_CHANGED);
-      // Give the new ID to the client
-      response->id = client_id;
-    }
+  return 0;
+}
 
-    memset(resp_buffer, 0, sizeof(resp_buffer)); // Code = 50 or 51, most likely to be smaller than Code 4
-    if (message_to_buffer(response, resp_buffer, sizeof(resp_buffer)) < 0) {
-      perror("message_to_buffer a échoué");
-      free_message(response);
-      close(client_sock);
-      return -1;
-    }
-    // Send the response (CODE = 50 or 51)
-    if (send(client_sock, resp_buffer, strlen(resp_buffer), 0) < 0) {
-      perror("send a échoué");
-      close(client_sock);
-      free_message(response);
-      return -1;
-    }
-    if (response->code == CODE_ID_ACCEPTED) printf("  Validation d'ID envoyé... (CODE = 50)\n");
-    else printf("  Changement d'ID envoyé... (CODE = 51)\n");
+// Encode a message as text and answer it on a held connection, with its '\0'
+static int reply_message(unsigned int conn, struct message *msg, int framed) {
+  int buffer_size = get_buffer_size(msg);
+  char *buffer = calloc(1, buffer_size);
+  if (buffer == NULL) {
+    perror("calloc a échoué");
+    return -1;
+  }
+  int ret = -1;
+  if (message_to_buffer(msg, buffer, buffer_size) < 0) {
+    perror("message_to_buffer a échoué");
+  } else {
+    ret = conn_reply_held(conn, buffer, buffer_size, framed);
+  }
+  free(buffer);
+  return ret;
+}
 
-    free_message(response);
-    // Add the new pair to the system (CODE = 6)
-    sleep(1); // Wait for the other pairs to end their handle_join() process
-    send_new_pair(client_id, client_addr.sin6_addr, info_msg->info[0].port);
-    sleep(1); // Wait for the new pair to be sent
-    // Prepare the system information message (CODE = 7)
-    struct message *system_info = init_message(CODE_INFO_SYSTEME);
-    if (system_info == NULL) {
-      perror("Échec de l'initialisation du message d'information système");
-      close(client_sock);
-      return -1;
-    }
-    // Set the system information
-    system_info->id = pSystem.my_id;
-    struct in6_addr auction_ip;
-    inet_pton(AF_INET6, pSystem.auction_addr, &auction_ip); // Default IP address
-    message_set_ip(system_info, auction_ip);
-    message_set_port(system_info, pSystem.auction_port);
-    if (message_set_nb(system_info, pSystem.count) < 0) {
-      perror("message_set_nb a échoué");
-      free_message(system_info);
-      close(client_sock);
-      return -1;
+/**
+ * A join answered in steps from the loop: the workers check the signature
+ * of CODE 5, then sign CODE 7
+ */
+struct join_answer {
+  struct crypto_job job;        // Must stay the first field
+  unsigned int conn;            // Connection kept for CODE 7 (conn_hold())
+  int framed;
+  unsigned char joiner_dh[MESSAGE_KEY_SIZE]; // Ephemeral key sent in CODE 5
+  struct message *system_info;  // CODE 7
+  unsigned char data[MESSAGE_SIGNED_MAX];
+};
+
+// Last step of a join: CODE 7 is signed, queued behind CODE 50/51
+static void send_system_info(struct crypto_job *job) {
+  struct join_answer *ja = (struct join_answer *) job;
+  if (!job->result || message_set_sig_raw(ja->system_info, job->sig, job->slen) < 0) {
+    fprintf(stderr, "  Échec de la signature des informations du système\n");
+  }
+  // The connection is closed once both are written
+  if (reply_message(ja->conn, ja->system_info, ja->framed) < 0) {
+    fprintf(stderr, "  Échec de l'envoi des informations du système (CODE = 7)\n");
+  } else {
+    printf("  Envoie des pairs du systèmes... (CODE = 7)\n");
+  }
+  conn_release(ja->conn);
+  free_message(ja->system_info);
+  free(ja);
+}
+
+// Wrap the group key for the joiner if its ephemeral key is trusted, then
+// have the whole CODE 7 signed with our key
+static void sign_system_info(struct join_answer *ja, int joiner_dh_ok) {
+  struct message *system_info = ja->system_info;
+  if (joiner_dh_ok && crypto_has_group_key()) {
+    EVP_PKEY *dh = crypto_dh_generate(system_info->dh);
+    if (dh != NULL && crypto_group_key_export(dh, ja->joiner_dh, system_info->gkey) == 0) {
+      system_info->ldh = MESSAGE_KEY_SIZE;
+      system_info->lgkey = MESSAGE_KEY_SIZE;
     }
-    // Set the pairs information
-    for (int i = 0; i < pSystem.count; i++) {
-      struct info *pair_info = malloc(sizeof(struct info));
-      if (pair_info == NULL) {
-        perror("malloc a échoué (info pair)");
-        free_message(system_info);
-        close(client_sock);
-        return -1;
-      }
-      if (init_info(pair_info, pSystem.pairs[i].id, pSystem.pairs[i].ip, pSystem.pairs[i].port) < 0) {
-        perror("init_info a échoué");
-        free(pair_info);
-        free_message(system_info);
-        close(client_sock);
-        return -1;
+    EVP_PKEY_free(dh);
+  }
+  int len = message_signed_data(system_info, ja->data);
+  memset(&ja->job, 0, sizeof(ja->job));
+  ja->job.op = CRYPTO_SIGN;
+  ja->job.data = ja->data;
+  ja->job.len = len;
+  ja->job.done = send_system_info;
+  if (len < 0) send_system_info(&ja->job); // Sent unsigned, as when signing fails
+  else crypto_submit(&ja->job);
+}
+
+// The signature of CODE 5 is checked: its ephemeral key can be trusted
+static void join_verified(struct crypto_job *job) {
+  EVP_PKEY_free(job->pubkey);
+  sign_system_info((struct join_answer *) job, job->result);
+}
+
+// Second step of a join: the joiner connected to us and sent CODE 5
+static int answer_join(int sock, struct message *info_msg) {
+  struct sockaddr_in6 client_addr;
+  socklen_t client_addr_len = sizeof(client_addr);
+  if (info_msg->info == NULL ||
+      getpeername(sock, (struct sockaddr *)&client_addr, &client_addr_len) < 0) {
+    perror("Information du pair invalide");
+    return -1;
+  }
+  struct info joiner = info_msg->info[0];
+  int framed = joiner.enc & ENC_FRAMED;
+
+  // Check if ID is valid
+  int client_id = joiner.id;
+  int found = 1;
+  while (found == 1) {
+    found = 0;
+    if (pSystem.my_id == client_id) {
+      // If the ID is the same as our own, increment it
+      printf("    ID %d est notre propre ID, génération d'un nouvel ID...\n", client_id);
+      client_id++;
+      found = 1; // Set found to 1 to continue checking
+    } else {
+      for (int i = 0; i < pSystem.count; i++) {
+        if (pSystem.pairs[i].id == client_id) {
+          found = 1;
+          break;
+        }
       }
-      if (message_set_info(system_info, i, pair_info) < 0) {
-        perror("message_set_info a échoué");
-        free(pair_info);
-        free_message(system_info);
-        close(client_sock);
-        return -1;
+      if (found) {
+        // Generate a new ID not in use
+        printf("    ID %d déjà utilisé, génération d'un nouvel ID...\n", client_id);
+        client_id++;
       }
     }
-    // Convert the system info message to buffer
-    int system_info_buffer_size = get_buffer_size(system_info);
-    char system_info_buffer[system_info_buffer_size];
-    memset(system_info_buffer, 0, system_info_buffer_size);
-    if (message_to_buffer(system_info, system_info_buffer, system_info_buffer_size) < 0) {
-      perror("message_to_buffer a échoué (info système)");
-      free_message(system_info);
-      close(client_sock);
-      return -1;
-    }
-    // Free the system info message as we have the buffer now
+  }
+  // The connection stays open until CODE 7 is signed and written
+  unsigned int conn = conn_hold(sock);
+  if (conn == 0) return -1;
+
+  // Init the response (50 if the ID is not used, 51 otherwise)
+  struct message *response;
+  if (joiner.id == client_id) {
+    response = init_message(CODE_ID_ACCEPTED);
+  } else {
+    response = init_message(CODE_ID_CHANGED);
+    // Give the new ID to the client
+    if (response != NULL) response->id = client_id;
+  }
+  if (response == NULL) {
+    perror("init_message a échoué");
+    conn_release(conn);
+    return -1;
+  }
+  // Queued (CODE = 50 or 51), with its '\0' so that it can be told apart from CODE 7
+  if (reply_message(conn, response, framed) < 0) {
+    free_message(response);
+    conn_release(conn);
+    return -1;
+  }
+  if (response->code == CODE_ID_ACCEPTED) printf("  Validation d'ID envoyé... (CODE = 50)\n");
+  else printf("  Changement d'ID envoyé... (CODE = 51)\n");
+  free_message(response);
+
+  // Known from now on, the announce forwards the key with the pair
+  keys_set(client_id, joiner.cle);
+  // Add the new pair to the system (CODE = 6), sent once signed
+  announce_pair(client_id, client_addr.sin6_addr, joiner.port, joiner.enc);
+
+  // Prepare the system information message (CODE = 7)
+  struct join_answer *ja = calloc(1, sizeof(struct join_answer));
+  struct message *system_info = init_message(CODE_INFO_SYSTEME);
+  if (ja == NULL || system_info == NULL) {
+    perror("Échec de l'initialisation du message d'information système");
+    free(ja);
     free_message(system_info);
-    // Send the system info message (CODE = 7)
-    if (send(client_sock, system_info_buffer, system_info_buffer_size, 0) < 0) {
-      perror("send a échoué (info système)");
-      close(client_sock);
-      return -1;
+    conn_release(conn);
+    return -1;
+  }
+  ja->conn = conn;
+  ja->framed = framed;
+  ja->system_info = system_info;
+  // Set the system information
+  system_info->id = pSystem.my_id;
+  message_set_ip(system_info, pSystem.auction.addr.sin6_addr);
+  message_set_port(system_info, endpoint_port(&pSystem.auction));
+  int ok = message_set_nb(system_info, pSystem.count) == 0;
+  if (!ok) perror("message_set_nb a échoué");
+  // Set the pairs information
+  for (int i = 0; ok && i < pSystem.count; i++) {
+    struct info pair_info;
+    if (init_info(&pair_info, pSystem.pairs[i].id, pSystem.pairs[i].ip, pSystem.pairs[i].port) < 0) {
+      perror("init_info a échoué");
+      ok = 0;
+      break;
     }
-    printf("  Envoie des pairs du systèmes... (CODE = 7)\n");
-
-    close(client_sock);
-    // Add the new peer after sending the new pair to all peers
-    if (add_pair(client_id, client_addr.sin6_addr, info_msg->info[0].port) < 0) {
-      perror("add_pair a échoué");
-      free_message(info_msg);
-      return -1;
+    pair_info.enc = pSystem.pairs[i].encodings;
+    keys_get_text(pair_info.id, pair_info.cle, sizeof(pair_info.cle));
+    if (message_set_info(system_info, i, &pair_info) < 0) {
+      perror("message_set_info a échoué");
+      ok = 0;
     }
-    free_message(info_msg);
-    return 1;
+  }
+  if (!ok) {
+    free_message(system_info);
+    free(ja);
+    conn_release(conn);
+    return -1;
+  }
 
-  } else if (request->code == CODE_REPONSE_LIAISON) { // CODE = 4
-    // Ignorer tous les messages qui ont notre ID
-    if (request->id == pSystem.my_id) {
-      printf("Message ignoré : message avec notre propre ID (%d)\n", pSystem.my_id);
-      free_message(request);
-      return 0;
-    }
+  // Add the new peer, CODE 7 lists the ones it did not know
+  if (add_pair(client_id, client_addr.sin6_addr, joiner.port, joiner.enc) < 0) {
+    perror("add_pair a échoué");
   }
 
-  free_message(request);
+  // Ephemeral key of the joiner, trusted if signed with the key it sent: checked
+  // by the workers, which then sign CODE 7
+  EVP_PKEY *key = NULL;
+  int len = -1;
+  if (info_msg->ldh == MESSAGE_KEY_SIZE && info_msg->lsig > 0 && info_msg->lsig <= SIGNATURE_SIZE &&
+      (key = crypto_key_from_text(joiner.cle)) != NULL) {
+    memcpy(ja->joiner_dh, info_msg->dh, MESSAGE_KEY_SIZE);
+    len = message_signed_data(info_msg, ja->data);
+  }
+  if (len < 0) {
+    EVP_PKEY_free(key);
+    sign_system_info(ja, 0);
+    return 0;
+  }
+  memset(&ja->job, 0, sizeof(ja->job));
+  ja->job.op = CRYPTO_VERIFY;
+  ja->job.data = ja->data;
+  ja->job.len = len;
+  memcpy(ja->job.sig, info_msg->sig, info_msg->lsig);
+  ja->job.slen = info_msg->lsig;
+  ja->job.pubkey = key;
+  ja->job.done = join_verified;
+  crypto_submit(&ja->job);
   return 0;
 }
 
-int send_new_pair(unsigned short id, struct in6_addr ip, unsigned short port) {
-  printf("Envoi des informations du nouveau pair à tous les pairs...\n");
-  for (int i = 0; i < pSystem.count; i++) {
-    char peer_ip_str[INET6_ADDRSTRLEN];
-    inet_ntop(AF_INET6, &pSystem.pairs[i].ip, peer_ip_str, sizeof(peer_ip_str));
+// Send a message to every active peer at once, encoded once for each encoding in use;
+// with wait, the outcome for each peer is awaited and printed
+static int send_to_pairs(struct message *msg, int wait) {
+  char *encoded[ENC_BINARY + 1] = { NULL };
+  int sizes[ENC_BINARY + 1] = { 0 };
+  int count = pSystem.count;
+  int *status = malloc((count > 0 ? count : 1) * sizeof(int));
+  if (status == NULL) {
+    perror("malloc a échoué");
+    return -1;
+  }
 
-    int sock = setup_client_socket(peer_ip_str, pSystem.pairs[i].port);
-    if (sock < 0) {
-      perror("Échec de la connexion au pair");
-      continue; // Skip to the next peer if connection fails
-    }
-    // Prepare the message to send
-    struct message *msg = init_message(CODE_INFO_PAIR_BROADCAST);
-    if (msg == NULL) {
-      perror("Échec de l'initialisation du message");
-      close(sock);
-      return -1;
-    }
-    struct info *new_info = malloc(sizeof(struct info));
-    if (new_info == NULL) {
-      perror("malloc a échoué (info pair)");
-      free_message(msg);
-      close(sock);
-      return -1;
-    }
-    if (init_info(new_info, id, ip, port) < 0) {
-      perror("init_info a échoué");
-      free(new_info);
-      free_message(msg);
-      close(sock);
-      return -1;
+  for (int i = 0; i < count; i++) {
+    struct Pair *pair = &pSystem.pairs[i];
+    status[i] = CONN_SENT;
+    if (!pair->active) {
+      continue; // Skip inactive pairs
     }
-    if (message_set_nb(msg, 1) < 0) {
-      perror("message_set_nb a échoué");
-      free(new_info);
-      free_message(msg);
-      close(sock);
-      return -1;
+    if (msg->code == CODE_INFO_PAIR_BROADCAST && pair->id == msg->info[0].id) {
+      continue; // The new peer learns of the others from CODE 7
     }
-    if (message_set_info(msg, 0, new_info) < 0) {
-      perror("message_set_info a échoué");
-      free(new_info);
-      free_message(msg);
-      close(sock);
-      return -1;
+    status[i] = CONN_FAILED;
+    int encoding = pair_encoding(pair);
+    if (encoded[encoding] == NULL) {
+      int buffer_size = get_encoded_size(msg, encoding);
+      encoded[encoding] = malloc(buffer_size);
+      if (encoded[encoding] == NULL) {
+        perror("malloc a échoué");
+        break;
+      }
+      sizes[encoding] = encode_message(msg, encoding, encoded[encoding], buffer_size);
+      if (sizes[encoding] < 0) {
+        perror("message_to_buffer a échoué");
+        break;
+      }
     }
+    // Only starts the connection: every peer is reached in parallel
+    conn_send(pair, encoded[encoding], sizes[encoding], wait ? &status[i] : NULL);
+  }
+  free(encoded[ENC_TEXT]);
+  free(encoded[ENC_BINARY]);
+  if (!wait) {
+    // Failures are reported by the connections themselves
+    free(status);
+    return 0;
+  }
 
-    int buffer_size = get_buffer_size(msg);
-    char *buffer = malloc(buffer_size);
-    if (buffer == NULL) {
-      perror("malloc a échoué");
-      free_message(msg);
-      close(sock);
-      return -1;
-    }
-    if (message_to_buffer(msg, buffer, buffer_size) < 0) {
-      perror("message_to_buffer a échoué");
-      free(buffer);
-      free_message(msg);
-      close(sock);
-      return -1;
+  int sent = conn_wait(status, count, CONN_BROADCAST_MS);
+  for (int i = 0; i < count; i++) {
+    struct Pair *pair = &pSystem.pairs[i];
+    if (!pair->active) continue;
+    char peer_ip_str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &pair->ip, peer_ip_str, sizeof(peer_ip_str));
+    if (status[i] == CONN_SENT) {
+      printf("  Message envoyé au pair %d: ID=%d, IP=%s, Port=%d\n",
+             i + 1, pair->id, peer_ip_str, pair->port);
+    } else {
+      fprintf(stderr, "  Échec de l'envoi au pair %d: ID=%d, IP=%s, Port=%d (%s)\n",
+              i + 1, pair->id, peer_ip_str, pair->port,
+              status[i] == CONN_TIMEOUT ? "délai dépassé" : "connexion impossible");
     }
-    // Free the message as we have the buffer now
+  }
+  free(status);
+  return sent;
+}
+
+// Build the announce of a new pair (CODE 6), sent by us
+static struct message *new_pair_message(unsigned short id, struct in6_addr ip, unsigned short port,
+                                        unsigned char encodings) {
+  printf("Envoi des informations du nouveau pair à tous les pairs...\n");
+  // Prepare the message to send
+  struct message *msg = init_message(CODE_INFO_PAIR_BROADCAST);
+  if (msg == NULL) {
+    perror("Échec de l'initialisation du message");
+    return NULL;
+  }
+  struct info new_info;
+  if (init_info(&new_info, id, ip, port) < 0) {
+    perror("init_info a échoué");
     free_message(msg);
-    // Send the message
-    if (send(sock, buffer, buffer_size, 0) < 0) {
-      perror("send a échoué");
-      free(buffer);
-      close(sock);
-      return -1;
-    }
-    printf("  Message envoyé au pair %d: ID=%d, IP=%s, Port=%d\n",
-           i + 1, id, peer_ip_str, port);
-    free(buffer);
-    close(sock);
+    return NULL;
+  }
+  new_info.enc = encodings;
+  keys_get_text(id, new_info.cle, sizeof(new_info.cle));
+  if (message_set_nb(msg, 1) < 0) {
+    perror("message_set_nb a échoué");
+    free_message(msg);
+    return NULL;
   }
+  if (message_set_info(msg, 0, &new_info) < 0) {
+    perror("message_set_info a échoué");
+    free_message(msg);
+    return NULL;
+  }
+  // Signed by us, the peers check it with the key they know for us
+  msg->id = pSystem.my_id;
+  return msg;
+}
+
+/**
+ * CODE 6 waiting for its signature before it is sent to every peer
+ */
+struct signed_announce {
+  struct crypto_job job; // Must stay the first field
+  struct message *msg;
+  unsigned char data[MESSAGE_SIGNED_MAX];
+};
+
+// Called from the loop once the workers signed the announce
+static void send_signed_announce(struct crypto_job *job) {
+  struct signed_announce *sa = (struct signed_announce *) job;
+  if (!job->result || message_set_sig_raw(sa->msg, job->sig, job->slen) < 0) {
+    fprintf(stderr, "  Échec de la signature de l'annonce du pair %d\n", sa->msg->info[0].id);
+  }
+  // The connections go on in the loop
+  send_to_pairs(sa->msg, 0);
+  free_message(sa->msg);
+  free(sa);
+}
+
+// Announce a new pair without waiting, neither for the signature nor for the peers
+static int announce_pair(unsigned short id, struct in6_addr ip, unsigned short port,
+                         unsigned char encodings) {
+  struct signed_announce *sa = malloc(sizeof(struct signed_announce));
+  struct message *msg = new_pair_message(id, ip, port, encodings);
+  int len = msg != NULL && sa != NULL ? message_signed_data(msg, sa->data) : -1;
+  if (len < 0) {
+    free(sa);
+    free_message(msg);
+    return -1;
+  }
+  memset(&sa->job, 0, sizeof(sa->job));
+  sa->job.op = CRYPTO_SIGN;
+  sa->job.data = sa->data;
+  sa->job.len = len;
+  sa->job.done = send_signed_announce;
+  sa->msg = msg;
+  crypto_submit(&sa->job);
   return 0;
 }
 
-int add_pair(unsigned short id, struct in6_addr ip, unsigned short port) {
+int send_new_pair(unsigned short id, struct in6_addr ip, unsigned short port, unsigned char encodings) {
+  struct message *msg = new_pair_message(id, ip, port, encodings);
+  if (msg == NULL) return -1;
+  if (message_set_sig(msg) < 0) {
+    fprintf(stderr, "  Échec de la signature de l'annonce du pair %d\n", id);
+  }
+  int sent = send_to_pairs(msg, 1);
+  free_message(msg);
+  return sent;
+}
+
+int add_pair(unsigned short id, struct in6_addr ip, unsigned short port, unsigned char encodings) {
   char ip_str[INET6_ADDRSTRLEN];
   inet_ntop(AF_INET6, &ip, ip_str, sizeof(ip_str));
   printf("    Ajout du pair: ID=%d, IP=%s, Port=%d\n", id, ip_str, port);
@@ -708,13 +835,14 @@ int add_pair(unsigned short id, struct in6_addr ip, unsigned short port) {
       pSystem.pairs[i].ip = ip;
       pSystem.pairs[i].port = port;
       pSystem.pairs[i].active = 1;
+      pSystem.pairs[i].encodings = encodings;
       return 0;
     }
   }
 
-  // Add a new peer
+  // Add a new peer, growing the array as a CODE 7 may list any number of them
   if (pSystem.count >= pSystem.capacity) {
-    int new_capacity = pSystem.capacity * 2;
+    int new_capacity = pSystem.capacity > 0 ? pSystem.capacity * 2 : 10;
     struct Pair *new_pairs = realloc(pSystem.pairs, new_capacity * sizeof(struct Pair));
     if (!new_pairs) {
       perror("realloc a échoué");
@@ -728,114 +856,181 @@ int add_pair(unsigned short id, struct in6_addr ip, unsigned short port) {
   pSystem.pairs[pSystem.count].ip = ip;
   pSystem.pairs[pSystem.count].port = port;
   pSystem.pairs[pSystem.count].active = 1;
+  pSystem.pairs[pSystem.count].encodings = encodings;
   pSystem.count++;
 
   return 0;
 }
 
-int recv_message(int sock) {
-  char buffer[UNKNOWN_SIZE];
-  memset(buffer, 0, UNKNOWN_SIZE);
+int pair_encoding(const struct Pair *pair) {
+  return (pair->encodings & ENC_BINARY) ? ENC_BINARY : ENC_TEXT;
+}
 
-  // Receive a message
-  int len = recv(sock, buffer, UNKNOWN_SIZE - 1, 0);
-  if (len <= 0) {
-    perror("recv a échoué");
-    return -1; // Error or no data received
+int pairs_group_encoding() {
+  return (pairs_group_capabilities() & ENC_BINARY) ? ENC_BINARY : ENC_TEXT;
+}
+
+unsigned char pairs_group_capabilities() {
+  unsigned char common = ENC_SUPPORTED;
+  for (int i = 0; i < pSystem.count; i++) {
+    if (pSystem.pairs[i].active) common &= pSystem.pairs[i].encodings;
   }
+  return common;
+}
 
-  buffer[len] = '\0'; // Ensure null-terminated string
-  printf("Message reçu (%d octets)\n", len);
+int pairs_is_active(unsigned short id) {
+  for (int i = 0; i < pSystem.count; i++) {
+    if (pSystem.pairs[i].id == id) return pSystem.pairs[i].active;
+  }
+  return 0;
+}
 
-  struct message *msg = malloc(sizeof(struct message));
-  if (msg == NULL) {
-    perror("malloc a échoué");
+// Tell whether the public key of a peer is known
+static int key_known(uint16_t id) {
+  EVP_PKEY *key = keys_get(id);
+  EVP_PKEY_free(key);
+  return key != NULL;
+}
+
+// Apply a new pair (CODE 6) or a departure (CODE 13). Unless it is trusted
+// (signed by a key we knew), it may not change a peer whose key is known
+static int apply_pair_message(struct message *msg, int trusted) {
+  if (msg->code == CODE_INFO_PAIR_BROADCAST) {
+    // A new peer joined through another peer (CODE = 6)
+    struct info *joiner = &msg->info[0];
+    if (joiner->id == pSystem.my_id) return 0;
+    if (!trusted && key_known(joiner->id)) {
+      fprintf(stderr, "  Annonce non authentifiée du pair %d ignorée\n", joiner->id);
+      return -1;
+    }
+    if (add_pair(joiner->id, joiner->ip, joiner->port, joiner->enc) < 0) {
+      perror("add_pair a échoué");
+      return -1;
+    }
+    if (trusted) keys_set(joiner->id, joiner->cle);
+    else keys_add(joiner->id, joiner->cle);
+    return 1;
+  }
+
+  printf("  Déconnexion du système P2P demandée par le pair ID=%d\n", msg->id);
+  // Remove the peer from the system
+  for (int i = 0; i < pSystem.count; i++) {
+    if (pSystem.pairs[i].id == msg->id) {
+      pSystem.pairs[i].active = 0; // Mark as inactive
+      keys_remove(msg->id);
+      conn_close(msg->id);
+      printf("  Pair ID=%d déconnecté\n", msg->id);
+      break;
+    }
+  }
+  return 0;
+}
+
+/**
+ * CODE 6 or CODE 13 waiting for the check of its signature
+ */
+struct pair_verify {
+  struct crypto_job job; // Must stay the first field
+  struct message *msg;   // Copy detached from the receive buffer
+  unsigned char data[MESSAGE_SIGNED_MAX];
+};
+
+// Called from the loop once the workers checked the signature
+static void apply_verified(struct crypto_job *job) {
+  struct pair_verify *pv = (struct pair_verify *) job;
+  if (job->result) {
+    apply_pair_message(pv->msg, 1);
+  } else {
+    fprintf(stderr, "Signature invalide: message %d du pair %d ignoré\n",
+            pv->msg->code, pv->msg->id);
+  }
+  EVP_PKEY_free(job->pubkey);
+  free_message(pv->msg);
+  free(pv);
+}
+
+// A CODE 6 is signed by the peer sending it, a CODE 13 by the peer leaving:
+// a sender whose key is known must sign, the message is applied once the
+// workers checked it. Messages of senders without a known key (older
+// peers) are applied at once, without authority over known peers
+static int receive_pair_message(struct message *msg) {
+  EVP_PKEY *key = keys_get(msg->id);
+  if (key == NULL) return apply_pair_message(msg, 0);
+  if (msg->lsig == 0) {
+    fprintf(stderr, "Message %d du pair %d ignoré: non signé\n", msg->code, msg->id);
+    EVP_PKEY_free(key);
+    return -1;
+  }
+
+  struct pair_verify *pv = malloc(sizeof(struct pair_verify));
+  struct message *copy = pool_get_message();
+  if (!pv || !copy) {
+    perror("malloc a échoué (vérification)");
+    free(pv);
+    pool_put_message(copy);
+    EVP_PKEY_free(key);
     return -1;
   }
+  // The message points into the receive buffer, which is reused
+  *copy = *msg;
+  int len = message_detach(copy) < 0 ? -1 : message_signed_data(copy, pv->data);
+  if (len < 0) {
+    free(pv);
+    free_message(copy);
+    EVP_PKEY_free(key);
+    return -1;
+  }
+  memset(&pv->job, 0, sizeof(pv->job));
+  pv->job.op = CRYPTO_VERIFY;
+  pv->job.data = pv->data;
+  pv->job.len = len;
+  memcpy(pv->job.sig, copy->sig, copy->lsig);
+  pv->job.slen = copy->lsig;
+  pv->job.pubkey = key;
+  pv->job.done = apply_verified;
+  pv->msg = copy;
+  crypto_submit(&pv->job);
+  return 0;
+}
 
-  if (buffer_to_message(msg, buffer) < 0) {
+int process_pair_message(int sock, char *buffer, int len) {
+  printf("Message reçu (%d octets)\n", len);
+
+  struct message_view view;
+  if (decode_message_view(&view, buffer, len) < 0) {
     perror("buffer_to_message a échoué");
-    free_message(msg);
     return -1;
   }
+  struct message *msg = &view.msg;
 
   // Process the message based on its code
-  if (msg->code == CODE_QUIT_SYSTEME) {
-    printf("  Déconnexion du système P2P demandée par le pair ID=%d\n", msg->id);
-    // Remove the peer from the system
-    for (int i = 0; i < pSystem.count; i++) {
-      if (pSystem.pairs[i].id == msg->id) {
-        pSystem.pairs[i].active = 0; // Mark as inactive
-        printf("  Pair ID=%d déconnecté\n", msg->id);
-        break;
-      }
-    }
-    free_message(msg);
-    return 0; // Indicate that the system should quit
-  } else {
-    printf("  Message reçu avec code inconnu: %d\n", msg->code);
+  if (msg->code == CODE_INFO_PAIR) {
+    // A peer joining through us (CODE = 5), answered on its connection
+    printf("    Information reçue du pair (%d octets)\n", len);
+    return answer_join(sock, msg);
+  } else if (msg->code == CODE_INFO_PAIR_BROADCAST || msg->code == CODE_QUIT_SYSTEME) {
+    return receive_pair_message(msg);
   }
-
-  free_message(msg);
-  return 0; // Return the length of the received message
+  printf("  Message reçu avec code inconnu: %d\n", msg->code);
+  return 0;
 }
 
 int quit_pairs() {
   printf("Déconnexion du système P2P...\n");
   // Send a message to all pairs to notify them of disconnection
-  for (int i = 0; i < pSystem.count; i++) {
-    if (!pSystem.pairs[i].active) {
-      continue; // Skip inactive pairs
-    }
-    char peer_ip_str[INET6_ADDRSTRLEN];
-    inet_ntop(AF_INET6, &pSystem.pairs[i].ip, peer_ip_str, sizeof(peer_ip_str));
-
-    int sock = setup_client_socket(peer_ip_str, pSystem.pairs[i].port);
-    if (sock < 0) {
-      perror("Échec de la connexion au pair");
-      continue; // Skip to the next peer if connection fails
-    }
-    // Prepare the message to send
-    struct message *msg = init_message(CODE_QUIT_SYSTEME); // CODE = 13 for disconnection
-    if (msg == NULL) {
-      perror("Échec de l'initialisation du message");
-      close(sock);
-      return -1;
-    }
-    msg->id = pSystem.my_id; // Set the ID of the sender
-
-    int buffer_size = get_buffer_size(msg);
-    char *buffer = malloc(buffer_size);
-    if (buffer == NULL) {
-      perror("malloc a échoué");
-      free_message(msg);
-      close(sock);
-      return -1;
-    }
-    if (message_to_buffer(msg, buffer, buffer_size) < 0) {
-      perror("message_to_buffer a échoué");
-      free(buffer);
-      free_message(msg);
-      close(sock);
-      return -1;
-    }
-    // Free the message as we have the buffer now
-    free_message(msg);
-
-    // Send the message
-    if (send(sock, buffer, buffer_size, 0) < 0) {
-      perror("send a échoué");
-      free(buffer);
-      close(sock);
-      return -1;
-    }
-    printf("  Message de déconnexion envoyé au pair %d: ID=%d, IP=%s, Port=%d\n",
-           i + 1, pSystem.pairs[i].id, peer_ip_str, pSystem.pairs[i].port);
-    free(buffer);
-    close(sock);
+  struct message *msg = init_message(CODE_QUIT_SYSTEME); // CODE = 13 for disconnection
+  if (msg == NULL) {
+    perror("Échec de l'initialisation du message");
+    return -1;
   }
-
-  return 0;
+  msg->id = pSystem.my_id; // Set the ID of the sender
+  if (message_set_sig(msg) < 0) {
+    fprintf(stderr, "  Échec de la signature du message de déconnexion\n");
+  }
+  // Waits for every peer: the event loop stops after this
+  int sent = send_to_pairs(msg, 1);
+  free_message(msg);
+  return sent < 0 ? -1 : 0;
 }
 
 void print_pairs() {
@@ -872,4 +1067,8 @@ void free_pairs() {
   }
   pSystem.count = 0;
   pSystem.capacity = 0;
+  EVP_PKEY_free(join_dh);
+  join_dh = NULL;
+  keys_clear();
+  crypto_cleanup();
 }
@@ -0,0 +1,171 @@
+#include "include/pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Free objects are chained through their first bytes
+struct free_node {
+  struct free_node *next;
+};
+
+struct freelist {
+  struct free_node *head;
+  int count;
+};
+
+// Header placed before each info array, remembers its capacity
+union info_header {
+  struct free_node node;
+  size_t cap;
+  max_align_t align;
+};
+
+// Pools of one thread
+struct pool_cache {
+  struct freelist messages;
+  struct freelist infos;
+  struct pool_stats stats;
+  int registered;
+  struct pool_cache *prev;
+  struct pool_cache *next;
+};
+
+static __thread struct pool_cache cache;
+static struct pool_cache *caches = NULL; // Caches of the running threads
+static struct pool_stats retired;        // Counters of the threads which exited
+static pthread_mutex_t caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static void freelist_clear(struct freelist *list) {
+  while (list->head != NULL) {
+    struct free_node *node = list->head;
+    list->head = node->next;
+    free(node);
+  }
+  list->count = 0;
+}
+
+// Called when a thread exits, releases its freelists and keeps its counters
+static void cache_destroy(void *arg) {
+  struct pool_cache *c = arg;
+  pthread_mutex_lock(&caches_mutex);
+  if (c->prev != NULL) c->prev->next = c->next;
+  else caches = c->next;
+  if (c->next != NULL) c->next->prev = c->prev;
+  retired.hits += c->stats.hits;
+  retired.misses += c->stats.misses;
+  retired.outstanding += c->stats.outstanding;
+  pthread_mutex_unlock(&caches_mutex);
+
+  freelist_clear(&c->messages);
+  freelist_clear(&c->infos);
+  c->registered = 0;
+}
+
+static void cache_key_create(void) {
+  if (pthread_key_create(&cache_key, cache_destroy) != 0) {
+    perror("pthread_key_create a échoué (pool)");
+  }
+}
+
+static struct pool_cache *get_cache(void) {
+  struct pool_cache *c = &cache;
+  if (!c->registered) {
+    pthread_once(&cache_key_once, cache_key_create);
+    pthread_setspecific(cache_key, c);
+    pthread_mutex_lock(&caches_mutex);
+    c->prev = NULL;
+    c->next = caches;
+    if (caches != NULL) caches->prev = c;
+    caches = c;
+    pthread_mutex_unlock(&caches_mutex);
+    c->registered = 1;
+  }
+  return c;
+}
+
+static void *freelist_pop(struct freelist *list) {
+  struct free_node *node = list->head;
+  if (node != NULL) {
+    list->head = node->next;
+    list->count--;
+  }
+  return node;
+}
+
+// Returns 0 if the list is full and the object must be freed by the caller
+static int freelist_push(struct freelist *list, void *obj) {
+  if (list->count >= POOL_MAX_FREE) return 0;
+  struct free_node *node = obj;
+  node->next = list->head;
+  list->head = node;
+  list->count++;
+  return 1;
+}
+
+struct message *pool_get_message(void) {
+  struct pool_cache *c = get_cache();
+  struct message *msg = freelist_pop(&c->messages);
+  if (msg != NULL) {
+    c->stats.hits++;
+  } else {
+    msg = malloc(sizeof(struct message));
+    if (msg == NULL) {
+      perror("Allocation ratée (pool message)");
+      return NULL;
+    }
+    c->stats.misses++;
+  }
+  c->stats.outstanding++;
+  return msg;
+}
+
+void pool_put_message(struct message *msg) {
+  if (msg == NULL) return;
+  struct pool_cache *c = get_cache();
+  c->stats.outstanding--;
+  if (!freelist_push(&c->messages, msg)) free(msg);
+}
+
+struct info *pool_get_info(int nb) {
+  struct pool_cache *c = get_cache();
+  union info_header *header = NULL;
+  size_t cap = nb > POOL_INFO_SMALL ? (size_t) nb : POOL_INFO_SMALL;
+
+  if (cap == POOL_INFO_SMALL) header = freelist_pop(&c->infos);
+  if (header != NULL) {
+    c->stats.hits++;
+  } else {
+    header = malloc(sizeof(union info_header) + cap * sizeof(struct info));
+    if (header == NULL) {
+      perror("Allocation ratée (pool info)");
+      return NULL;
+    }
+    c->stats.misses++;
+  }
+  header->cap = cap;
+  c->stats.outstanding++;
+  return (struct info *) (header + 1);
+}
+
+void pool_put_info(struct info *info) {
+  if (info == NULL) return;
+  struct pool_cache *c = get_cache();
+  union info_header *header = (union info_header *) info - 1;
+  c->stats.outstanding--;
+  if (header->cap != POOL_INFO_SMALL || !freelist_push(&c->infos, header)) free(header);
+}
+
+void pool_get_stats(struct pool_stats *stats) {
+  if (stats == NULL) return;
+  pthread_mutex_lock(&caches_mutex);
+  *stats = retired;
+  for (struct pool_cache *c = caches; c != NULL; c = c->next) {
+    stats->hits += c->stats.hits;
+    stats->misses += c->stats.misses;
+    stats->outstanding += c->stats.outstanding;
+  }
+  pthread_mutex_unlock(&caches_mutex);
+}
@@ -0,0 +1,360 @@
+#include "include/reliable.h"
+#include "include/batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <openssl/rand.h>
+
+/**
+ * A datagram we sent, kept until its slot is reused
+ */
+struct sent_datagram {
+  uint32_t seq;
+  int len;                                             // 0 if not kept
+  unsigned char data[RELIABLE_HEADER_SIZE + BATCH_MTU]; // Envelope included
+};
+
+/**
+ * What was received from a sender
+ */
+struct sender_state {
+  int used;
+  uint16_t id;
+  uint32_t epoch;
+  uint32_t top;        // Highest SEQ seen
+  uint64_t received;   // Bit i set when SEQ top - i arrived
+  uint64_t last_nack;  // When holes were last asked for (ms)
+  uint64_t last_seen;  // When it was last heard from (ms)
+};
+
+/**
+ * When a receiver last had its NACK answered
+ */
+struct requester_state {
+  int used;
+  uint16_t id;
+  uint64_t last_repair; // ms
+};
+
+static pthread_mutex_t reliable_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Sender side
+static uint16_t my_id;
+static uint32_t my_epoch;
+static uint32_t next_seq;
+static int sent_any;
+static uint64_t last_sent;
+static uint64_t last_heartbeat;
+static const struct endpoint *group;
+static struct sent_datagram history[RELIABLE_HISTORY];
+static struct requester_state requesters[RELIABLE_PEERS];
+static int (*peer_check)(uint16_t id) = NULL;
+
+// Receiver side
+static struct sender_state senders[RELIABLE_PEERS];
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put_header(unsigned char *p, uint8_t type, uint16_t id, uint32_t epoch, uint32_t seq) {
+  p[0] = RELIABLE_MAGIC;
+  p[1] = RELIABLE_VERSION;
+  p[2] = type;
+  id = htons(id);
+  epoch = htonl(epoch);
+  seq = htonl(seq);
+  memcpy(p + 3, &id, 2);
+  memcpy(p + 5, &epoch, 4);
+  memcpy(p + 9, &seq, 4);
+}
+
+static int send_to(int sock, const void *data, size_t len, const struct sockaddr_in6 *dest) {
+  if (sendto(sock, data, len, 0, (const struct sockaddr *) dest, sizeof(*dest)) < 0) {
+    perror("sendto a échoué (reliable)");
+    return -1;
+  }
+  return 0;
+}
+
+void reliable_init(uint16_t id, const struct endpoint *group_ep) {
+  pthread_mutex_lock(&reliable_mutex);
+  my_id = id;
+  if (RAND_bytes((unsigned char *) &my_epoch, sizeof(my_epoch)) != 1) {
+    my_epoch = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+  }
+  next_seq = 0;
+  sent_any = 0;
+  last_sent = 0;
+  last_heartbeat = 0;
+  group = group_ep;
+  memset(history, 0, sizeof(history));
+  memset(requesters, 0, sizeof(requesters));
+  memset(senders, 0, sizeof(senders));
+  pthread_mutex_unlock(&reliable_mutex);
+}
+
+void reliable_set_peer_check(int (*is_peer)(uint16_t id)) {
+  pthread_mutex_lock(&reliable_mutex);
+  peer_check = is_peer;
+  pthread_mutex_unlock(&reliable_mutex);
+}
+
+// Number a datagram, keep it for retransmission and build its envelope in out
+static void wrap(const struct datagram *d, unsigned char *out, uint64_t now) {
+  memcpy(out + RELIABLE_HEADER_SIZE, d->data, d->len);
+
+  pthread_mutex_lock(&reliable_mutex);
+  uint32_t seq = next_seq++;
+  put_header(out, RELIABLE_DATA, my_id, my_epoch, seq);
+  struct sent_datagram *slot = &history[seq % RELIABLE_HISTORY];
+  slot->seq = seq;
+  slot->len = 0;
+  if (d->len <= BATCH_MTU) {
+    // Larger datagrams are not kept: their loss is not repaired
+    slot->len = RELIABLE_HEADER_SIZE + d->len;
+    memcpy(slot->data, out, slot->len);
+  }
+  sent_any = 1;
+  last_sent = now;
+  pthread_mutex_unlock(&reliable_mutex);
+}
+
+int reliable_send_batch(int sock, const struct endpoint *dest, const struct datagram *d, int count) {
+  unsigned char stack[count][RELIABLE_HEADER_SIZE + BATCH_MTU];
+  struct datagram wrapped[count];
+  uint64_t now = now_ms();
+  int ret = 0;
+
+  for (int i = 0; i < count; i++) {
+    unsigned char *out = stack[i];
+    if (d[i].len > BATCH_MTU) {
+      out = malloc(RELIABLE_HEADER_SIZE + d[i].len);
+      if (out == NULL) {
+        perror("malloc a échoué (reliable)");
+        count = i;
+        ret = -1;
+        break;
+      }
+    }
+    wrap(&d[i], out, now);
+    wrapped[i].data = out;
+    wrapped[i].len = RELIABLE_HEADER_SIZE + d[i].len;
+  }
+
+  if (count > 0 && send_multicast_batch(sock, dest, wrapped, count) < 0) ret = -1;
+  for (int i = 0; i < count; i++) {
+    if (wrapped[i].data != stack[i]) free((void *) wrapped[i].data);
+  }
+  return ret;
+}
+
+int reliable_send(int sock, const struct endpoint *dest, const void *data, size_t len) {
+  struct datagram d = { data, len };
+  return reliable_send_batch(sock, dest, &d, 1);
+}
+
+int is_reliable_buffer(const char *buffer, int len) {
+  return buffer != NULL && len >= RELIABLE_HEADER_SIZE &&
+         (unsigned char) buffer[0] == RELIABLE_MAGIC && buffer[1] == RELIABLE_VERSION;
+}
+
+// State of a sender, reset when it restarted, NULL for ourselves or when every
+// entry belongs to a sender heard from lately (its datagrams then go without
+// repair). Open addressing on the full ID: an entry is never emptied, only
+// given to another sender, so a probe can stop at the first unused one
+static struct sender_state *find_sender(uint16_t id, uint32_t epoch, uint32_t top, uint64_t now) {
+  if (id == my_id) return NULL;
+  struct sender_state *s = NULL;
+  struct sender_state *idle = NULL;
+  uint32_t home = ((uint32_t) id * 2654435761u) >> 16;
+  for (int i = 0; i < RELIABLE_PEERS && s == NULL; i++) {
+    struct sender_state *e = &senders[(home + i) % RELIABLE_PEERS];
+    if (!e->used || e->id == id) {
+      s = e;
+    } else if (now - e->last_seen >= RELIABLE_IDLE_MS && (idle == NULL || e->last_seen < idle->last_seen)) {
+      idle = e;
+    }
+  }
+  if (s == NULL) s = idle; // Table full: take the entry of the sender quiet for longest
+  if (s == NULL) return NULL;
+
+  if (!s->used || s->id != id || s->epoch != epoch) {
+    // Nothing up to top can be asked for
+    s->used = 1;
+    s->id = id;
+    s->epoch = epoch;
+    s->top = top;
+    s->received = ~(uint64_t) 0;
+    s->last_nack = 0;
+  }
+  s->last_seen = now;
+  return s;
+}
+
+// Record the arrival of a SEQ, 1 if it is new, 0 if it already came or is too old
+static int mark_received(struct sender_state *s, uint32_t seq) {
+  int32_t d = (int32_t) (seq - s->top);
+  if (d > 0) {
+    s->received = d >= RELIABLE_WINDOW ? 0 : s->received << d;
+    s->received |= 1;
+    s->top = seq;
+    return 1;
+  }
+  d = -d;
+  if (d >= RELIABLE_WINDOW) return 0;
+  uint64_t bit = (uint64_t) 1 << d;
+  if (s->received & bit) return 0;
+  s->received |= bit;
+  return 1;
+}
+
+// Build the NACK for the holes of a sender, 0 if there are none
+static int build_nack(const struct sender_state *s, unsigned char *nack) {
+  if (s->received == ~(uint64_t) 0) return 0;
+  int oldest = RELIABLE_WINDOW - 1;
+  while (s->received & ((uint64_t) 1 << oldest)) oldest--;
+  uint32_t first = s->top - oldest;
+
+  uint64_t missing = 0;
+  for (int i = oldest; i >= 0; i--) {
+    if (!(s->received & ((uint64_t) 1 << i))) missing |= (uint64_t) 1 << (oldest - i);
+  }
+  put_header(nack, RELIABLE_NACK, s->id, s->epoch, first);
+  for (int i = 0; i < 8; i++) nack[RELIABLE_HEADER_SIZE + i] = missing >> (56 - 8 * i);
+  uint16_t me = htons(my_id);
+  memcpy(nack + RELIABLE_HEADER_SIZE + 8, &me, 2);
+  return 1;
+}
+
+// Tell whether a receiver may be answered now, and if so count it as answered.
+// Same open addressing as the senders; with every entry taken, the one
+// answered longest ago is reused
+static int may_repair(uint16_t id, uint64_t now) {
+  if (peer_check != NULL && !peer_check(id)) return 0;
+  struct requester_state *r = NULL;
+  struct requester_state *oldest = NULL;
+  uint32_t home = ((uint32_t) id * 2654435761u) >> 16;
+  for (int i = 0; i < RELIABLE_PEERS && r == NULL; i++) {
+    struct requester_state *e = &requesters[(home + i) % RELIABLE_PEERS];
+    if (!e->used || e->id == id) {
+      r = e;
+    } else if (oldest == NULL || e->last_repair < oldest->last_repair) {
+      oldest = e;
+    }
+  }
+  if (r == NULL) r = oldest;
+  if (r->used && r->id == id && now - r->last_repair < RELIABLE_NACK_MS) return 0;
+  r->used = 1;
+  r->id = id;
+  r->last_repair = now;
+  return 1;
+}
+
+// Send again the datagrams a receiver is missing
+static void retransmit(int sock, uint32_t first, const unsigned char *body,
+                       const struct sockaddr_in6 *from) {
+  uint64_t missing = 0;
+  for (int i = 0; i < 8; i++) missing = missing << 8 | body[i];
+
+  for (int i = 0; i < RELIABLE_WINDOW && missing != 0; i++, missing >>= 1) {
+    if (!(missing & 1)) continue;
+    uint32_t seq = first + i;
+    unsigned char out[RELIABLE_HEADER_SIZE + BATCH_MTU];
+    int len = 0;
+    pthread_mutex_lock(&reliable_mutex);
+    struct sent_datagram *slot = &history[seq % RELIABLE_HISTORY];
+    if (slot->len > 0 && slot->seq == seq && (int32_t) (next_seq - seq) > 0) {
+      len = slot->len;
+      memcpy(out, slot->data, len);
+    }
+    pthread_mutex_unlock(&reliable_mutex);
+    if (len > 0) send_to(sock, out, len, from);
+  }
+}
+
+int reliable_receive(int sock, char *buffer, int len, const struct sockaddr_in6 *from,
+                     char **payload) {
+  if (!is_reliable_buffer(buffer, len)) {
+    // Peer without envelope
+    *payload = buffer;
+    return len;
+  }
+  unsigned char *p = (unsigned char *) buffer;
+  uint16_t id;
+  uint32_t epoch, seq;
+  memcpy(&id, p + 3, 2);
+  memcpy(&epoch, p + 5, 4);
+  memcpy(&seq, p + 9, 4);
+  id = ntohs(id);
+  epoch = ntohl(epoch);
+  seq = ntohl(seq);
+
+  if (p[2] == RELIABLE_NACK) {
+    // Sent to us alone: SENDER is the peer asked, the receiver follows the mask
+    if (len < RELIABLE_NACK_SIZE || id != my_id || epoch != my_epoch) return 0;
+    uint16_t receiver;
+    memcpy(&receiver, p + RELIABLE_HEADER_SIZE + 8, 2);
+    pthread_mutex_lock(&reliable_mutex);
+    int answer = may_repair(ntohs(receiver), now_ms());
+    pthread_mutex_unlock(&reliable_mutex);
+    if (answer) retransmit(sock, seq, p + RELIABLE_HEADER_SIZE, from);
+    return 0;
+  }
+  if (p[2] != RELIABLE_DATA && p[2] != RELIABLE_HEARTBEAT) return 0;
+
+  int data = p[2] == RELIABLE_DATA;
+  int deliver = data;
+  unsigned char nack[RELIABLE_NACK_SIZE];
+  int send_nack = 0;
+
+  uint64_t now = now_ms();
+  pthread_mutex_lock(&reliable_mutex);
+  // A heartbeat from a sender not seen yet tells of nothing missed
+  struct sender_state *s = find_sender(id, epoch, data ? seq - 1 : seq, now);
+  if (s != NULL) {
+    int32_t ahead = seq - s->top;
+    if (data) {
+      deliver = mark_received(s, seq);
+    } else if (ahead > 0) {
+      // Datagrams up to seq were sent, none of them arrived
+      s->received = ahead >= RELIABLE_WINDOW ? 0 : s->received << ahead;
+      s->top = seq;
+    }
+    // Ask at once for a new hole, again on each heartbeat for the ones left
+    if (ahead > data || (!data && now - s->last_nack >= RELIABLE_NACK_MS)) {
+      send_nack = build_nack(s, nack);
+      if (send_nack) s->last_nack = now;
+    }
+  }
+  pthread_mutex_unlock(&reliable_mutex);
+
+  if (send_nack) send_to(sock, nack, sizeof(nack), from);
+  if (!deliver) return 0;
+  *payload = buffer + RELIABLE_HEADER_SIZE;
+  return len - RELIABLE_HEADER_SIZE;
+}
+
+void reliable_tick(int sock) {
+  unsigned char hb[RELIABLE_HEADER_SIZE];
+  uint64_t now = now_ms();
+
+  pthread_mutex_lock(&reliable_mutex);
+  int due = sent_any && group != NULL &&
+            now - last_sent < (uint64_t) RELIABLE_HEARTBEATS * RELIABLE_HEARTBEAT_MS &&
+            now - last_heartbeat >= RELIABLE_HEARTBEAT_MS;
+  if (due) {
+    put_header(hb, RELIABLE_HEARTBEAT, my_id, my_epoch, next_seq - 1);
+    last_heartbeat = now;
+  }
+  pthread_mutex_unlock(&reliable_mutex);
+
+  if (due) send_multicast(sock, group, hb, sizeof(hb));
+}
@@ -0,0 +1,154 @@
+#include "include/scan.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+static int scan_scalar(const char *buf, int from, int len, char sep, int *off, int max) {
+  int n = 0;
+  for (int i = from; i < len && n < max; i++) {
+    off[n] = i;
+    n += buf[i] == sep;
+  }
+  return n;
+}
+
+#ifdef SCAN_X86
+// Append the positions of the bits set in mask, returns -1 once off is full
+static inline int push_mask(uint32_t mask, int base, int *off, int n, int max) {
+  while (mask != 0) {
+    if (n == max) return -1;
+    off[n++] = base + __builtin_ctz(mask);
+    mask &= mask - 1;
+  }
+  return n;
+}
+
+__attribute__((target("sse2")))
+static int scan_sse2(const char *buf, int from, int len, char sep, int *off, int max) {
+  const __m128i vsep = _mm_set1_epi8(sep);
+  int n = 0;
+  int i = from;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vsep));
+    if ((n = push_mask(mask, i, off, n, max)) < 0) return max;
+  }
+  return n + scan_scalar(buf, i, len, sep, off + n, max - n);
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2(const char *buf, int from, int len, char sep, int *off, int max) {
+  const __m256i vsep = _mm256_set1_epi8(sep);
+  int n = 0;
+  int i = from;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (buf + i));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vsep));
+    if ((n = push_mask(mask, i, off, n, max)) < 0) return max;
+  }
+  return n + scan_scalar(buf, i, len, sep, off + n, max - n);
+}
+#endif
+
+typedef int (*scan_fn)(const char *, int, int, char, int *, int);
+static scan_fn scan_impl = NULL;
+
+static scan_fn pick_scan(void) {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return scan_avx2;
+  if (__builtin_cpu_supports("sse2")) return scan_sse2;
+#endif
+  return scan_scalar;
+}
+
+int scan_separators(const char *buf, int from, int len, char sep, int *off, int max) {
+  // Every thread picks the same function, a concurrent first call is harmless
+  scan_fn fn = __atomic_load_n(&scan_impl, __ATOMIC_RELAXED);
+  if (fn == NULL) {
+    fn = pick_scan();
+    __atomic_store_n(&scan_impl, fn, __ATOMIC_RELAXED);
+  }
+  if (max <= 0 || from >= len) return 0;
+  return fn(buf, from, len, sep, off, max);
+}
+
+void scan_init(struct scan_tokens *t, char *buf, char sep) {
+  t->buf = buf;
+  t->len = strlen(buf);
+  t->sep = sep;
+  t->start = 0;
+  t->from = 0;
+  t->n = 0;
+  t->i = 0;
+}
+
+char *scan_next(struct scan_tokens *t, int *len) {
+  while (t->start < t->len) {
+    int end;
+    if (t->i < t->n) {
+      end = t->off[t->i++];
+    } else if (t->from < t->len) {
+      t->n = scan_separators(t->buf, t->from, t->len, t->sep, t->off, SCAN_CHUNK);
+      t->i = 0;
+      t->from = t->n == SCAN_CHUNK ? t->off[SCAN_CHUNK - 1] + 1 : t->len;
+      continue;
+    } else {
+      end = t->len;
+    }
+
+    char *token = t->buf + t->start;
+    int l = end - t->start;
+    t->start = end + 1;
+    if (l == 0) continue; // Empty token, skipped like strtok_r()
+    t->buf[end] = '\0';
+    if (len != NULL) *len = l;
+    return token;
+  }
+  return NULL;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Value of 8 ASCII digits, the first one in the lowest byte
+static inline uint32_t parse_8digits(uint64_t v) {
+  v = (v & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+  v = (v & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+  return (uint32_t) ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32);
+}
+
+// Whether the 8 bytes are all ASCII digits
+static inline int all_digits(uint64_t v) {
+  return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+          (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+         0x3333333333333333ULL;
+}
+
+uint32_t parse_uint(const char *s, int len) {
+  if (len <= 0 || len > 10) return (uint32_t) strtoul(s, NULL, 10);
+
+  // Left pad with '0' up to a multiple of 8 digits
+  char digits[16];
+  int pad = (len > 8 ? 16 : 8) - len;
+  memset(digits, '0', pad);
+  memcpy(digits + pad, s, len);
+
+  uint64_t lo, hi;
+  memcpy(&lo, digits, 8);
+  if (len <= 8) {
+    if (!all_digits(lo)) return (uint32_t) strtoul(s, NULL, 10);
+    return parse_8digits(lo);
+  }
+  memcpy(&hi, digits + 8, 8);
+  if (!all_digits(lo) || !all_digits(hi)) return (uint32_t) strtoul(s, NULL, 10);
+  return (uint32_t) ((uint64_t) parse_8digits(lo) * 100000000ULL + parse_8digits(hi));
+}
+#else
+uint32_t parse_uint(const char *s, int len) {
+  (void) len;
+  return (uint32_t) strtoul(s, NULL, 10);
+}
+#endif
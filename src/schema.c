@@ -0,0 +1,101 @@
+#include "include/schema.h"
+
+// Builds a schema from its list of fields
+#define SCHEMA(...) { sizeof((uint8_t[]){ __VA_ARGS__ }), { __VA_ARGS__ } }
+#define OPT(f) ((f) | FIELD_OPTIONAL)
+
+// Fields carried by each message code, indexed by code
+static const struct message_schema schemas[256] = {
+  [CODE_VALIDATION]          = SCHEMA(FIELD_ID, FIELD_MESS, FIELD_SIG),
+  [CODE_CONSENSUS]           = SCHEMA(FIELD_ID, FIELD_MESS, FIELD_SIG),
+  [CODE_CONSENSUS_SUITE]     = SCHEMA(FIELD_ID),
+
+  [CODE_DEMANDE_LIAISON]     = { 0, { 0 } },
+  [CODE_REPONSE_LIAISON]     = SCHEMA(FIELD_ID, FIELD_IP, FIELD_PORT, OPT(FIELD_ENC), FIELD_CLE),
+  [CODE_INFO_PAIR]           = SCHEMA(FIELD_INFO, OPT(FIELD_INFO_ENC), FIELD_INFO_CLE, FIELD_DH,
+                                      FIELD_SIG),
+  [CODE_ID_ACCEPTED]         = { 0, { 0 } },
+  [CODE_ID_CHANGED]          = SCHEMA(FIELD_ID),
+  [CODE_INFO_PAIR_BROADCAST] = SCHEMA(FIELD_INFO, OPT(FIELD_INFO_ENC), FIELD_INFO_CLE, FIELD_ID, FIELD_SIG),
+  [CODE_INFO_SYSTEME]        = SCHEMA(FIELD_ID, FIELD_IP, FIELD_PORT, FIELD_NB, FIELD_INFO,
+                                      OPT(FIELD_INFO_ENC), FIELD_INFO_CLE, FIELD_DH, FIELD_GKEY,
+                                      FIELD_SIG),
+
+  [CODE_QUIT_SYSTEME]        = SCHEMA(FIELD_ID, OPT(FIELD_SIG)),
+
+  [CODE_NOUVELLE_VENTE]      = SCHEMA(FIELD_ID, OPT(FIELD_NUMV), FIELD_PRIX, FIELD_SIG),
+  [CODE_ENCHERE]             = SCHEMA(FIELD_ID, OPT(FIELD_NUMV), FIELD_PRIX, FIELD_MAC),
+  [CODE_ENCHERE_SUPERVISEUR] = SCHEMA(FIELD_ID, OPT(FIELD_NUMV), FIELD_PRIX, FIELD_MAC),
+  [CODE_FIN_VENTE_WARNING]   = SCHEMA(FIELD_ID, OPT(FIELD_NUMV), FIELD_PRIX),
+  [CODE_FIN_VENTE]           = SCHEMA(FIELD_ID, OPT(FIELD_NUMV), FIELD_PRIX),
+  [CODE_REFUS_CONCURRENT]    = SCHEMA(FIELD_ID),
+  [CODE_REFUS_PRIX]          = SCHEMA(FIELD_ID, OPT(FIELD_NUMV), FIELD_PRIX),
+  [CODE_ANNUL_SUPERVISEUR]   = SCHEMA(FIELD_ID, OPT(FIELD_NUMV)),
+  [CODE_ANNUL_DEMANDE]       = SCHEMA(FIELD_ID, OPT(FIELD_NUMV)),
+  [CODE_RETRAIT_PAIRS]       = SCHEMA(FIELD_ID),
+  [CODE_DEMANDE_CLE_GROUPE]  = SCHEMA(FIELD_ID, FIELD_NUMV, FIELD_DH, FIELD_SIG),
+  [CODE_CLE_GROUPE]          = SCHEMA(FIELD_ID, FIELD_NUMV, FIELD_DH, FIELD_GKEY, FIELD_SIG),
+};
+
+static const char *field_names[FIELD_COUNT] = {
+  [FIELD_ID]       = "ID",
+  [FIELD_MESS]     = "MESS",
+  [FIELD_SIG]      = "SIG",
+  [FIELD_IP]       = "IP",
+  [FIELD_PORT]     = "PORT",
+  [FIELD_ENC]      = "ENC",
+  [FIELD_NB]       = "NB",
+  [FIELD_INFO]     = "info",
+  [FIELD_INFO_ENC] = "info ENC",
+  [FIELD_CLE]      = "CLE",
+  [FIELD_INFO_CLE] = "info CLE",
+  [FIELD_DH]       = "DH",
+  [FIELD_GKEY]     = "GKEY",
+  [FIELD_MAC]      = "MAC",
+  [FIELD_NUMV]     = "NUMV",
+  [FIELD_PRIX]     = "PRIX",
+};
+
+const struct message_schema *message_schema(uint8_t code) {
+  return &schemas[code];
+}
+
+const char *field_name(int field) {
+  field = FIELD_TYPE(field);
+  if (field <= 0 || field >= FIELD_COUNT) return "?";
+  return field_names[field];
+}
+
+int message_field_blob(struct message *msg, int field, struct field_blob *blob) {
+  switch (FIELD_TYPE(field)) {
+    case FIELD_DH:
+      *blob = (struct field_blob) { msg->dh, &msg->ldh, sizeof(msg->dh) };
+      return 0;
+    case FIELD_GKEY:
+      *blob = (struct field_blob) { msg->gkey, &msg->lgkey, sizeof(msg->gkey) };
+      return 0;
+    case FIELD_MAC:
+      *blob = (struct field_blob) { msg->mac, &msg->lmac, sizeof(msg->mac) };
+      return 0;
+  }
+  return -1;
+}
+
+int schema_has_field(uint8_t code, int field) {
+  const struct message_schema *schema = &schemas[code];
+  for (int i = 0; i < schema->count; i++) {
+    if (FIELD_TYPE(schema->fields[i]) == FIELD_TYPE(field)) return 1;
+  }
+  return 0;
+}
+
+int message_info_count(const struct message *msg) {
+  const struct message_schema *schema = &schemas[msg->code];
+  int count = 0;
+  for (int i = 0; i < schema->count; i++) {
+    int field = FIELD_TYPE(schema->fields[i]);
+    if (field == FIELD_NB) return msg->nb;
+    if (field == FIELD_INFO) count = 1;
+  }
+  return count;
+}
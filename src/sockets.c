@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // recvmmsg(), sendmmsg()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,7 +8,9 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <net/if.h>
+#include <ifaddrs.h>
 #include "include/sockets.h"
+#include "include/uring.h"
 #include <asm-generic/socket.h>
 
 int setup_sock_opt(int sock) {
@@ -27,7 +30,73 @@ int setup_sock_opt(int sock) {
   return 0;
 }
 
-int setup_multicast_receiver(const char *addr, int port) {
+static unsigned int if_index = 0;   // Interface of the multicast groups and link-local peers
+static int if_chosen = 0;           // if_index was set or detected
+
+int sockets_set_interface(const char *name) {
+  unsigned int index = if_nametoindex(name);
+  if (index == 0) {
+    fprintf(stderr, "Interface réseau inconnue: %s\n", name);
+    return -1;
+  }
+  if_index = index;
+  if_chosen = 1;
+  return 0;
+}
+
+// First interface up, able to multicast and having an IPv6 address
+static unsigned int detect_interface(void) {
+  struct ifaddrs *list;
+  if (getifaddrs(&list) < 0) {
+    perror("getifaddrs a échoué");
+    return 0;
+  }
+  unsigned int index = 0;
+  for (struct ifaddrs *ifa = list; ifa != NULL && index == 0; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET6) continue;
+    if ((ifa->ifa_flags & (IFF_UP | IFF_MULTICAST)) != (IFF_UP | IFF_MULTICAST)) continue;
+    if (ifa->ifa_flags & IFF_LOOPBACK) continue;
+    index = if_nametoindex(ifa->ifa_name);
+  }
+  freeifaddrs(list);
+  return index;
+}
+
+unsigned int sockets_interface(void) {
+  if (!if_chosen) {
+    // 0 if none: the kernel chooses from the routes
+    if_index = detect_interface();
+    if_chosen = 1;
+  }
+  return if_index;
+}
+
+void endpoint_set_in6(struct endpoint *ep, const struct in6_addr *ip, int port) {
+  memset(&ep->addr, 0, sizeof(ep->addr));
+  ep->addr.sin6_family = AF_INET6;
+  ep->addr.sin6_port = htons(port);
+  ep->addr.sin6_addr = *ip;
+  // Only these addresses need to be told which interface they are on
+  if (IN6_IS_ADDR_LINKLOCAL(ip) || IN6_IS_ADDR_MC_LINKLOCAL(ip) || IN6_IS_ADDR_MC_NODELOCAL(ip)) {
+    ep->addr.sin6_scope_id = sockets_interface();
+  }
+}
+
+int endpoint_set(struct endpoint *ep, const char *addr, int port) {
+  struct in6_addr ip;
+  if (inet_pton(AF_INET6, addr, &ip) <= 0) {
+    fprintf(stderr, "Adresse IPv6 invalide: %s\n", addr);
+    return -1;
+  }
+  endpoint_set_in6(ep, &ip, port);
+  return 0;
+}
+
+int endpoint_port(const struct endpoint *ep) {
+  return ntohs(ep->addr.sin6_port);
+}
+
+int setup_multicast_receiver(const struct endpoint *group_ep) {
   int sock = socket(AF_INET6, SOCK_DGRAM, 0);
   if (sock < 0) {
     perror("création du socket a échoué");
@@ -44,7 +113,7 @@ int setup_multicast_receiver(const char *addr, int port) {
   memset(&s_addr, 0, sizeof(s_addr));
   s_addr.sin6_family = AF_INET6;
   s_addr.sin6_addr = in6addr_any;
-  s_addr.sin6_port = htons(port);
+  s_addr.sin6_port = group_ep->addr.sin6_port;
 
   // Bind the socket
   if (bind(sock, (struct sockaddr*)&s_addr, sizeof(s_addr)) < 0) {
@@ -56,17 +125,8 @@ int setup_multicast_receiver(const char *addr, int port) {
   // Join the multicast group
   struct ipv6_mreq group;
   memset(&group, 0, sizeof(group));
-  if (inet_pton(AF_INET6, addr, &group.ipv6mr_multiaddr) <= 0) {
-    perror("inet_pton a échoué");
-    close(sock);
-    return -1;
-  }
-  group.ipv6mr_interface = if_nametoindex("eth0");
-  if (group.ipv6mr_interface == 0) {
-    perror("Impossible de trouver une interface réseau valide");
-    close(sock);
-    return -1;
-  }
+  group.ipv6mr_multiaddr = group_ep->addr.sin6_addr;
+  group.ipv6mr_interface = sockets_interface();
 
   if (setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &group, sizeof(group)) < 0) {
     perror("setsockopt(IPV6_JOIN_GROUP) a échoué");
@@ -89,6 +149,14 @@ int setup_multicast_sender() {
     return -1;
   }
 
+  // Same interface as the groups joined
+  unsigned int index = sockets_interface();
+  if (index != 0 && setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof(index)) < 0) {
+    perror("setsockopt(IPV6_MULTICAST_IF) a échoué");
+    close(sock);
+    return -1;
+  }
+
   return sock;
 }
 
@@ -122,7 +190,7 @@ int setup_unicast_receiver(int port) {
   return sock;
 }
 
-int setup_unicast_sender(const char *s_addr, int port) {
+int setup_unicast_sender(const struct endpoint *dest) {
   // Socket pour envoyer les réponses unicast
   int sock = socket(AF_INET6, SOCK_DGRAM, 0);
   if (sock < 0) {
@@ -130,22 +198,17 @@ int setup_unicast_sender(const char *s_addr, int port) {
     return -1;
   }
 
-  struct sockaddr_in6 addr;
-  memset(&addr, 0, sizeof(addr));
-  addr.sin6_family = AF_INET6;
-  if (inet_pton(AF_INET6, s_addr, &addr.sin6_addr) < 0) {
-    perror("inet_pton a échoué");
+  // Options pour réutiliser l'adresse/port
+  if (setup_sock_opt(sock) < 0) {
     close(sock);
     return -1;
   }
-  addr.sin6_port = htons(port);
-
-  // Options pour réutiliser l'adresse/port
-  if (setup_sock_opt(sock) < 0) {
+  // Destination fixée une fois pour toutes, send() suffit ensuite
+  if (connect(sock, (const struct sockaddr *) &dest->addr, sizeof(dest->addr)) < 0) {
+    perror("connect a échoué (unicast)");
     close(sock);
     return -1;
   }
-  // printf("  Socket unicast UDP configuré pour l'envoie ADDR: %s  IP: %d\n", s_addr, port);
   return sock;
 }
 
@@ -185,56 +248,51 @@ int setup_server_socket(int port) {
   return sock;
 }
 
-int setup_client_socket(const char *addr, int port) {
+int setup_client_socket(const struct endpoint *ep) {
   int sock = socket(AF_INET6, SOCK_STREAM, 0);
   if (sock < 0) {
     perror("création du socket a échoué");
     return -1;
   }
 
-  struct sockaddr_in6 s_addr;
-  memset(&s_addr, 0, sizeof(s_addr));
-  s_addr.sin6_family = AF_INET6;
-  s_addr.sin6_port = htons(port);
-  s_addr.sin6_scope_id = if_nametoindex("eth0");
-
-  // Gérer l'adresse IPv6 et l'interface si nécessaire
-  char addr_copy[INET6_ADDRSTRLEN];
-  strncpy(addr_copy, addr, sizeof(addr_copy) - 1);
-  addr_copy[sizeof(addr_copy) - 1] = '\0';
+  // Options pour réutiliser l'adresse/port
+  if (setup_sock_opt(sock) < 0) {
+    close(sock);
+    return -1;
+  }
 
-  if (inet_pton(AF_INET6, addr_copy, &s_addr.sin6_addr) <= 0) {
-    perror("inet_pton a échoué");
+  if (connect(sock, (const struct sockaddr*)&ep->addr, sizeof(ep->addr)) < 0) {
+    perror("connect a échoué");
+    printf("Erreur: %d (%s)\n", errno, strerror(errno));
     close(sock);
     return -1;
   }
+  return sock;
+}
+
+int setup_client_socket_nowait(const struct endpoint *ep) {
+  int sock = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (sock < 0) {
+    perror("création du socket a échoué");
+    return -1;
+  }
 
-  // Options pour réutiliser l'adresse/port
   if (setup_sock_opt(sock) < 0) {
     close(sock);
     return -1;
   }
 
-  if (connect(sock, (struct sockaddr*)&s_addr, sizeof(s_addr)) < 0) {
+  // The connection goes on in the background, the socket becomes writable once done
+  if (connect(sock, (const struct sockaddr*)&ep->addr, sizeof(ep->addr)) < 0 && errno != EINPROGRESS) {
     perror("connect a échoué");
-    printf("Erreur: %d (%s)\n", errno, strerror(errno));
     close(sock);
     return -1;
   }
-  // printf("  Socket client TCP connecté à %s:%d\n", addr, port);
   return sock;
 }
 
-int send_multicast(int sock, const char *addr, int port, const void *data, size_t len) {
-  struct sockaddr_in6 dest;
-  memset(&dest, 0, sizeof(dest));
-  dest.sin6_family = AF_INET6;
-  dest.sin6_port = htons(port);
-  if (inet_pton(AF_INET6, addr, &dest.sin6_addr) <= 0) {
-    perror("inet_pton a échoué");
-    return -1;
-  }
-  if (sendto(sock, data, len, 0, (struct sockaddr*)&dest, sizeof(dest)) < 0) {
+int send_multicast(int sock, const struct endpoint *dest, const void *data, size_t len) {
+  if (sendto(sock, data, len, 0, (const struct sockaddr*)&dest->addr, sizeof(dest->addr)) < 0) {
     perror("sendto a échoué");
     return -1;
   }
@@ -259,3 +317,97 @@ int receive_multicast(int sock, char *buffer, size_t buffer_size, struct sockadd
 
   return received;
 }
+
+int receive_multicast_nowait(int sock, char *buffer, size_t buffer_size, struct sockaddr_in6 *sender_addr) {
+  socklen_t sender_len = sizeof(*sender_addr);
+
+  int received = recvfrom(sock, buffer, buffer_size, MSG_DONTWAIT, (struct sockaddr*)sender_addr, &sender_len);
+  if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    perror("recvfrom a échoué");
+  }
+  return received < 0 ? -1 : received;
+}
+
+static int backend = SOCKETS_CLASSIC;
+
+int sockets_set_backend(int which) {
+  if (which == SOCKETS_URING && uring_init() < 0) {
+    return -1;
+  }
+  if (which == SOCKETS_CLASSIC) uring_cleanup();
+  backend = which;
+  return 0;
+}
+
+int sockets_receive_fd(int sock) {
+  if (backend == SOCKETS_URING) {
+    int fd = uring_receive_start(sock);
+    if (fd >= 0) return fd;
+    fprintf(stderr, "io_uring indisponible pour le socket %d, recvmmsg utilisé\n", sock);
+  }
+  return sock;
+}
+
+void sockets_cleanup(void) {
+  uring_cleanup();
+}
+
+int send_multicast_batch(int sock, const struct endpoint *dest, const struct datagram *d, int count) {
+  if (backend == SOCKETS_URING && uring_sending()) {
+    return uring_send_batch(sock, &dest->addr, d, count);
+  }
+
+  struct mmsghdr msgs[count];
+  struct iovec iov[count];
+  memset(msgs, 0, sizeof(msgs));
+  for (int i = 0; i < count; i++) {
+    iov[i].iov_base = (void *) d[i].data;
+    iov[i].iov_len = d[i].len;
+    msgs[i].msg_hdr.msg_name = (void *) &dest->addr;
+    msgs[i].msg_hdr.msg_namelen = sizeof(dest->addr);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int ret = 0;
+  int sent = 0;
+  while (sent < count) {
+    int n = sendmmsg(sock, msgs + sent, count - sent, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // The first datagram left failed, the next ones may still go
+      perror("sendmmsg a échoué");
+      ret = -1;
+      n = 1;
+    }
+    sent += n;
+  }
+  return ret;
+}
+
+int receive_multicast_batch(int sock, char *buffers, size_t buffer_size, int count,
+                            int *lens, struct sockaddr_in6 *senders) {
+  if (uring_receiving(sock)) {
+    return uring_receive_batch(sock, buffers, buffer_size, count, lens, senders);
+  }
+
+  struct mmsghdr msgs[count];
+  struct iovec iov[count];
+  memset(msgs, 0, sizeof(msgs));
+  for (int i = 0; i < count; i++) {
+    iov[i].iov_base = buffers + i * buffer_size;
+    iov[i].iov_len = buffer_size;
+    msgs[i].msg_hdr.msg_name = &senders[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int received = recvmmsg(sock, msgs, count, MSG_WAITFORONE, NULL);
+  if (received < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) perror("recvmmsg a échoué");
+    return -1;
+  }
+  for (int i = 0; i < received; i++) lens[i] = msgs[i].msg_len;
+  return received;
+}
@@ -0,0 +1,134 @@
+#include "include/stream.h"
+#include "include/binary.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+int stream_init(struct stream *s, int sock) {
+  s->sock = sock;
+  s->cap = UNKNOWN_SIZE;
+  s->start = 0;
+  s->end = 0;
+  s->buf = malloc(s->cap);
+  if (s->buf == NULL) {
+    perror("malloc a échoué (stream)");
+    return -1;
+  }
+  s->buf[0] = '\0';
+  return 0;
+}
+
+void stream_free(struct stream *s) {
+  free(s->buf);
+  s->buf = NULL;
+}
+
+// Make room for at least need bytes after the data not consumed yet
+static int stream_reserve(struct stream *s, int need) {
+  if (s->start > 0) {
+    memmove(s->buf, s->buf + s->start, s->end - s->start);
+    s->end -= s->start;
+    s->start = 0;
+  }
+  // One more byte for the '\0' put after the data
+  if (s->end + need + 1 <= s->cap) return 0;
+
+  int cap = s->cap;
+  while (cap < s->end + need + 1) cap *= 2;
+  char *buf = realloc(s->buf, cap);
+  if (buf == NULL) {
+    perror("realloc a échoué (stream)");
+    return -1;
+  }
+  s->buf = buf;
+  s->cap = cap;
+  return 0;
+}
+
+int stream_fill(struct stream *s) {
+  if (s->end + 1 >= s->cap || s->start > 0) {
+    if (stream_reserve(s, UNKNOWN_SIZE / 2) < 0) return -1;
+  }
+  int len = recv(s->sock, s->buf + s->end, s->cap - s->end - 1, 0);
+  if (len < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) perror("recv a échoué (stream)");
+    return -1;
+  }
+  s->end += len;
+  s->buf[s->end] = '\0';
+  return len;
+}
+
+int stream_pop(struct stream *s, char **msg, int *len) {
+  int avail = s->end - s->start;
+  if (avail <= 0) return 0;
+  char *p = s->buf + s->start;
+
+  if (p[0] == 0) {
+    // Length-prefixed frame
+    if (avail < STREAM_HEADER_SIZE) return 0;
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    n = ntohl(n);
+    if (n == 0 || n > STREAM_MAX_FRAME) {
+      fprintf(stderr, "Erreur: trame invalide (%u octets)\n", n);
+      return -1;
+    }
+    if ((uint32_t) avail - STREAM_HEADER_SIZE < n) {
+      // Grow now so that the next reads can hold the whole frame
+      if (stream_reserve(s, STREAM_HEADER_SIZE + n - avail) < 0) return -1;
+      return 0;
+    }
+    // The next frame starts with 0, or the buffer ends with '\0'
+    *msg = p + STREAM_HEADER_SIZE;
+    *len = n;
+    s->start += STREAM_HEADER_SIZE + n;
+    return 1;
+  }
+
+  // Unframed message: up to its '\0', or everything received so far
+  int n = avail;
+  if (!is_binary_buffer(p, avail)) {
+    char *nul = memchr(p, '\0', avail);
+    if (nul != NULL) n = nul - p + 1;
+  }
+  *msg = p;
+  *len = n;
+  s->start += n;
+  return 1;
+}
+
+int stream_read(struct stream *s, char **msg, int *len) {
+  for (;;) {
+    int ret = stream_pop(s, msg, len);
+    if (ret != 0) return ret;
+    ret = stream_fill(s);
+    if (ret <= 0) return ret;
+  }
+}
+
+int stream_send(int sock, const void *data, int len, int framed) {
+  if (framed) {
+    uint32_t n = htonl(len);
+    if (send(sock, &n, sizeof(n), MSG_MORE) != sizeof(n)) {
+      perror("send a échoué (stream)");
+      return -1;
+    }
+  }
+  const char *p = data;
+  while (len > 0) {
+    int sent = send(sock, p, len, 0);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      perror("send a échoué (stream)");
+      return -1;
+    }
+    p += sent;
+    len -= sent;
+  }
+  return 0;
+}
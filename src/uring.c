@@ -0,0 +1,365 @@
+#include "include/uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**
+ * A ring mapped in our memory
+ */
+struct uring {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  unsigned sq_entries;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+};
+
+/**
+ * A socket received through a multishot recvmsg
+ */
+struct uring_receiver {
+  int sock;
+  struct uring ring;
+  struct io_uring_buf_ring *br; // Buffers given to the kernel
+  unsigned short br_tail;       // Next slot of br to fill
+  unsigned char *bufs;          // URING_BUFFERS buffers of URING_BUFFER_SIZE bytes
+  struct msghdr msg;            // Layout of each buffer
+};
+
+static struct uring send_ring = { .fd = -1 };
+static pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct uring_receiver *receivers[URING_RECEIVERS];
+
+static int ring_setup(struct uring *r, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(r, 0, sizeof(*r));
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) {
+    perror("io_uring_setup a échoué");
+    return -1;
+  }
+
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  int single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single && r->cq_size > r->sq_size) r->sq_size = r->cq_size;
+
+  r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ptr == MAP_FAILED) goto fail;
+  if (single) {
+    r->cq_ptr = r->sq_ptr;
+  } else {
+    r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) goto fail;
+  }
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) goto fail;
+
+  unsigned char *sq = r->sq_ptr;
+  unsigned char *cq = r->cq_ptr;
+  r->sq_head = (unsigned *) (sq + p.sq_off.head);
+  r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *) (sq + p.sq_off.array);
+  r->sq_entries = p.sq_entries;
+  r->cq_head = (unsigned *) (cq + p.cq_off.head);
+  r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  return 0;
+
+fail:
+  perror("mmap a échoué (io_uring)");
+  if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_size);
+  if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+  close(r->fd);
+  r->fd = -1;
+  return -1;
+}
+
+static void ring_free(struct uring *r) {
+  if (r->fd < 0) return;
+  munmap(r->sqes, r->sqes_size);
+  if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+  munmap(r->sq_ptr, r->sq_size);
+  close(r->fd);
+  r->fd = -1;
+}
+
+// Next free request, NULL if the submission queue is full
+static struct io_uring_sqe *ring_get_sqe(struct uring *r) {
+  unsigned tail = *r->sq_tail;
+  unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head >= r->sq_entries) return NULL;
+  unsigned idx = tail & *r->sq_mask;
+  r->sq_array[idx] = idx;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+static int ring_enter(struct uring *r, unsigned submit, unsigned wait) {
+  for (;;) {
+    int ret = syscall(__NR_io_uring_enter, r->fd, submit, wait,
+                      wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret >= 0) return ret;
+    if (errno != EINTR) {
+      perror("io_uring_enter a échoué");
+      return -1;
+    }
+  }
+}
+
+// Next completion, NULL if there is none
+static struct io_uring_cqe *ring_peek_cqe(struct uring *r) {
+  unsigned head = *r->cq_head;
+  if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+  return &r->cqes[head & *r->cq_mask];
+}
+
+static void ring_cqe_seen(struct uring *r) {
+  __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_init(void) {
+  if (send_ring.fd >= 0) return 0;
+  return ring_setup(&send_ring, URING_ENTRIES);
+}
+
+void uring_cleanup(void) {
+  pthread_mutex_lock(&send_mutex);
+  ring_free(&send_ring);
+  pthread_mutex_unlock(&send_mutex);
+  for (int i = 0; i < URING_RECEIVERS; i++) {
+    struct uring_receiver *rc = receivers[i];
+    if (rc == NULL) continue;
+    ring_free(&rc->ring); // Cancels the recvmsg and the buffer ring
+    munmap(rc->br, URING_BUFFERS * sizeof(struct io_uring_buf));
+    free(rc->bufs);
+    free(rc);
+    receivers[i] = NULL;
+  }
+}
+
+int uring_send_batch(int sock, const struct sockaddr_in6 *dest, const struct datagram *d, int count) {
+  int ret = 0;
+  pthread_mutex_lock(&send_mutex);
+  if (send_ring.fd < 0) {
+    pthread_mutex_unlock(&send_mutex);
+    return -1;
+  }
+
+  while (count > 0) {
+    int n = count < URING_ENTRIES ? count : URING_ENTRIES;
+    struct msghdr msgs[n];
+    struct iovec iov[n];
+    memset(msgs, 0, sizeof(msgs));
+    int queued = 0;
+    for (int i = 0; i < n; i++) {
+      struct io_uring_sqe *sqe = ring_get_sqe(&send_ring);
+      if (sqe == NULL) break;
+      iov[i].iov_base = (void *) d[i].data;
+      iov[i].iov_len = d[i].len;
+      msgs[i].msg_name = (void *) dest;
+      msgs[i].msg_namelen = sizeof(*dest);
+      msgs[i].msg_iov = &iov[i];
+      msgs[i].msg_iovlen = 1;
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->fd = sock;
+      sqe->addr = (unsigned long) &msgs[i];
+      sqe->len = 1;
+      sqe->user_data = i;
+      queued++;
+    }
+
+    // Submit and wait in the same call: the buffers are ours again after it
+    if (ring_enter(&send_ring, queued, queued) < 0) {
+      // The requests may still point to msgs: never submit them later
+      ring_free(&send_ring);
+      ret = -1;
+      break;
+    }
+    for (int done = 0; done < queued; ) {
+      struct io_uring_cqe *cqe = ring_peek_cqe(&send_ring);
+      if (cqe == NULL) {
+        if (ring_enter(&send_ring, 0, 1) < 0) {
+          ring_free(&send_ring);
+          pthread_mutex_unlock(&send_mutex);
+          return -1;
+        }
+        continue;
+      }
+      if (cqe->res < 0) {
+        fprintf(stderr, "sendmsg a échoué (io_uring): %s\n", strerror(-cqe->res));
+        ret = -1;
+      }
+      ring_cqe_seen(&send_ring);
+      done++;
+    }
+    d += queued;
+    count -= queued;
+    if (queued == 0) break;
+  }
+  pthread_mutex_unlock(&send_mutex);
+  return ret;
+}
+
+int uring_sending(void) {
+  pthread_mutex_lock(&send_mutex);
+  int ok = send_ring.fd >= 0;
+  pthread_mutex_unlock(&send_mutex);
+  return ok;
+}
+
+static struct uring_receiver *find_receiver(int sock) {
+  for (int i = 0; i < URING_RECEIVERS; i++) {
+    if (receivers[i] != NULL && receivers[i]->sock == sock) return receivers[i];
+  }
+  return NULL;
+}
+
+// Give a buffer back to the kernel
+static void give_buffer(struct uring_receiver *rc, unsigned short bid) {
+  struct io_uring_buf *buf = &rc->br->bufs[rc->br_tail & (URING_BUFFERS - 1)];
+  buf->addr = (unsigned long) (rc->bufs + (size_t) bid * URING_BUFFER_SIZE);
+  buf->len = URING_BUFFER_SIZE;
+  buf->bid = bid;
+  rc->br_tail++;
+  __atomic_store_n(&rc->br->tail, rc->br_tail, __ATOMIC_RELEASE);
+}
+
+// Queue the multishot recvmsg, again after the kernel ended it
+static int arm_receive(struct uring_receiver *rc) {
+  struct io_uring_sqe *sqe = ring_get_sqe(&rc->ring);
+  if (sqe == NULL) return -1;
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = rc->sock;
+  sqe->addr = (unsigned long) &rc->msg;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = rc->sock;
+  return ring_enter(&rc->ring, 1, 0) < 0 ? -1 : 0;
+}
+
+int uring_receive_start(int sock) {
+  struct uring_receiver *rc = find_receiver(sock);
+  if (rc != NULL) return rc->ring.fd;
+
+  int slot = 0;
+  while (slot < URING_RECEIVERS && receivers[slot] != NULL) slot++;
+  if (slot == URING_RECEIVERS) {
+    fprintf(stderr, "Erreur: trop de sockets reçus par io_uring\n");
+    return -1;
+  }
+
+  rc = calloc(1, sizeof(struct uring_receiver));
+  if (rc == NULL) {
+    perror("malloc a échoué (io_uring)");
+    return -1;
+  }
+  rc->sock = sock;
+  if (ring_setup(&rc->ring, URING_ENTRIES) < 0) {
+    free(rc);
+    return -1;
+  }
+  rc->bufs = malloc((size_t) URING_BUFFERS * URING_BUFFER_SIZE);
+  rc->br = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (rc->bufs == NULL || rc->br == MAP_FAILED) {
+    perror("allocation des tampons a échoué (io_uring)");
+    goto fail;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long) rc->br;
+  reg.ring_entries = URING_BUFFERS;
+  reg.bgid = 0;
+  if (syscall(__NR_io_uring_register, rc->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    perror("io_uring_register a échoué (tampons)");
+    goto fail;
+  }
+  for (int i = 0; i < URING_BUFFERS; i++) give_buffer(rc, i);
+
+  // Each buffer holds the recvmsg header, the sender address, then the datagram
+  rc->msg.msg_namelen = sizeof(struct sockaddr_in6);
+  rc->msg.msg_controllen = 0;
+  if (arm_receive(rc) < 0) goto fail;
+
+  receivers[slot] = rc;
+  return rc->ring.fd;
+
+fail:
+  ring_free(&rc->ring);
+  if (rc->br != NULL && rc->br != MAP_FAILED) munmap(rc->br, URING_BUFFERS * sizeof(struct io_uring_buf));
+  free(rc->bufs);
+  free(rc);
+  return -1;
+}
+
+int uring_receiving(int sock) {
+  return find_receiver(sock) != NULL;
+}
+
+int uring_receive_batch(int sock, char *buffers, size_t buffer_size, int count,
+                        int *lens, struct sockaddr_in6 *senders) {
+  struct uring_receiver *rc = find_receiver(sock);
+  if (rc == NULL) return -1;
+
+  int received = 0;
+  int rearm = 0;
+  struct io_uring_cqe *cqe;
+  while (received < count && (cqe = ring_peek_cqe(&rc->ring)) != NULL) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) rearm = 1;
+    if (cqe->res < 0) {
+      // -ENOBUFS: every buffer was in use, the request ended
+      if (cqe->res != -ENOBUFS) fprintf(stderr, "recvmsg a échoué (io_uring): %s\n", strerror(-cqe->res));
+      ring_cqe_seen(&rc->ring);
+      continue;
+    }
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+      ring_cqe_seen(&rc->ring);
+      continue;
+    }
+
+    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned char *buf = rc->bufs + (size_t) bid * URING_BUFFER_SIZE;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buf;
+    size_t header = sizeof(*out) + rc->msg.msg_namelen + rc->msg.msg_controllen;
+    if ((size_t) cqe->res >= header) {
+      size_t len = cqe->res - header;
+      if (len > buffer_size) len = buffer_size;
+      memcpy(buffers + received * buffer_size, buf + header, len);
+      memset(&senders[received], 0, sizeof(senders[received]));
+      size_t namelen = out->namelen < sizeof(senders[received]) ? out->namelen : sizeof(senders[received]);
+      memcpy(&senders[received], buf + sizeof(*out), namelen);
+      lens[received] = len;
+      received++;
+    }
+    give_buffer(rc, bid);
+    ring_cqe_seen(&rc->ring);
+  }
+
+  if (rearm && arm_receive(rc) < 0) {
+    fprintf(stderr, "Erreur: réception io_uring interrompue (socket %d)\n", sock);
+  }
+  return received > 0 ? received : -1;
+}
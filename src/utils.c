@@ -1,4 +1,8 @@
 #include "include/utils.h"
+#include "include/binary.h"
+#include "include/schema.h"
+#include "include/pool.h"
+#include "include/scan.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -92,83 +96,6 @@ int generate_ed25519_key(char* public_key_name, char* private_key_name){
 	return ret;
 }
 
-int sign(EVP_PKEY *privkey, unsigned char *msg, unsigned char **sig, size_t *slen) {
-	EVP_MD_CTX *mdctx = NULL;
-	int ret = 0, msg_len = strlen((char *) msg);
-	
-	*sig = NULL;
-
-	/* crée le Message Digest Context */
-	if(!(mdctx = EVP_MD_CTX_create())){
-		fprintf(stderr, "erreur EVP_MD_CTX_create\n");
-		goto err;
-	}
-
-	/* initialise l'operation DigestSign (hachage avec signature) 
-	 * avec la clé privée.
-	 * 3eme param (fonction de hachage) doit être NULL pour une clé ED25519
-	 * puisque celle-ci utilise SHA-512 (pas de choix) 
-	 * si RSA, fonction de hachage peut être EVP_sha256() */
-	if(1 != EVP_DigestSignInit(mdctx, NULL, NULL, NULL, privkey)){
-		fprintf(stderr, "erreur EVP_DigestSignInit\n");
-		goto err;
-	} 
-	
-	/* appel une 1ère fois de EVP_DigestSign avec le paramètre 
-	 * sig à NULL afin d'obtenir la longueur de la signature */
-	if(1 != EVP_DigestSign(mdctx, NULL, slen, msg, msg_len)) {
-		fprintf(stderr, "erreur EVP_DigestSign\n");
-		goto err;
-	} 
-
-	/* alloue la mémoire pour la signature */ 
-	if(!(*sig = malloc(sizeof(unsigned char) * (*slen)))) {
-		fprintf(stderr, "erreur malloc\n");
-		goto err;
-	} 
-
-	/* obtention de la signature */
-	if(1 != EVP_DigestSign(mdctx, *sig, slen, msg, msg_len)) {
-		fprintf(stderr, "erreur EVP_DigestSign\n");
-		goto err;
-	} 
-
-	/* Succès */
-	ret = 1;
-	printf("message : %s\n", msg);
-	EVP_MD_CTX_free(mdctx);
-	return 1;
- 
- err:
-	if(ret != 1)
-		fprintf(stderr, "erreur dans sign()\n");
-		 
-	/* nettoyage mémoire */
-	if(*sig && !ret) OPENSSL_free(*sig); // = free(*sig);
-	if(mdctx) EVP_MD_CTX_free(mdctx); //EVP_MD_CTX_destroy(mdctx);
-
-	return 0;
-}
-
-int verify(EVP_PKEY *pubkey, unsigned char *msg, unsigned char *sig, size_t slen) {
-	EVP_MD_CTX *mdctx;
-	int ret = -1;
-	
-	if(!(mdctx = EVP_MD_CTX_create()))  return 0; //erreur
-
-	if(1 != EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pubkey)) {
-		perror("erreur EVP_DigestVerifyInit");
-	}
-
-	if(1 == EVP_DigestVerify(mdctx, sig, slen, msg, strlen((char *) msg)))
-		printf("signature ok\n");
-	else {
-		printf("document corrompu\n");
-		return 0;
-	}	
-	return ret;
-}
-
 int nbDigits (int n) {
   if (n == 0) return 1;
   int count = 0;
@@ -179,62 +106,137 @@ int nbDigits (int n) {
   return count;
 }
 
-int get_buffer_size(struct message *msg) {
-  if (msg == NULL) {
-    perror("Error: msg is NULL");
-    return -1;
+// Number of digits of an unsigned 32 bits value (NUMV and PRIX)
+static int nbDigits_u32(uint32_t n) {
+  int count = 1;
+  while (n >= 10) {
+    n /= 10;
+    count++;
   }
+  return count;
+}
 
-  int size = 0;
-  // Calculate the size of the resulting buffer
-  size += nbDigits(msg->code); // For CODE (max 3 digits)
-  if (msg->code != CODE_DEMANDE_LIAISON && msg->code != CODE_ID_ACCEPTED &&
-       msg->code != CODE_INFO_PAIR_BROADCAST && msg->code != CODE_INFO_PAIR) {
-    size += nbDigits(msg->id) + sizeof(char); // For ID (max 10 digits) + separator
-  }
+// Length of the base64 form of a signature
+#define BASE64_LEN(n) (4 * (((n) + 2) / 3))
 
-  if (msg->code == CODE_VALIDATION || msg->code == CODE_CONSENSUS) {
-    size += nbDigits(msg->lmess) + sizeof(char); // For LMESS (max 5 digits) + separator
-    size += msg->lmess + sizeof(char); // For MESS + separator
-    size += nbDigits(msg->lsig) + sizeof(char); // For LSIG (max 5 digits) + separator
-    if (msg->lsig > 0) {
-      size += msg->lsig + sizeof(char); // For SIG + separator
-    }
-  }
+// Text placeholder for a missing key, empty tokens are skipped by the parser
+#define NO_KEY "-"
 
-  if (msg->code == CODE_REPONSE_LIAISON || msg->code == CODE_INFO_SYSTEME) {
-    // For IP address (16 bytes for IPv6) + separator
-    size += INET6_ADDRSTRLEN + sizeof(char);
-    size += nbDigits(msg->port) + sizeof(char); // For PORT (max 5 digits) + separator
-  }
+// Text form of a public key
+static const char *key_text(const char *cle) {
+  return cle[0] != '\0' ? cle : NO_KEY;
+}
 
-  if (msg->code == CODE_INFO_PAIR || msg->code == CODE_INFO_PAIR_BROADCAST || msg->code == CODE_INFO_SYSTEME) {
-    int max = 1;
-    if (msg->code == CODE_INFO_SYSTEME) {
-      max = msg->nb;
-      size += nbDigits(max) + sizeof(char); // For NB (max 10 digits) + separator
-    }
-    for (int i = 0; i < max; i++) {
-      size += nbDigits(msg->info[i].id) + sizeof(char); // For ID in info
-      size += INET6_ADDRSTRLEN + sizeof(char); // For IP in info
-      size += nbDigits(msg->info[i].port) + sizeof(char); // For PORT in info
-      size += strlen(msg->info[i].cle) + sizeof(char); // For cle in info
-    }
+// Decode a base64 token over itself, returns the number of bytes or -1
+static int base64_decode_in_place(char *token, int len) {
+  unsigned char raw[UINT8_MAX + 3];
+  if (len % 4 != 0 || len / 4 * 3 > (int) sizeof(raw)) return -1;
+  int n = EVP_DecodeBlock(raw, (unsigned char *) token, len);
+  if (n < 0) return -1;
+  // The decoded length counts the padding
+  for (int i = len - 1; i >= 0 && token[i] == '='; i--) n--;
+  memcpy(token, raw, n);
+  return n;
+}
+
+// Length of the text form of an IPv6 address
+static int ip_text_len(const struct in6_addr *ip) {
+  char ip_str[INET6_ADDRSTRLEN];
+  if (inet_ntop(AF_INET6, ip, ip_str, sizeof(ip_str)) == NULL) return 0;
+  return strlen(ip_str);
+}
+
+int get_buffer_size(struct message *msg) {
+  if (msg == NULL) {
+    perror("Error: msg is NULL");
+    return -1;
   }
 
-  if (msg->code == CODE_NOUVELLE_VENTE || msg->code == CODE_ENCHERE ||
-      msg->code == CODE_ENCHERE_SUPERVISEUR || msg->code == CODE_FIN_VENTE_WARNING ||
-      msg->code == CODE_FIN_VENTE || msg->code == CODE_REFUS_PRIX) {
-    size += nbDigits(msg->numv) + sizeof(char); // For NUMV + separator
-    size += nbDigits(msg->prix) + sizeof(char); // For PRIX + separator
-  } else if (msg->code == CODE_ANNUL_SUPERVISEUR || msg->code == CODE_ANNUL_DEMANDE) {
-    size += nbDigits(msg->numv) + sizeof(char); // For NUMV + separator
+  const struct message_schema *schema = message_schema(msg->code);
+  int infos = 1; // Peers carried by FIELD_INFO, updated by FIELD_NB
+  struct field_blob blob;
+  int size = nbDigits(msg->code); // For CODE
+  // Each field is preceded by a separator
+  for (int f = 0; f < schema->count; f++) {
+    switch (FIELD_TYPE(schema->fields[f])) {
+      case FIELD_ID:
+        size += 1 + nbDigits(msg->id);
+        break;
+      case FIELD_MESS:
+        size += 1 + nbDigits(msg->lmess) + 1 + msg->lmess;
+        break;
+      case FIELD_SIG:
+        size += 1 + nbDigits(msg->lsig);
+        if (msg->lsig > 0) size += 1 + BASE64_LEN(msg->lsig);
+        break;
+      case FIELD_IP:
+        size += 1 + ip_text_len(&msg->ip);
+        break;
+      case FIELD_PORT:
+        size += 1 + nbDigits(msg->port);
+        break;
+      case FIELD_ENC:
+        size += 1 + nbDigits(msg->enc);
+        break;
+      case FIELD_NB:
+        size += 1 + nbDigits(msg->nb);
+        infos = msg->nb;
+        break;
+      case FIELD_INFO:
+        for (int i = 0; i < infos; i++) {
+          size += 1 + nbDigits(msg->info[i].id);
+          size += 1 + ip_text_len(&msg->info[i].ip);
+          size += 1 + nbDigits(msg->info[i].port);
+        }
+        break;
+      case FIELD_INFO_ENC:
+        for (int i = 0; i < infos; i++) size += 1 + nbDigits(msg->info[i].enc);
+        break;
+      case FIELD_CLE:
+        size += 1 + strlen(key_text(msg->cle));
+        break;
+      case FIELD_DH:
+      case FIELD_GKEY:
+      case FIELD_MAC:
+        message_field_blob(msg, schema->fields[f], &blob);
+        size += 1 + (*blob.len > 0 ? BASE64_LEN(*blob.len) : (int) strlen(NO_KEY));
+        break;
+      case FIELD_INFO_CLE:
+        for (int i = 0; i < infos; i++) size += 1 + strlen(key_text(msg->info[i].cle));
+        break;
+      case FIELD_NUMV:
+        size += 1 + nbDigits_u32(msg->numv);
+        break;
+      case FIELD_PRIX:
+        size += 1 + nbDigits_u32(msg->prix);
+        break;
+    }
   }
 
   size += 1; // +1 for ending null character
   return size;
 }
 
+#ifdef CODEC_SELF_CHECK
+// Decode what was just encoded: a signed message must give back the data
+// its signature covers, or no peer could check it
+static int check_encoded(struct message *msg, char *buffer, int len) {
+  if (msg->lsig == 0) return len;
+  struct message *back = init_message(msg->code);
+  if (back == NULL) return len;
+  unsigned char sent[MESSAGE_SIGNED_MAX];
+  unsigned char received[MESSAGE_SIGNED_MAX];
+  int sent_len = message_signed_data(msg, sent);
+  int received_len = decode_message(back, buffer, len) < 0 ? -1 : message_signed_data(back, received);
+  free_message(back);
+  if (received_len < 0 || received_len != sent_len || memcmp(sent, received, sent_len) != 0) {
+    fprintf(stderr, "Erreur: le message %d encodé ne se relit pas à l'identique\n", msg->code);
+    return -1;
+  }
+  return len;
+}
+#endif
+
 int message_to_buffer(struct message *msg, char *buffer, int buffer_size) {
   if (msg == NULL) {
     perror("Error: msg is NULL");
@@ -246,78 +248,114 @@ int message_to_buffer(struct message *msg, char *buffer, int buffer_size) {
     return -1;
   }
 
-  // Initialiser le buffer
-  memset(buffer, 0, buffer_size);
+  const struct message_schema *schema = message_schema(msg->code);
+  int infos = 1; // Peers carried by FIELD_INFO, updated by FIELD_NB
+  struct field_blob blob;
+  char ip_str[INET6_ADDRSTRLEN];
 
   // Fill the buffer with the serialized data
-  int offset = 0;
-  // Offset for code
-  offset += snprintf(buffer + offset, buffer_size - offset, "%d", msg->code);
-
-  if (msg->code != CODE_DEMANDE_LIAISON && msg->code != CODE_ID_ACCEPTED &&
-      msg->code != CODE_INFO_PAIR_BROADCAST && msg->code != CODE_INFO_PAIR) {
-    // Offset for ID
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->id);
-  }
-
-  if (msg->code == CODE_VALIDATION || msg->code == CODE_CONSENSUS) {
-    // Offset for LMESS and MESS
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->lmess);
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%s", msg->mess);
-    // Offset for LSIG and SIG
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->lsig);
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%s", msg->sig);
-  }
-
-  if (msg->code == CODE_REPONSE_LIAISON || msg->code == CODE_INFO_SYSTEME) {
-    // Offset for IP address
-    char ip_str[INET6_ADDRSTRLEN];
-    inet_ntop(AF_INET6, &msg->ip, ip_str, sizeof(ip_str));
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%s", ip_str);
-    // Offset for PORT
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->port);
-  }
-
-  if (msg->code == CODE_INFO_PAIR || msg->code == CODE_INFO_PAIR_BROADCAST || msg->code == CODE_INFO_SYSTEME) {
-    int max = 1;
-    if (msg->code == CODE_INFO_SYSTEME) {
-      max = msg->nb;
-      offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->nb);
-    }
-    for (int i = 0; i < max; i++) {
-      offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->info[i].id);
-      char info_ip_str[INET6_ADDRSTRLEN];
-      inet_ntop(AF_INET6, &msg->info[i].ip, info_ip_str, sizeof(info_ip_str));
-      offset += snprintf(buffer + offset, buffer_size - offset, "|%s", info_ip_str);
-      offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->info[i].port);
-      // TODO : Handle cle
-      // offset += snprintf(buffer + offset, buffer_size - offset, "|%s", msg->info[i].cle);
+  int offset = snprintf(buffer, buffer_size, "%d", msg->code);
+  for (int f = 0; f < schema->count && offset < buffer_size; f++) {
+    char *p = buffer + offset;
+    int left = buffer_size - offset;
+    switch (FIELD_TYPE(schema->fields[f])) {
+      case FIELD_ID:
+        offset += snprintf(p, left, "|%d", msg->id);
+        break;
+      case FIELD_MESS:
+        offset += snprintf(p, left, "|%d|%.*s", msg->lmess, msg->lmess, msg->mess ? msg->mess : "");
+        break;
+      case FIELD_SIG:
+        offset += snprintf(p, left, "|%d", msg->lsig);
+        if (msg->lsig > 0) {
+          // Raw bytes could contain the separator, SIG is sent in base64
+          if (offset + 1 + BASE64_LEN(msg->lsig) >= buffer_size) {
+            offset = buffer_size;
+            break;
+          }
+          buffer[offset++] = SEPARATOR[0];
+          offset += EVP_EncodeBlock((unsigned char *) buffer + offset,
+                                    (unsigned char *) msg->sig, msg->lsig);
+        }
+        break;
+      case FIELD_IP:
+        inet_ntop(AF_INET6, &msg->ip, ip_str, sizeof(ip_str));
+        offset += snprintf(p, left, "|%s", ip_str);
+        break;
+      case FIELD_PORT:
+        offset += snprintf(p, left, "|%d", msg->port);
+        break;
+      case FIELD_ENC:
+        offset += snprintf(p, left, "|%d", msg->enc);
+        break;
+      case FIELD_NB:
+        offset += snprintf(p, left, "|%d", msg->nb);
+        infos = msg->nb;
+        break;
+      case FIELD_INFO:
+        for (int i = 0; i < infos && offset < buffer_size; i++) {
+          inet_ntop(AF_INET6, &msg->info[i].ip, ip_str, sizeof(ip_str));
+          offset += snprintf(buffer + offset, buffer_size - offset, "|%d|%s|%d",
+                             msg->info[i].id, ip_str, msg->info[i].port);
+        }
+        break;
+      case FIELD_INFO_ENC:
+        // Encodings of each peer are appended after the peers, so that older
+        // peers which only read ID|IP|PORT groups simply ignore them
+        for (int i = 0; i < infos && offset < buffer_size; i++) {
+          offset += snprintf(buffer + offset, buffer_size - offset, "|%d", msg->info[i].enc);
+        }
+        break;
+      case FIELD_CLE:
+        offset += snprintf(p, left, "|%s", key_text(msg->cle));
+        break;
+      case FIELD_DH:
+      case FIELD_GKEY:
+      case FIELD_MAC:
+        message_field_blob(msg, schema->fields[f], &blob);
+        if (*blob.len == 0) {
+          offset += snprintf(p, left, "|%s", NO_KEY);
+          break;
+        }
+        if (offset + 1 + BASE64_LEN(*blob.len) >= buffer_size) {
+          offset = buffer_size;
+          break;
+        }
+        buffer[offset++] = SEPARATOR[0];
+        offset += EVP_EncodeBlock((unsigned char *) buffer + offset, blob.data, *blob.len);
+        break;
+      case FIELD_INFO_CLE:
+        for (int i = 0; i < infos && offset < buffer_size; i++) {
+          offset += snprintf(buffer + offset, buffer_size - offset, "|%s", key_text(msg->info[i].cle));
+        }
+        break;
+      case FIELD_NUMV:
+        offset += snprintf(p, left, "|%u", msg->numv);
+        break;
+      case FIELD_PRIX:
+        offset += snprintf(p, left, "|%u", msg->prix);
+        break;
     }
   }
 
-  // Add auction-specific fields if needed
-  if (msg->code == CODE_NOUVELLE_VENTE || msg->code == CODE_ENCHERE ||
-      msg->code == CODE_ENCHERE_SUPERVISEUR || msg->code == CODE_FIN_VENTE_WARNING ||
-      msg->code == CODE_FIN_VENTE || msg->code == CODE_REFUS_PRIX) {
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%u", msg->numv);
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%u", msg->prix);
-  } else if (msg->code == CODE_ANNUL_SUPERVISEUR || msg->code == CODE_ANNUL_DEMANDE) {
-    offset += snprintf(buffer + offset, buffer_size - offset, "|%u", msg->numv);
+  if (offset >= buffer_size) {
+    fprintf(stderr, "Error: buffer too small for message (CODE %d)\n", msg->code);
+    return -1;
   }
+#ifdef CODEC_SELF_CHECK
+  if (check_encoded(msg, buffer, offset + 1) < 0) return -1;
+#endif
   return 0;
 }
 
-int buffer_to_message(struct message *msg, char *buffer) {
+int buffer_to_message_in_place(struct message *msg, char *buffer, struct info *info, int max_info) {
   if(buffer == NULL) {
     perror("Error: buffer is NULL");
     return -1;
   }
   if (msg == NULL) {
-    msg = malloc(sizeof(struct message));
-    if (msg == NULL) {
-      perror("Error: malloc failed");
-      return -1;
-    }
+    perror("Error: msg is NULL");
+    return -1;
   }
 
   // Initialize fields to defaults
@@ -329,240 +367,324 @@ int buffer_to_message(struct message *msg, char *buffer) {
   msg->sig = NULL;
   memset(&msg->ip, 0, sizeof(struct in6_addr));
   msg->port = 0;
-  memset(msg->cle, 0, sizeof(msg->cle));
+  msg->cle[0] = '\0';
+  msg->enc = ENC_TEXT;
+  msg->ldh = 0;
+  msg->lgkey = 0;
+  msg->lmac = 0;
   msg->numv = 0;
   msg->prix = 0;
   msg->nb = 0;
+  msg->info = NULL;
 
   // Debug mode - désactivé pour réduire la verbosité
   // printf("Analyse du buffer: '%s'\n", buffer);
 
-  // Copy the buffer to avoid modifying the original
-  char *buffer_copy = strdup(buffer);
-  if (buffer_copy == NULL) {
-    perror("Error: strdup failed");
-    return -1;
-  }
-
+  // The buffer is tokenized in place, MESS and SIG point into it
   char *token;
-  char *saveptr;
+  int token_len = 0;
+  struct scan_tokens tokens;
+  scan_init(&tokens, buffer, SEPARATOR[0]);
 
   // Extract CODE
-  token = strtok_r(buffer_copy, SEPARATOR, &saveptr);
+  token = scan_next(&tokens, &token_len);
   if (token == NULL) {
     perror("Error: invalid buffer format (missing CODE)");
-    free(buffer_copy);
     return -1;
   }
-  msg->code = atoi(token);
-
-  if (msg->code != CODE_DEMANDE_LIAISON && msg->code != CODE_ID_ACCEPTED &&
-      msg->code != CODE_INFO_PAIR_BROADCAST && msg->code != CODE_INFO_PAIR) {
-    // Extract ID
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
-    if (token == NULL) {
-      perror("Error: invalid buffer format (missing ID)");
-      free(buffer_copy);
-      return -1;
+  msg->code = parse_uint(token, token_len);
+
+  const struct message_schema *schema = message_schema(msg->code);
+  int optional = 0; // Set once the optional fields are reached
+  int infos = 1;    // Peers carried by FIELD_INFO, updated by FIELD_NB
+  struct field_blob blob;
+  int blob_len;
+
+  for (int f = 0; f < schema->count; f++) {
+    int field = FIELD_TYPE(schema->fields[f]);
+    if (schema->fields[f] & FIELD_OPTIONAL) optional = 1;
+
+    // An empty peer list is written as nothing at all: its fields have no token
+    if (infos == 0 && (field == FIELD_INFO || field == FIELD_INFO_ENC || field == FIELD_INFO_CLE)) {
+      if (field == FIELD_INFO) msg->info = info;
+      continue;
     }
-    msg->id = (uint16_t)atoi(token);
-  }
 
-  if (msg->code == CODE_VALIDATION || msg->code == CODE_CONSENSUS) {
-    // Extract LMESS
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
+    token = scan_next(&tokens, &token_len);
     if (token == NULL) {
-      perror("Error: invalid buffer format (missing LMESS)");
-      free(buffer_copy);
-      return -1;
-    }
-    msg->lmess = (uint8_t) atoi(token);
-    // Extract MESS
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
-    if (token == NULL) {
-      perror("Error: invalid buffer format (missing MESS)");
-      free(buffer_copy);
-      return -1;
-    }
-    if (msg->lmess > 0) {
-      msg->mess = malloc(msg->lmess + 1);
-      if (msg->mess == NULL) {
-        perror("Error: malloc failed for mess");
-        free(buffer_copy);
+      if (!optional) {
+        fprintf(stderr, "Error: invalid buffer format (missing %s)\n", field_name(field));
         return -1;
       }
-      strncpy(msg->mess, token, msg->lmess);
-      msg->mess[msg->lmess] = '\0';
-    } else if (strlen(token) > 0) {
-      // Si LMESS est 0 mais qu'il y a un message, on l'affecte quand même
-      msg->lmess = strlen(token);
-      msg->mess = malloc(msg->lmess + 1);
-      if (msg->mess == NULL) {
-        perror("Error: malloc failed for mess");
-        free(buffer_copy);
-        return -1;
+      if (field == FIELD_NUMV || field == FIELD_PRIX) {
+        // Pas d'erreur critique si NUMV ou PRIX est manquant
+        printf("Warning: missing %s field\n", field_name(field));
       }
-      strcpy(msg->mess, token);
+      break; // The remaining fields are optional too
     }
 
-    // Extract LSIG
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
-    if (token == NULL) {
-      perror("Error: invalid buffer format (missing LSIG)");
-      free(buffer_copy);
-      if (msg->mess) free(msg->mess);
-      return -1;
-    }
-    msg->lsig = (uint8_t) atoi(token);
-
-    // Extract SIG (if present)
-    if (msg->lsig > 0) {
-      token = strtok_r(NULL, SEPARATOR, &saveptr);
-      if (token == NULL) {
-        perror("Error: invalid buffer format (missing SIG)");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        return -1;
-      }
-      msg->sig = malloc(msg->lsig + 1);
-      if (msg->sig == NULL) {
-        perror("Error: malloc failed for sig");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        return -1;
-      }
-      strncpy(msg->sig, token, msg->lsig);
-      msg->sig[msg->lsig] = '\0';
-    } else if (strlen(token) > 0) {
-      // Si LSIG est 0 mais qu'il y a une signature, on l'affecte quand même
-      msg->lsig = strlen(token);
-      msg->sig = malloc(msg->lsig + 1);
-      if (msg->sig == NULL) {
-        perror("Error: malloc failed for sig");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        return -1;
-      }
-      strcpy(msg->sig, token);
+    switch (field) {
+      case FIELD_ID:
+        msg->id = (uint16_t) parse_uint(token, token_len);
+        break;
+      case FIELD_MESS:
+        msg->lmess = (uint8_t) parse_uint(token, token_len);
+        token = scan_next(&tokens, &token_len);
+        if (token == NULL) {
+          perror("Error: invalid buffer format (missing MESS)");
+          return -1;
+        }
+        if (msg->lmess == 0 || msg->lmess > token_len) {
+          // Si LMESS est 0 mais qu'il y a un message, on l'affecte quand même
+          msg->lmess = token_len;
+        }
+        token[msg->lmess] = '\0';
+        if (msg->lmess > 0) msg->mess = token;
+        break;
+      case FIELD_SIG:
+        msg->lsig = (uint8_t) parse_uint(token, token_len);
+        token = scan_next(&tokens, &token_len);
+        if (token == NULL && msg->lsig > 0) {
+          perror("Error: invalid buffer format (missing SIG)");
+          return -1;
+        }
+        if (token != NULL) {
+          // SIG is decoded over its base64 form, which is longer
+          int sig_len = base64_decode_in_place(token, token_len);
+          if (sig_len < 0) {
+            fprintf(stderr, "Error: invalid buffer format (SIG is not base64)\n");
+            return -1;
+          }
+          if (msg->lsig == 0 || msg->lsig > sig_len) {
+            // Si LSIG est 0 mais qu'il y a une signature, on l'affecte quand même
+            msg->lsig = sig_len;
+          }
+          token[msg->lsig] = '\0';
+          if (msg->lsig > 0) msg->sig = token;
+        }
+        break;
+      case FIELD_IP:
+        if (inet_pton(AF_INET6, token, &msg->ip) <= 0) {
+          perror("Error: invalid IP address format");
+          return -1;
+        }
+        break;
+      case FIELD_PORT:
+        msg->port = (uint16_t) parse_uint(token, token_len);
+        break;
+      case FIELD_ENC:
+        msg->enc = (uint8_t) parse_uint(token, token_len);
+        break;
+      case FIELD_NB:
+        msg->nb = parse_uint(token, token_len);
+        infos = msg->nb;
+        if (infos < 0 || infos > max_info) {
+          // Not enough room in the caller's array, msg->nb tells how much is needed
+          return -1;
+        }
+        break;
+      case FIELD_INFO:
+        if (infos > max_info) return -1;
+        msg->info = info;
+        for (int i = 0; i < infos; i++) {
+          memset(&info[i], 0, sizeof(struct info));
+          info[i].enc = ENC_TEXT;
+          // The first token of the first peer is already read
+          if (i > 0) token = scan_next(&tokens, &token_len);
+          if (token == NULL) {
+            perror("Error: invalid buffer format (missing info ID)");
+            return -1;
+          }
+          info[i].id = (uint16_t) parse_uint(token, token_len);
+          token = scan_next(&tokens, &token_len);
+          if (token == NULL) {
+            perror("Error: invalid buffer format (missing info IP)");
+            return -1;
+          }
+          if (inet_pton(AF_INET6, token, &info[i].ip) <= 0) {
+            perror("Error: invalid info IP address format");
+            return -1;
+          }
+          token = scan_next(&tokens, &token_len);
+          if (token == NULL) {
+            perror("Error: invalid buffer format (missing info PORT)");
+            return -1;
+          }
+          info[i].port = (uint16_t) parse_uint(token, token_len);
+        }
+        break;
+      case FIELD_INFO_ENC:
+        for (int i = 0; i < infos && token != NULL; i++) {
+          if (i > 0) token = scan_next(&tokens, &token_len);
+          if (token != NULL && msg->info != NULL) msg->info[i].enc = (uint8_t) parse_uint(token, token_len);
+        }
+        break;
+      case FIELD_CLE:
+        if (strcmp(token, NO_KEY) != 0) snprintf(msg->cle, sizeof(msg->cle), "%s", token);
+        break;
+      case FIELD_DH:
+      case FIELD_GKEY:
+      case FIELD_MAC:
+        if (strcmp(token, NO_KEY) == 0) break;
+        message_field_blob(msg, field, &blob);
+        blob_len = base64_decode_in_place(token, token_len);
+        if (blob_len < 0 || blob_len > blob.cap) {
+          fprintf(stderr, "Error: invalid buffer format (bad %s)\n", field_name(field));
+          return -1;
+        }
+        memcpy(blob.data, token, blob_len);
+        *blob.len = blob_len;
+        break;
+      case FIELD_INFO_CLE:
+        for (int i = 0; i < infos && token != NULL; i++) {
+          if (i > 0) token = scan_next(&tokens, &token_len);
+          if (token != NULL && msg->info != NULL && strcmp(token, NO_KEY) != 0) {
+            snprintf(msg->info[i].cle, sizeof(msg->info[i].cle), "%s", token);
+          }
+        }
+        break;
+      case FIELD_NUMV:
+        msg->numv = parse_uint(token, token_len);
+        break;
+      case FIELD_PRIX:
+        msg->prix = parse_uint(token, token_len);
+        break;
     }
   }
+  return 0;
+}
 
-  if (msg->code == CODE_REPONSE_LIAISON || msg->code == CODE_INFO_SYSTEME) {
-    // Extract IP address
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
-    if (token == NULL) {
-      perror("Error: invalid buffer format (missing IP)");
-      free(buffer_copy);
-      if (msg->mess) free(msg->mess);
-      if (msg->sig) free(msg->sig);
+int message_detach(struct message *msg) {
+  if (msg == NULL) {
+    perror("Error: msg is NULL");
+    return -1;
+  }
+  char *mess = msg->mess;
+  char *sig = msg->sig;
+  struct info *info = msg->info;
+  msg->mess = NULL;
+  msg->sig = NULL;
+  msg->info = NULL;
+
+  if (mess != NULL) {
+    msg->mess = malloc(msg->lmess + 1);
+    if (msg->mess == NULL) goto nomem;
+    memcpy(msg->mess, mess, msg->lmess);
+    msg->mess[msg->lmess] = '\0';
+  }
+  if (sig != NULL) {
+    msg->sig = malloc(msg->lsig + 1);
+    if (msg->sig == NULL) goto nomem;
+    memcpy(msg->sig, sig, msg->lsig);
+    msg->sig[msg->lsig] = '\0';
+  }
+  if (info != NULL) {
+    int max = message_info_count(msg);
+    msg->info = pool_get_info(max);
+    if (msg->info == NULL) goto nomem;
+    memcpy(msg->info, info, max * sizeof(struct info));
+  }
+  return 0;
+
+ nomem:
+  perror("Error: malloc failed");
+  free(msg->mess);
+  free(msg->sig);
+  msg->mess = NULL;
+  msg->sig = NULL;
+  msg->info = NULL;
+  return -1;
+}
+
+int buffer_to_message(struct message *msg, char *buffer) {
+  if(buffer == NULL) {
+    perror("Error: buffer is NULL");
+    return -1;
+  }
+  return decode_message(msg, buffer, strlen(buffer) + 1);
+}
+
+int get_encoded_size(struct message *msg, int encoding) {
+  if (encoding == ENC_BINARY) return get_binary_size(msg);
+  return get_buffer_size(msg);
+}
+
+int encode_message(struct message *msg, int encoding, char *buffer, int buffer_size) {
+  if (encoding == ENC_BINARY) {
+    int len = message_to_binary(msg, (unsigned char *) buffer, buffer_size);
+#ifdef CODEC_SELF_CHECK
+    if (len > 0) len = check_encoded(msg, buffer, len);
+#endif
+    return len;
+  }
+  if (message_to_buffer(msg, buffer, buffer_size) < 0) return -1;
+  return strlen(buffer) + 1; // Text messages are sent with their '\0'
+}
+
+int decode_message_in_place(struct message *msg, char *buffer, int len, struct info *info, int max_info) {
+  if (is_binary_buffer(buffer, len)) {
+    return binary_to_message_in_place(msg, (unsigned char *) buffer, len, info, max_info);
+  }
+  return buffer_to_message_in_place(msg, buffer, info, max_info);
+}
+
+int decode_message_view(struct message_view *view, char *buffer, int len) {
+  if (view == NULL) {
+    perror("Error: view is NULL");
+    return -1;
+  }
+  return decode_message_in_place(&view->msg, buffer, len, view->info, MESSAGE_VIEW_INFO);
+}
+
+int decode_message(struct message *msg, char *buffer, int len) {
+  if (msg == NULL || buffer == NULL || len <= 0) {
+    perror("Error: msg or buffer is NULL");
+    return -1;
+  }
+  // Work on a copy to leave the caller's buffer untouched
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    perror("Error: malloc failed");
+    return -1;
+  }
+  memcpy(copy, buffer, len);
+  copy[len] = '\0';
+
+  struct info info[MESSAGE_VIEW_INFO];
+  int ret = decode_message_in_place(msg, copy, len, info, MESSAGE_VIEW_INFO);
+  if (ret < 0 && msg->nb > MESSAGE_VIEW_INFO) {
+    // Too many peers for the stack array, decode again into a heap array
+    int nb = msg->nb;
+    struct info *big = pool_get_info(nb);
+    if (big == NULL) {
+      perror("Error: malloc failed");
+      free(copy);
       return -1;
     }
-    if (inet_pton(AF_INET6, token, &msg->ip) <= 0) {
-      perror("Error: invalid IP address format");
-      free(buffer_copy);
-      if (msg->mess) free(msg->mess);
-      if (msg->sig) free(msg->sig);
+    memcpy(copy, buffer, len);
+    copy[len] = '\0';
+    if (decode_message_in_place(msg, copy, len, big, nb) < 0) {
+      pool_put_info(big);
+      free(copy);
+      msg->info = NULL;
       return -1;
     }
-    // Extract PORT
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
-    if (token == NULL) {
-      perror("Error: invalid buffer format (missing PORT)");
-      free(buffer_copy);
-      if (msg->mess) free(msg->mess);
-      if (msg->sig) free(msg->sig);
+    msg->info = NULL;
+    ret = message_detach(msg);
+    free(copy);
+    if (ret < 0) {
+      pool_put_info(big);
       return -1;
     }
-    msg->port = (uint16_t) atoi(token);
-  }
-
-  if (msg->code == CODE_INFO_PAIR || msg->code == CODE_INFO_PAIR_BROADCAST || msg->code == CODE_INFO_SYSTEME) {
-    int max = 1; // Default to 1 info
-    if (msg->code == CODE_INFO_SYSTEME) {
-      // More than one info is expected
-      token = strtok_r(NULL, SEPARATOR, &saveptr);
-      if (token == NULL) {
-        perror("Error: invalid buffer format (missing NB)");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        if (msg->sig) free(msg->sig);
-        return -1;
-      }
-      msg->nb = atoi(token);
-      max = msg->nb;
-    }
-    msg->info = malloc(sizeof (struct info) * max); // Allocate for at least one info
-    for (int i = 0; i < max; i++) {
-      // Extract info ID
-      token = strtok_r(NULL, SEPARATOR, &saveptr);
-      if (token == NULL) {
-        perror("Error: invalid buffer format (missing info ID)");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        if (msg->sig) free(msg->sig);
-        return -1;
-      }
-      msg->info[i].id = (uint16_t) atoi(token);
-      // Extract info IP
-      token = strtok_r(NULL, SEPARATOR, &saveptr);
-      if (token == NULL) {
-        perror("Error: invalid buffer format (missing info IP)");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        if (msg->sig) free(msg->sig);
-        return -1;
-      }
-      if (inet_pton(AF_INET6, token, &msg->info[i].ip) <= 0) {
-        perror("Error: invalid info IP address format");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        if (msg->sig) free(msg->sig);
-        return -1;
-      }
-      // Extract info PORT
-      token = strtok_r(NULL, SEPARATOR, &saveptr);
-      if (token == NULL) {
-        perror("Error: invalid buffer format (missing info PORT)");
-        free(buffer_copy);
-        if (msg->mess) free(msg->mess);
-        if (msg->sig) free(msg->sig);
-        return -1;
-      }
-      msg->info[i].port = (uint16_t) atoi(token);
-      // Extract info cle
-      // TODO : Handle cle
-    }
+    msg->info = big; // Already owned by us
+    return 0;
   }
-
-  if (msg->code == CODE_NOUVELLE_VENTE || msg->code == CODE_ENCHERE ||
-      msg->code == CODE_ENCHERE_SUPERVISEUR || msg->code == CODE_FIN_VENTE_WARNING ||
-      msg->code == CODE_FIN_VENTE || msg->code == CODE_REFUS_PRIX) {
-    // Extract NUMV
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
-    if (token == NULL) {
-      // Pas d'erreur critique si NUMV est manquant
-      printf("Warning: missing NUMV field\n");
-    } else {
-      msg->numv = (uint32_t)atoi(token);
-      // Extract PRIX
-      token = strtok_r(NULL, SEPARATOR, &saveptr);
-      if (token == NULL) {
-        // Pas d'erreur critique si PRIX est manquant
-        printf("Warning: missing PRIX field\n");
-      } else {
-        msg->prix = (uint32_t)atoi(token);
-      }
-    }
-  } else if (msg->code == CODE_ANNUL_SUPERVISEUR || msg->code == CODE_ANNUL_DEMANDE) {
-    token = strtok_r(NULL, SEPARATOR, &saveptr);
-    if (token == NULL) {
-      // Pas d'erreur critique si NUMV est manquant
-      printf("Warning: missing NUMV field\n");
-    } else {
-      msg->numv = (uint32_t)atoi(token);
-    }
+  if (ret == 0) ret = message_detach(msg);
+  if (ret < 0) {
+    msg->mess = NULL;
+    msg->sig = NULL;
+    msg->info = NULL;
   }
-  // Release memory
-  free(buffer_copy);
-  return 0;
+  free(copy);
+  return ret;
 }
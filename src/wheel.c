@@ -0,0 +1,193 @@
+#include "include/wheel.h"
+#include "include/event.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) // Ticks covered by the wheel
+#define WHEEL_NEVER UINT64_MAX
+
+static struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t occupied[WHEEL_LEVELS];  // Bit i set if slot i of the level has timers
+static uint64_t current = 0;             // Next tick to process
+static uint64_t origin = 0;              // Time of tick 0 (ms)
+static uint64_t armed = WHEEL_NEVER;     // Tick the timerfd fires at
+static int timer_fd = -1;
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER; // Slots, bitmaps, current, armed
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Tick in progress
+static uint64_t now_tick(void) {
+  return (now_ms() - origin) / WHEEL_TICK_MS;
+}
+
+static void unlink_timer(struct wheel_timer *timer) {
+  *timer->pprev = timer->next;
+  if (timer->next != NULL) timer->next->pprev = timer->pprev;
+  // Last timer of a slot (and not of the list being expired): the slot is empty
+  struct wheel_timer **first = &slots[0][0];
+  if (*timer->pprev == NULL && timer->pprev >= first && timer->pprev < first + WHEEL_LEVELS * WHEEL_SLOTS) {
+    int i = timer->pprev - first;
+    occupied[i / WHEEL_SLOTS] &= ~((uint64_t) 1 << (i % WHEEL_SLOTS));
+  }
+  timer->next = NULL;
+  timer->pprev = NULL;
+}
+
+// Slot of a timer, by how far it is from the current tick
+static void link_timer(struct wheel_timer *timer) {
+  if (timer->expires < current) timer->expires = current;
+  uint64_t delta = timer->expires - current;
+  if (delta >= WHEEL_SPAN) {
+    delta = WHEEL_SPAN - 1;
+    timer->expires = current + delta;
+  }
+
+  int level = 0;
+  while (level < WHEEL_LEVELS - 1 && delta >= (uint64_t) 1 << (WHEEL_BITS * (level + 1))) level++;
+  int slot = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+  struct wheel_timer **head = &slots[level][slot];
+  timer->next = *head;
+  if (*head != NULL) (*head)->pprev = &timer->next;
+  timer->pprev = head;
+  *head = timer;
+  occupied[level] |= (uint64_t) 1 << slot;
+}
+
+// Move the timers of a slot down, now that they are close enough
+static void cascade(int level, int slot) {
+  struct wheel_timer *timer = slots[level][slot];
+  slots[level][slot] = NULL;
+  occupied[level] &= ~((uint64_t) 1 << slot);
+  while (timer != NULL) {
+    struct wheel_timer *next = timer->next;
+    link_timer(timer);
+    timer = next;
+  }
+}
+
+// Distance from a slot to the next occupied one, going round the level
+static int distance(uint64_t bits, int from) {
+  uint64_t rotated = from ? bits >> from | bits << (WHEEL_SLOTS - from) : bits;
+  return __builtin_ctzll(rotated);
+}
+
+// Next tick with work to do: a slot of level 0 or a cascade, WHEEL_NEVER if none
+static uint64_t next_tick(void) {
+  uint64_t next = WHEEL_NEVER;
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    if (occupied[level] == 0) continue;
+    // Slot i of a level is moved down at the ticks whose digit of the level is i
+    // and whose lower digits are 0; level 0 is processed at every tick
+    int shift = WHEEL_BITS * level;
+    uint64_t unit = (current + ((uint64_t) 1 << shift) - 1) >> shift;
+    uint64_t tick = (unit + distance(occupied[level], unit & WHEEL_MASK)) << shift;
+    if (tick < next) next = tick;
+  }
+  return next;
+}
+
+// Make the timerfd fire at the next tick with work to do, if it would fire later
+static void arm(int force) {
+  if (timer_fd < 0) return;
+  uint64_t next = next_tick();
+  if (next == WHEEL_NEVER || (!force && armed <= next)) return;
+  uint64_t at = origin + next * WHEEL_TICK_MS;
+  uint64_t now = now_ms();
+  int delay = at > now ? (int) (at - now) : 1;
+  if (event_set_timer(timer_fd, delay, 0) == 0) armed = next;
+}
+
+// Call the handlers of the timers expired by now
+static void run(void) {
+  pthread_mutex_lock(&wheel_lock);
+  uint64_t until = now_tick();
+  while (current <= until) {
+    int slot = current & WHEEL_MASK;
+    if (slot == 0) {
+      // Level 0 wraps: bring the slot of each level above down, as long as they wrap too
+      for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int upper = (current >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        cascade(level, upper);
+        if (upper != 0) break;
+      }
+    }
+    // Take the slot: a timer scheduled by a handler may land in it again
+    struct wheel_timer *expired = slots[0][slot];
+    slots[0][slot] = NULL;
+    occupied[0] &= ~((uint64_t) 1 << slot);
+    if (expired != NULL) expired->pprev = &expired;
+    current++;
+
+    // A handler, or another thread, may cancel the next timers of the list
+    struct wheel_timer *timer;
+    while ((timer = expired) != NULL) {
+      unlink_timer(timer);
+      wheel_handler handler = timer->handler;
+      void *arg = timer->arg;
+      pthread_mutex_unlock(&wheel_lock);
+      handler(timer, arg);
+      pthread_mutex_lock(&wheel_lock);
+    }
+  }
+  armed = WHEEL_NEVER;
+  arm(1);
+  pthread_mutex_unlock(&wheel_lock);
+}
+
+static void on_tick(int fd, uint32_t events, void *arg) {
+  (void) fd;
+  (void) events;
+  (void) arg;
+  run();
+}
+
+int wheel_init(void) {
+  memset(slots, 0, sizeof(slots));
+  memset(occupied, 0, sizeof(occupied));
+  origin = now_ms();
+  current = 0;
+  armed = WHEEL_NEVER;
+  // Created disarmed, armed for the first timer
+  timer_fd = event_add_timer(0, 0, on_tick, NULL);
+  return timer_fd < 0 ? -1 : 0;
+}
+
+void wheel_timer_init(struct wheel_timer *timer, wheel_handler handler, void *arg) {
+  memset(timer, 0, sizeof(struct wheel_timer));
+  timer->handler = handler;
+  timer->arg = arg;
+}
+
+void wheel_schedule(struct wheel_timer *timer, int delay_ms) {
+  pthread_mutex_lock(&wheel_lock);
+  if (timer->pprev != NULL) unlink_timer(timer);
+  // Round up: never before the delay
+  uint64_t at = now_ms() - origin + (delay_ms > 0 ? delay_ms : 0);
+  timer->expires = (at + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+  link_timer(timer);
+  arm(0);
+  pthread_mutex_unlock(&wheel_lock);
+}
+
+void wheel_cancel(struct wheel_timer *timer) {
+  // The timerfd stays armed: waking for nothing is cheaper than disarming
+  pthread_mutex_lock(&wheel_lock);
+  if (timer->pprev != NULL) unlink_timer(timer);
+  pthread_mutex_unlock(&wheel_lock);
+}
+
+int wheel_pending(const struct wheel_timer *timer) {
+  pthread_mutex_lock(&wheel_lock);
+  int pending = timer->pprev != NULL;
+  pthread_mutex_unlock(&wheel_lock);
+  return pending;
+}